@@ -0,0 +1,77 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/renderer.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+
+using engine::renderer_vulkan;
+
+const uint32_t WIDTH = 1920;
+const uint32_t HEIGHT = 1080;
+const uint32_t WARMUP_FRAMES = 20;
+const uint32_t DEFAULT_MEASURED_FRAMES = 2000;
+const uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+
+// Renders the same scene headless with an increasing number of frames in flight, to show how much of the frame time
+// is hidden by letting the CPU record ahead of the GPU.
+int main(int argc, char** argv)
+{
+	uint32_t measured_frames = DEFAULT_MEASURED_FRAMES;
+	if (argc > 1)
+		measured_frames = (uint32_t)std::strtoul(argv[1], nullptr, 10);
+
+	if (measured_frames == 0)
+	{
+		std::cerr << "Usage: HeadlessBenchmark [frame count]" << std::endl;
+		return -1;
+	}
+
+	std::cout << std::format("Rendering {} frames at {}x{}", measured_frames, WIDTH, HEIGHT) << std::endl;
+
+	double single_frame_fps = 0.0;
+	for (uint32_t frames_in_flight = 1; frames_in_flight <= MAX_FRAMES_IN_FLIGHT; ++frames_in_flight)
+	{
+		auto renderer = renderer_vulkan::create_headless(WIDTH, HEIGHT, renderer_vulkan::debug_output::disabled, frames_in_flight);
+		if (renderer == nullptr)
+			return -1;
+
+		for (uint32_t i = 0; i < WARMUP_FRAMES; ++i)
+			renderer->render();
+		renderer->wait_idle();
+
+		if (auto* profiler = renderer->profiler())
+		{
+			profiler->collect();
+			profiler->reset_history();
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0; i < measured_frames; ++i)
+			renderer->render();
+		renderer->wait_idle();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		double fps = measured_frames / elapsed.count();
+		if (frames_in_flight == 1)
+			single_frame_fps = fps;
+
+		std::cout << std::format("\t{} frame(s) in flight: {:.1f} fps ({:.3f} ms/frame, {:.2f}x)", frames_in_flight, fps,
+								 elapsed.count() * 1000.0 / measured_frames, fps / single_frame_fps)
+				  << std::endl;
+
+		// The GPU time doesn't depend on the frames in flight, how much of it the CPU overlaps does.
+		if (auto* profiler = renderer->profiler())
+		{
+			profiler->collect();
+			profiler->output_statistics();
+		}
+	}
+
+	return 0;
+}
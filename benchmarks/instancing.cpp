@@ -0,0 +1,219 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "datastructures/fixed_vector.h"
+#include "engine/backend/vulkan/renderer.h"
+#include "math/math.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <string>
+
+using datastructures::fixed_vector;
+using engine::mesh_draw_mode;
+using engine::mesh_instance;
+using engine::mesh_vertex;
+using engine::renderer_vulkan;
+
+const uint32_t WIDTH = 1920;
+const uint32_t HEIGHT = 1080;
+const uint32_t WARMUP_FRAMES = 20;
+const uint32_t DEFAULT_MEASURED_FRAMES = 200;
+const uint32_t GRID_X = 50;
+const uint32_t GRID_Y = 40;
+const uint32_t GRID_Z = 50;
+const float GRID_SPACING = 2.f;
+
+// Unit cube with a normal per face, wound counter clockwise seen from outside.
+void create_cube(fixed_vector<mesh_vertex>& vertices, fixed_vector<uint32_t>& indices)
+{
+	struct face
+	{
+		math::vec3 normal, u, v;
+	};
+
+	// u x v == normal for every face, which gives the winding.
+	face const faces[]{
+		{ { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, 0.f, 1.f } },
+		{ { -1.f, 0.f, 0.f }, { 0.f, 0.f, 1.f }, { 0.f, 1.f, 0.f } },
+		{ { 0.f, 1.f, 0.f }, { 0.f, 0.f, 1.f }, { 1.f, 0.f, 0.f } },
+		{ { 0.f, -1.f, 0.f }, { 1.f, 0.f, 0.f }, { 0.f, 0.f, 1.f } },
+		{ { 0.f, 0.f, 1.f }, { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f } },
+		{ { 0.f, 0.f, -1.f }, { 0.f, 1.f, 0.f }, { 1.f, 0.f, 0.f } }
+	};
+
+	float const corners[4][2]{ { -1.f, -1.f }, { 1.f, -1.f }, { 1.f, 1.f }, { -1.f, 1.f } };
+	uint32_t const corner_indices[]{ 0, 1, 2, 0, 2, 3 };
+
+	for (uint32_t f = 0; f < 6; ++f)
+	{
+		auto const& current = faces[f];
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			auto position = current.normal + current.u * corners[c][0] + current.v * corners[c][1];
+			vertices[f * 4 + c] = { position * 0.5f, current.normal, { (corners[c][0] + 1.f) * 0.5f, (corners[c][1] + 1.f) * 0.5f } };
+		}
+
+		for (uint32_t i = 0; i < 6; ++i)
+			indices[f * 6 + i] = f * 4 + corner_indices[i];
+	}
+}
+
+double measure(renderer_vulkan& renderer, uint32_t frame_count)
+{
+	for (uint32_t i = 0; i < WARMUP_FRAMES; ++i)
+		renderer.render();
+	renderer.wait_idle();
+
+	// Only the measured frames count, the warm up frames still in the queries are collected and discarded.
+	if (auto* statistics = renderer.statistics())
+	{
+		statistics->collect();
+		statistics->reset_totals();
+	}
+
+	if (auto* profiler = renderer.profiler())
+	{
+		profiler->collect();
+		profiler->reset_history();
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < frame_count; ++i)
+		renderer.render();
+	renderer.wait_idle();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	if (auto* statistics = renderer.statistics())
+		statistics->collect();
+
+	if (auto* profiler = renderer.profiler())
+		profiler->collect();
+
+	return elapsed.count();
+}
+
+// GPU culling runs as two passes ahead of the scene. Resetting the draw commands, culling into them and drawing from
+// them take a buffer barrier each after the first, next to the transitions of the frame's image, its transient depth
+// and the final one to TRANSFER_SRC. Any other count means the graph dropped or added a barrier.
+bool check_culling_graph(renderer_vulkan const& renderer)
+{
+	constexpr uint32_t EXPECTED_BARRIERS = 5;
+
+	auto const* graph = renderer.last_render_graph();
+	if (graph == nullptr)
+		return true;
+
+	graph->output_compiled_graph();
+	if (graph->culled_pass_count() != 0 || graph->barrier_count() != EXPECTED_BARRIERS || graph->transient_memory_size() == 0)
+	{
+		std::cerr << std::format("Unexpected culling graph: {} culled pass(es), {} barrier(s) instead of {}, {} bytes of transient memory",
+								 graph->culled_pass_count(), graph->barrier_count(), EXPECTED_BARRIERS, graph->transient_memory_size())
+				  << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// Draws a grid of 100k cubes with a single instanced draw, with a draw call per cube and with GPU culling, to measure
+// how many draws the CPU can submit, what instancing saves and what culling the instances outside the view saves.
+int main(int argc, char** argv)
+{
+	uint32_t measured_frames = DEFAULT_MEASURED_FRAMES;
+	if (argc > 1)
+		measured_frames = (uint32_t)std::strtoul(argv[1], nullptr, 10);
+
+	if (measured_frames == 0)
+	{
+		std::cerr << "Usage: InstancingBenchmark [frame count]" << std::endl;
+		return -1;
+	}
+
+	auto renderer = renderer_vulkan::create_headless(WIDTH, HEIGHT, renderer_vulkan::debug_output::disabled);
+	if (renderer == nullptr)
+		return -1;
+
+	fixed_vector<mesh_vertex> vertices(24);
+	fixed_vector<uint32_t> indices(36);
+	create_cube(vertices, indices);
+
+	auto cube = renderer->create_mesh(vertices.data(), (uint32_t)vertices.size(), indices.data(), (uint32_t)indices.size());
+	if (!cube.has_value())
+		return -1;
+
+	uint32_t const instance_count = GRID_X * GRID_Y * GRID_Z;
+	fixed_vector<mesh_instance> instances(instance_count);
+	math::vec3 grid_center{ (GRID_X - 1) * GRID_SPACING * 0.5f, (GRID_Y - 1) * GRID_SPACING * 0.5f, (GRID_Z - 1) * GRID_SPACING * 0.5f };
+	for (uint32_t x = 0; x < GRID_X; ++x)
+	{
+		for (uint32_t y = 0; y < GRID_Y; ++y)
+		{
+			for (uint32_t z = 0; z < GRID_Z; ++z)
+			{
+				auto& instance = instances[(x * GRID_Y + y) * GRID_Z + z];
+				math::vec3 position{ x * GRID_SPACING, y * GRID_SPACING, z * GRID_SPACING };
+				instance.transform = math::translation(position - grid_center) * math::scaling(0.8f);
+				instance.color[0] = (float)x / GRID_X;
+				instance.color[1] = (float)y / GRID_Y;
+				instance.color[2] = (float)z / GRID_Z;
+				instance.color[3] = 1.f;
+			}
+		}
+	}
+
+	if (!renderer->add_instances(cube.value(), instances.data(), instance_count))
+		return -1;
+
+	auto view = math::look_at({ 110.f, 80.f, 140.f }, { 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f });
+	auto projection = math::perspective(1.0472f, (float)WIDTH / HEIGHT, 0.1f, 1000.f);
+	renderer->set_view_projection(projection * view);
+
+	// The first frame submits the uploads, the ones after it can draw once they have finished.
+	renderer->render();
+	renderer->wait_idle();
+
+	std::cout << std::format("Rendering {} frames of {} instances at {}x{}", measured_frames, instance_count, WIDTH, HEIGHT) << std::endl;
+
+	double instanced_seconds = 0.0;
+	for (auto mode : { mesh_draw_mode::instanced, mesh_draw_mode::individual, mesh_draw_mode::gpu_driven })
+	{
+		renderer->set_mesh_draw_mode(mode);
+		auto seconds = measure(*renderer, measured_frames);
+		if (mode == mesh_draw_mode::instanced)
+			instanced_seconds = seconds;
+
+		char const* name = mode == mesh_draw_mode::instanced ? "instanced" : mode == mesh_draw_mode::individual ? "individual" : "gpu driven";
+		auto draws = mode == mesh_draw_mode::instanced	 ? std::string("1 draw")
+					 : mode == mesh_draw_mode::individual ? std::format("{} draws", instance_count)
+														  : std::string("1 indirect draw");
+		std::cout << std::format("\t{}: {:.3f} ms/frame, {} per frame, {:.1f}M instances/s ({:.2f}x the instanced frame time)",
+								 name, seconds * 1000.0 / measured_frames, draws, (double)instance_count * measured_frames / seconds / 1e6,
+								 seconds / instanced_seconds)
+				  << std::endl;
+
+		// Vertex invocations tell how much geometry culling removed, fragment invocations how much overdraw is left.
+		if (auto* statistics = renderer->statistics(); statistics != nullptr && statistics->total_frame_count() > 0)
+		{
+			auto const& totals = statistics->totals();
+			auto frames = (double)statistics->total_frame_count();
+			std::cout << std::format("\t\t{:.0f} vertex shader invocations, {:.0f} clipped primitives, {:.0f} fragment shader invocations per frame",
+									 totals.vertex_shader_invocations / frames, totals.clipping_primitives / frames,
+									 totals.fragment_shader_invocations / frames)
+					  << std::endl;
+		}
+
+		// What the frame time is made of on the GPU: culling against drawing the scene.
+		if (auto* profiler = renderer->profiler())
+			profiler->output_statistics();
+
+		if (mode == mesh_draw_mode::gpu_driven && !check_culling_graph(*renderer))
+			return -1;
+	}
+
+	return 0;
+}
@@ -20,6 +20,11 @@ namespace datastructures
 		{
 			std::memcpy(m_data, other.data(), sizeof(T) * m_size);
 		}
+		fixed_vector(fixed_vector<T>&& other) noexcept : m_data(other.m_data), m_size(other.m_size)
+		{
+			other.m_data = nullptr;
+			other.m_size = 0;
+		}
 		fixed_vector(std::initializer_list<T> initializer_list) : m_data(new T[initializer_list.size()]), m_size(initializer_list.size())
 		{
 			auto i = 0;
@@ -32,6 +37,29 @@ namespace datastructures
 
 		~fixed_vector() { delete[] m_data; }
 
+		fixed_vector<T>& operator=(fixed_vector<T>&& other) noexcept
+		{
+			if (this != &other)
+			{
+				delete[] m_data;
+				m_data = other.m_data;
+				m_size = other.m_size;
+				other.m_data = nullptr;
+				other.m_size = 0;
+			}
+
+			return *this;
+		}
+
+		constexpr T* begin() noexcept { return m_data; }
+		constexpr T* end() noexcept { return m_data + m_size; }
+
+		constexpr T const* begin() const noexcept { return m_data; }
+		constexpr T const* end() const noexcept { return m_data + m_size; }
+
+		constexpr T const* cbegin() const noexcept { return m_data; }
+		constexpr T const* cend() const noexcept { return m_data + m_size; }
+
 		constexpr T const& at(size_t pos) const
 		{
 			assert(pos < m_size);
@@ -0,0 +1,17 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace datastructures
+{
+	// Mixes the hash of a value into an existing seed (the boost::hash_combine constant, widened to 64 bits).
+	constexpr void hash_combine(size_t& seed, size_t value)
+	{
+		seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+	}
+}
@@ -30,7 +30,7 @@ namespace datastructures
 			m_value = value;
 		}
 
-		bool operator!=(optional<T> const& rhs)
+		bool operator!=(optional<T> const& rhs) const
 		{
 			return has_value() != rhs.has_value() || value() != rhs.value();
 		}
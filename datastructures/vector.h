@@ -85,6 +85,34 @@ namespace datastructures
 			m_data[m_size - 1] = value;
 		}
 
+		void insert(size_t pos, T const& value)
+		{
+			assert(pos <= m_size);
+			T copy = value;
+			push_back(copy);
+			std::memmove(m_data + pos + 1, m_data + pos, sizeof(T) * (m_size - 1 - pos));
+			m_data[pos] = copy;
+		}
+
+		void erase(size_t pos)
+		{
+			assert(pos < m_size);
+			std::memmove(m_data + pos, m_data + pos + 1, sizeof(T) * (m_size - 1 - pos));
+			--m_size;
+		}
+
+		void pop_back()
+		{
+			assert(m_size > 0);
+			--m_size;
+		}
+
+		constexpr T& back()
+		{
+			assert(m_size > 0);
+			return m_data[m_size - 1];
+		}
+
 		bool contains(T const& value) const
 		{
 			for (auto i = 0; i < m_size; ++i)
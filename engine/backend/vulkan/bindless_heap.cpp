@@ -0,0 +1,225 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/bindless_heap.h"
+
+#include "engine/backend/vulkan/formatters.h"
+
+#include <algorithm>
+#include <format>
+#include <iostream>
+
+namespace engine
+{
+	std::unique_ptr<bindless_heap> bindless_heap::create(VkPhysicalDevice physical_device, VkDevice device, VolkDeviceTable const& device_functions,
+														 uint32_t max_textures /* = DEFAULT_MAX_TEXTURES */,
+														 uint32_t max_buffers /* = DEFAULT_MAX_BUFFERS */)
+	{
+		VkPhysicalDeviceVulkan12Properties vulkan12_properties{};
+		vulkan12_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+
+		VkPhysicalDeviceProperties2 properties{};
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+		properties.pNext = &vulkan12_properties;
+		vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+		// Combined image samplers count as both a sampled image and a sampler. Both bindings are visible to every stage,
+		// so each stage sees all of them, which also counts against the per stage total of all descriptor types.
+		auto const& limits = vulkan12_properties;
+		auto textures = std::min({ max_textures, limits.maxDescriptorSetUpdateAfterBindSampledImages,
+								   limits.maxPerStageDescriptorUpdateAfterBindSampledImages, limits.maxDescriptorSetUpdateAfterBindSamplers,
+								   limits.maxPerStageDescriptorUpdateAfterBindSamplers });
+		auto buffers = std::min({ max_buffers, limits.maxDescriptorSetUpdateAfterBindStorageBuffers,
+								  limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+		if ((uint64_t)textures + buffers > limits.maxPerStageUpdateAfterBindResources)
+		{
+			// Split the total in the ratio that was asked for.
+			auto total = limits.maxPerStageUpdateAfterBindResources;
+			auto scaled_textures = (uint32_t)((uint64_t)total * textures / ((uint64_t)textures + buffers));
+			buffers = std::min(buffers, total - scaled_textures);
+			textures = scaled_textures;
+		}
+
+		if (textures < max_textures || buffers < max_buffers)
+			std::cout << std::format("Bindless descriptor heap reduced from {} to {} textures and from {} to {} buffers by the device limits",
+									 max_textures, textures, max_buffers, buffers)
+					  << std::endl;
+
+		max_textures = textures;
+		max_buffers = buffers;
+
+		auto heap = std::make_unique<bindless_heap>(device, device_functions);
+		heap->m_textures.capacity = max_textures;
+		heap->m_buffers.capacity = max_buffers;
+
+		VkDescriptorSetLayoutBinding bindings[2]{};
+		bindings[0].binding = TEXTURE_BINDING;
+		bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[0].descriptorCount = max_textures;
+		bindings[0].stageFlags = VK_SHADER_STAGE_ALL;
+		bindings[1].binding = BUFFER_BINDING;
+		bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[1].descriptorCount = max_buffers;
+		bindings[1].stageFlags = VK_SHADER_STAGE_ALL;
+
+		VkDescriptorBindingFlags const binding_flags[2]{
+			VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+			VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+		};
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_create_info{};
+		binding_flags_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+		binding_flags_create_info.pBindingFlags = binding_flags;
+		binding_flags_create_info.bindingCount = 2;
+
+		VkDescriptorSetLayoutCreateInfo layout_create_info{};
+		layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layout_create_info.pNext = &binding_flags_create_info;
+		layout_create_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+		layout_create_info.pBindings = bindings;
+		layout_create_info.bindingCount = 2;
+
+		auto result = device_functions.vkCreateDescriptorSetLayout(device, &layout_create_info, nullptr, &heap->m_set_layout);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create bindless descriptor set layout: {}", result) << std::endl;
+			return nullptr;
+		}
+
+		VkDescriptorPoolSize const pool_sizes[2]{
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, max_textures },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, max_buffers }
+		};
+
+		VkDescriptorPoolCreateInfo pool_create_info{};
+		pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		pool_create_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+		pool_create_info.maxSets = 1;
+		pool_create_info.pPoolSizes = pool_sizes;
+		pool_create_info.poolSizeCount = 2;
+
+		result = device_functions.vkCreateDescriptorPool(device, &pool_create_info, nullptr, &heap->m_pool);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create bindless descriptor pool: {}", result) << std::endl;
+			return nullptr;
+		}
+
+		VkDescriptorSetAllocateInfo allocate_info{};
+		allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocate_info.descriptorPool = heap->m_pool;
+		allocate_info.pSetLayouts = &heap->m_set_layout;
+		allocate_info.descriptorSetCount = 1;
+
+		result = device_functions.vkAllocateDescriptorSets(device, &allocate_info, &heap->m_descriptor_set);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to allocate bindless descriptor set: {}", result) << std::endl;
+			return nullptr;
+		}
+
+		std::cout << std::format("Bindless descriptor heap with {} textures and {} buffers", max_textures, max_buffers) << std::endl;
+		return heap;
+	}
+
+	bool bindless_heap::is_supported(VkPhysicalDeviceFeatures const& features, VkPhysicalDeviceVulkan12Features const& vulkan12_features)
+	{
+		// Buffers are indexed with a push constant, textures with a per instance material that differs within a draw.
+		return features.shaderStorageBufferArrayDynamicIndexing && vulkan12_features.descriptorIndexing &&
+			vulkan12_features.shaderSampledImageArrayNonUniformIndexing && vulkan12_features.runtimeDescriptorArray &&
+			vulkan12_features.descriptorBindingPartiallyBound && vulkan12_features.descriptorBindingSampledImageUpdateAfterBind &&
+			vulkan12_features.descriptorBindingStorageBufferUpdateAfterBind;
+	}
+
+	bindless_heap::~bindless_heap()
+	{
+		if (m_pool != VK_NULL_HANDLE)
+			m_device_functions.vkDestroyDescriptorPool(m_device, m_pool, nullptr);
+
+		if (m_set_layout != VK_NULL_HANDLE)
+			m_device_functions.vkDestroyDescriptorSetLayout(m_device, m_set_layout, nullptr);
+	}
+
+	uint32_t bindless_heap::add_texture(VkImageView image_view, VkSampler sampler, VkImageLayout layout /* = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL */)
+	{
+		auto index = m_textures.allocate();
+		if (index == INVALID_INDEX)
+		{
+			std::cerr << std::format("Failed to add texture, all {} bindless texture slots are in use", m_textures.capacity) << std::endl;
+			return INVALID_INDEX;
+		}
+
+		VkDescriptorImageInfo image_info{ sampler, image_view, layout };
+
+		VkWriteDescriptorSet write{};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = m_descriptor_set;
+		write.dstBinding = TEXTURE_BINDING;
+		write.dstArrayElement = index;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.pImageInfo = &image_info;
+
+		m_device_functions.vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+		return index;
+	}
+
+	uint32_t bindless_heap::add_buffer(VkBuffer buffer, VkDeviceSize offset /* = 0 */, VkDeviceSize range /* = VK_WHOLE_SIZE */)
+	{
+		auto index = m_buffers.allocate();
+		if (index == INVALID_INDEX)
+		{
+			std::cerr << std::format("Failed to add buffer, all {} bindless buffer slots are in use", m_buffers.capacity) << std::endl;
+			return INVALID_INDEX;
+		}
+
+		VkDescriptorBufferInfo buffer_info{ buffer, offset, range };
+
+		VkWriteDescriptorSet write{};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = m_descriptor_set;
+		write.dstBinding = BUFFER_BINDING;
+		write.dstArrayElement = index;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.pBufferInfo = &buffer_info;
+
+		m_device_functions.vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+		return index;
+	}
+
+	void bindless_heap::remove_texture(uint32_t index)
+	{
+		m_textures.free(index);
+	}
+
+	void bindless_heap::remove_buffer(uint32_t index)
+	{
+		m_buffers.free(index);
+	}
+
+	void bindless_heap::bind(VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point, VkPipelineLayout layout, uint32_t set /* = 0 */) const
+	{
+		m_device_functions.vkCmdBindDescriptorSets(command_buffer, bind_point, layout, set, 1, &m_descriptor_set, 0, nullptr);
+	}
+
+	uint32_t bindless_heap::slot_allocator::allocate()
+	{
+		if (!free_slots.empty())
+		{
+			auto index = free_slots.back();
+			free_slots.pop_back();
+			return index;
+		}
+
+		return next < capacity ? next++ : INVALID_INDEX;
+	}
+
+	void bindless_heap::slot_allocator::free(uint32_t index)
+	{
+		if (index < next)
+			free_slots.push_back(index);
+	}
+}
@@ -0,0 +1,80 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "datastructures/vector.h"
+
+#include <memory>
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	// One global descriptor set with an array of every sampled texture and every storage buffer, built on descriptor
+	// indexing. Shaders index into the arrays, so the set is bound once per command buffer and draws that use
+	// different resources no longer need their own descriptor sets. Slots are written with update after bind and the
+	// arrays are partially bound, so resources can be added while the set is in use by frames in flight.
+	class bindless_heap
+	{
+	public:
+		static constexpr uint32_t TEXTURE_BINDING = 0;
+		static constexpr uint32_t BUFFER_BINDING = 1;
+		static constexpr uint32_t INVALID_INDEX = ~0u;
+
+		static constexpr uint32_t DEFAULT_MAX_TEXTURES = 16384;
+		static constexpr uint32_t DEFAULT_MAX_BUFFERS = 4096;
+
+		// The counts are clamped to the update after bind limits of the device. Expects the descriptor indexing
+		// features the heap relies on to be enabled, see is_supported.
+		static std::unique_ptr<bindless_heap> create(VkPhysicalDevice, VkDevice, VolkDeviceTable const&,
+													 uint32_t max_textures = DEFAULT_MAX_TEXTURES,
+													 uint32_t max_buffers = DEFAULT_MAX_BUFFERS);
+		static bool is_supported(VkPhysicalDeviceFeatures const&, VkPhysicalDeviceVulkan12Features const&);
+
+		bindless_heap(VkDevice device, VolkDeviceTable const& device_functions)
+			: m_device(device), m_device_functions(device_functions) {}
+		~bindless_heap();
+
+		bindless_heap(bindless_heap const&) = delete;
+		bindless_heap& operator=(bindless_heap const&) = delete;
+
+		// Both return INVALID_INDEX when the array is full.
+		uint32_t add_texture(VkImageView, VkSampler, VkImageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		uint32_t add_buffer(VkBuffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+
+		// The slot is reused by the next add, so no frame in flight may still read it.
+		void remove_texture(uint32_t index);
+		void remove_buffer(uint32_t index);
+
+		void bind(VkCommandBuffer, VkPipelineBindPoint, VkPipelineLayout, uint32_t set = 0) const;
+
+		VkDescriptorSetLayout set_layout() const { return m_set_layout; }
+		uint32_t max_textures() const { return m_textures.capacity; }
+		uint32_t max_buffers() const { return m_buffers.capacity; }
+		VkDescriptorSet descriptor_set() const { return m_descriptor_set; }
+
+	private:
+		struct slot_allocator
+		{
+			uint32_t capacity = 0;
+			uint32_t next = 0;
+			datastructures::vector<uint32_t> free_slots;
+
+			uint32_t allocate();
+			void free(uint32_t index);
+		};
+
+		VkDevice m_device;
+		VolkDeviceTable const& m_device_functions;
+
+		VkDescriptorSetLayout m_set_layout = VK_NULL_HANDLE;
+		VkDescriptorPool m_pool = VK_NULL_HANDLE;
+		VkDescriptorSet m_descriptor_set = VK_NULL_HANDLE;
+
+		slot_allocator m_textures;
+		slot_allocator m_buffers;
+	};
+}
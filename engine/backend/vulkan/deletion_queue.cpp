@@ -0,0 +1,149 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/deletion_queue.h"
+
+namespace engine
+{
+	deletion_queue::~deletion_queue()
+	{
+		for (auto& queued : m_entries)
+			destroy(queued);
+	}
+
+	void deletion_queue::destroy_buffer(VkBuffer buffer, memory_allocation const& allocation, uint64_t last_use)
+	{
+		entry new_entry{ object_type::buffer };
+		new_entry.buffer = buffer;
+		new_entry.allocation = allocation;
+		new_entry.last_use = last_use;
+		m_entries.push_back(new_entry);
+	}
+
+	void deletion_queue::destroy_image(VkImage image, memory_allocation const& allocation, uint64_t last_use)
+	{
+		entry new_entry{ object_type::image };
+		new_entry.image = image;
+		new_entry.allocation = allocation;
+		new_entry.last_use = last_use;
+		m_entries.push_back(new_entry);
+	}
+
+	void deletion_queue::destroy_image_view(VkImageView image_view, uint64_t last_use)
+	{
+		entry new_entry{ object_type::image_view };
+		new_entry.image_view = image_view;
+		new_entry.last_use = last_use;
+		m_entries.push_back(new_entry);
+	}
+
+	void deletion_queue::destroy_sampler(VkSampler sampler, uint64_t last_use)
+	{
+		entry new_entry{ object_type::sampler };
+		new_entry.sampler = sampler;
+		new_entry.last_use = last_use;
+		m_entries.push_back(new_entry);
+	}
+
+	void deletion_queue::destroy_framebuffer(VkFramebuffer framebuffer, uint64_t last_use)
+	{
+		entry new_entry{ object_type::framebuffer };
+		new_entry.framebuffer = framebuffer;
+		new_entry.last_use = last_use;
+		m_entries.push_back(new_entry);
+	}
+
+	void deletion_queue::destroy_render_pass(VkRenderPass render_pass, uint64_t last_use)
+	{
+		entry new_entry{ object_type::render_pass };
+		new_entry.render_pass = render_pass;
+		new_entry.last_use = last_use;
+		m_entries.push_back(new_entry);
+	}
+
+	void deletion_queue::destroy_pipeline(VkPipeline pipeline, uint64_t last_use)
+	{
+		entry new_entry{ object_type::pipeline };
+		new_entry.pipeline = pipeline;
+		new_entry.last_use = last_use;
+		m_entries.push_back(new_entry);
+	}
+
+	void deletion_queue::destroy_swapchain(VkSwapchainKHR swapchain, VkFence last_present_fence, uint64_t last_use)
+	{
+		entry new_entry{ object_type::swapchain };
+		new_entry.swapchain = swapchain;
+		new_entry.present_fence = last_present_fence;
+		new_entry.last_use = last_use;
+		m_entries.push_back(new_entry);
+	}
+
+	void deletion_queue::collect()
+	{
+		if (m_entries.empty())
+			return;
+
+		uint64_t completed = 0;
+		m_device_functions.vkGetSemaphoreCounterValue(m_device, m_timeline, &completed);
+
+		// Entries that have to wait keep their order, so dependent objects are still destroyed after what uses them.
+		size_t kept = 0;
+		for (size_t i = 0; i < m_entries.size(); ++i)
+		{
+			if (is_unused(m_entries[i], completed))
+				destroy(m_entries[i]);
+			else
+				m_entries[kept++] = m_entries[i];
+		}
+
+		m_entries.erase(m_entries.begin() + kept, m_entries.end());
+	}
+
+	bool deletion_queue::is_unused(entry const& queued, uint64_t completed) const
+	{
+		if (queued.last_use > completed)
+			return false;
+
+		return queued.type != object_type::swapchain || queued.present_fence == VK_NULL_HANDLE ||
+			   m_device_functions.vkGetFenceStatus(m_device, queued.present_fence) == VK_SUCCESS;
+	}
+
+	void deletion_queue::destroy(entry& queued)
+	{
+		switch (queued.type)
+		{
+		case object_type::buffer:
+			m_allocator.destroy_buffer(queued.buffer, queued.allocation);
+			break;
+		case object_type::image:
+			m_allocator.destroy_image(queued.image, queued.allocation);
+			break;
+		case object_type::image_view:
+			m_device_functions.vkDestroyImageView(m_device, queued.image_view, nullptr);
+			break;
+		case object_type::sampler:
+			m_device_functions.vkDestroySampler(m_device, queued.sampler, nullptr);
+			break;
+		case object_type::framebuffer:
+			m_device_functions.vkDestroyFramebuffer(m_device, queued.framebuffer, nullptr);
+			break;
+		case object_type::render_pass:
+			m_device_functions.vkDestroyRenderPass(m_device, queued.render_pass, nullptr);
+			break;
+		case object_type::pipeline:
+			m_device_functions.vkDestroyPipeline(m_device, queued.pipeline, nullptr);
+			break;
+		case object_type::swapchain:
+			// Only the destructor gets here before the fence has signaled.
+			if (queued.present_fence != VK_NULL_HANDLE)
+			{
+				m_device_functions.vkWaitForFences(m_device, 1, &queued.present_fence, VK_TRUE, UINT64_MAX);
+				m_device_functions.vkDestroyFence(m_device, queued.present_fence, nullptr);
+			}
+			m_device_functions.vkDestroySwapchainKHR(m_device, queued.swapchain, nullptr);
+			break;
+		}
+	}
+}
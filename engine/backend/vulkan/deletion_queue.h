@@ -0,0 +1,91 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "engine/backend/vulkan/memory_allocator.h"
+
+#include <vector>
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	// Destroys Vulkan objects once the GPU is done with them, without waiting for it. Every object goes in with
+	// the timeline value of the last submission that may use it, and stays until the timeline has reached that
+	// value. collect destroys everything that became unused at once, in the order it was queued. Like vkDestroy*,
+	// null handles are fine.
+	class deletion_queue
+	{
+	public:
+		deletion_queue(VkDevice device, VolkDeviceTable const& device_functions, memory_allocator& allocator, VkSemaphore timeline)
+			: m_device(device), m_device_functions(device_functions), m_allocator(allocator), m_timeline(timeline) {}
+		// Destroys everything that is left, so the device has to be idle.
+		~deletion_queue();
+
+		deletion_queue(deletion_queue const&) = delete;
+		deletion_queue& operator=(deletion_queue const&) = delete;
+
+		void destroy_buffer(VkBuffer, memory_allocation const&, uint64_t last_use);
+		void destroy_image(VkImage, memory_allocation const&, uint64_t last_use);
+		void destroy_image_view(VkImageView, uint64_t last_use);
+		void destroy_sampler(VkSampler, uint64_t last_use);
+		void destroy_framebuffer(VkFramebuffer, uint64_t last_use);
+		void destroy_render_pass(VkRenderPass, uint64_t last_use);
+		void destroy_pipeline(VkPipeline, uint64_t last_use);
+		// The timeline only covers command buffers, presents of the swapchain's images may still be pending when it
+		// is reached. Only VK_EXT_swapchain_maintenance1's present fences tell when they are done: with the fence of
+		// its last present, the swapchain also stays until that has signaled, and the fence goes with it. Without
+		// one, last_use has to leave the presents time to finish.
+		void destroy_swapchain(VkSwapchainKHR, VkFence last_present_fence, uint64_t last_use);
+
+		// Reads the timeline without blocking and destroys what it has passed.
+		void collect();
+
+		size_t pending_count() const { return m_entries.size(); }
+
+	private:
+		enum class object_type
+		{
+			buffer,
+			image,
+			image_view,
+			sampler,
+			framebuffer,
+			render_pass,
+			pipeline,
+			swapchain
+		};
+
+		struct entry
+		{
+			object_type type;
+			union
+			{
+				VkBuffer buffer;
+				VkImage image;
+				VkImageView image_view;
+				VkSampler sampler;
+				VkFramebuffer framebuffer;
+				VkRenderPass render_pass;
+				VkPipeline pipeline;
+				VkSwapchainKHR swapchain;
+			};
+			memory_allocation allocation; // Buffers and images only.
+			VkFence present_fence; // Swapchains only, may be null.
+			uint64_t last_use;
+		};
+
+		bool is_unused(entry const&, uint64_t completed) const;
+		void destroy(entry&);
+
+		VkDevice m_device;
+		VolkDeviceTable const& m_device_functions;
+		memory_allocator& m_allocator;
+		VkSemaphore m_timeline;
+
+		std::vector<entry> m_entries;
+	};
+}
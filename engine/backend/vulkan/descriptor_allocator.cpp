@@ -0,0 +1,137 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/descriptor_allocator.h"
+
+#include "engine/backend/vulkan/formatters.h"
+
+#include <format>
+#include <iostream>
+#include <iterator>
+
+namespace engine
+{
+	// Descriptors of each type per set in a pool. A pool runs out when either its sets or one of these does, and
+	// the next pool is used, so the ratios only need to be roughly right.
+	static constexpr struct
+	{
+		VkDescriptorType type;
+		float per_set;
+	} POOL_RATIOS[]{
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.f },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.f },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4.f },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.f },
+		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1.f },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.f },
+		{ VK_DESCRIPTOR_TYPE_SAMPLER, 0.5f }
+	};
+
+	std::unique_ptr<frame_descriptor_allocator> frame_descriptor_allocator::create(VkDevice device, VolkDeviceTable const& device_functions,
+																				   uint32_t frames_in_flight,
+																				   uint32_t sets_per_pool /* = DEFAULT_SETS_PER_POOL */)
+	{
+		auto allocator = std::make_unique<frame_descriptor_allocator>(device, device_functions, frames_in_flight);
+		allocator->m_sets_per_pool = sets_per_pool;
+
+		// Start every frame with one pool, so the first frames don't create them while recording.
+		for (size_t i = 0; i < allocator->m_frames.size(); ++i)
+		{
+			auto pool = allocator->create_pool();
+			if (pool == VK_NULL_HANDLE)
+				return nullptr;
+
+			allocator->m_frames[i].pools.push_back(pool);
+		}
+
+		return allocator;
+	}
+
+	frame_descriptor_allocator::~frame_descriptor_allocator()
+	{
+		for (auto& frame : m_frames)
+		{
+			for (auto pool : frame.pools)
+				m_device_functions.vkDestroyDescriptorPool(m_device, pool, nullptr);
+		}
+	}
+
+	void frame_descriptor_allocator::begin_frame(uint32_t frame_index)
+	{
+		m_current_frame = frame_index;
+
+		auto& frame = m_frames[frame_index];
+		for (uint32_t i = 0; i <= frame.current && i < frame.pools.size(); ++i)
+			m_device_functions.vkResetDescriptorPool(m_device, frame.pools[i], 0);
+
+		frame.current = 0;
+	}
+
+	VkDescriptorSet frame_descriptor_allocator::allocate(VkDescriptorSetLayout layout)
+	{
+		auto& frame = m_frames[m_current_frame];
+
+		VkDescriptorSetAllocateInfo allocate_info{};
+		allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocate_info.pSetLayouts = &layout;
+		allocate_info.descriptorSetCount = 1;
+
+		// A set that doesn't fit in a fresh pool never will, so give up after trying one.
+		bool tried_fresh_pool = false;
+		while (true)
+		{
+			if (frame.current == frame.pools.size())
+			{
+				auto pool = create_pool();
+				if (pool == VK_NULL_HANDLE)
+					return VK_NULL_HANDLE;
+
+				frame.pools.push_back(pool);
+				tried_fresh_pool = true;
+			}
+
+			allocate_info.descriptorPool = frame.pools[frame.current];
+
+			VkDescriptorSet descriptor_set;
+			auto result = m_device_functions.vkAllocateDescriptorSets(m_device, &allocate_info, &descriptor_set);
+			if (result == VK_SUCCESS)
+				return descriptor_set;
+
+			if ((result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) || tried_fresh_pool)
+			{
+				std::cerr << std::format("Failed to allocate frame descriptor set: {}", result) << std::endl;
+				return VK_NULL_HANDLE;
+			}
+
+			++frame.current;
+		}
+	}
+
+	VkDescriptorPool frame_descriptor_allocator::create_pool()
+	{
+		VkDescriptorPoolSize pool_sizes[std::size(POOL_RATIOS)];
+		for (size_t i = 0; i < std::size(POOL_RATIOS); ++i)
+		{
+			pool_sizes[i].type = POOL_RATIOS[i].type;
+			pool_sizes[i].descriptorCount = (uint32_t)(POOL_RATIOS[i].per_set * m_sets_per_pool);
+		}
+
+		VkDescriptorPoolCreateInfo create_info{};
+		create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		create_info.maxSets = m_sets_per_pool;
+		create_info.pPoolSizes = pool_sizes;
+		create_info.poolSizeCount = (uint32_t)std::size(pool_sizes);
+
+		VkDescriptorPool pool;
+		auto result = m_device_functions.vkCreateDescriptorPool(m_device, &create_info, nullptr, &pool);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create frame descriptor pool: {}", result) << std::endl;
+			return VK_NULL_HANDLE;
+		}
+
+		return pool;
+	}
+}
@@ -0,0 +1,58 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "datastructures/fixed_vector.h"
+#include "datastructures/vector.h"
+
+#include <memory>
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	// Hands out descriptor sets that only live for one frame. Every frame in flight owns a growing list of pools
+	// that sets are allocated from front to back. Sets are never freed on their own: once the frame timeline has
+	// reached the frame's value, begin_frame resets all of its pools at once and the list is reused from the start.
+	class frame_descriptor_allocator
+	{
+	public:
+		static constexpr uint32_t DEFAULT_SETS_PER_POOL = 256;
+
+		static std::unique_ptr<frame_descriptor_allocator> create(VkDevice, VolkDeviceTable const&, uint32_t frames_in_flight,
+																  uint32_t sets_per_pool = DEFAULT_SETS_PER_POOL);
+
+		frame_descriptor_allocator(VkDevice device, VolkDeviceTable const& device_functions, uint32_t frames_in_flight)
+			: m_device(device), m_device_functions(device_functions), m_frames(frames_in_flight) {}
+		~frame_descriptor_allocator();
+
+		frame_descriptor_allocator(frame_descriptor_allocator const&) = delete;
+		frame_descriptor_allocator& operator=(frame_descriptor_allocator const&) = delete;
+
+		// Resets the pools of this frame, so the frame timeline has to have reached its value. Sets allocated after
+		// this belong to it.
+		void begin_frame(uint32_t frame_index);
+
+		// Returns VK_NULL_HANDLE when no pool can be created. The set is valid until this frame index begins again.
+		VkDescriptorSet allocate(VkDescriptorSetLayout);
+
+	private:
+		struct frame_pools
+		{
+			datastructures::vector<VkDescriptorPool> pools;
+			uint32_t current = 0;
+		};
+
+		VkDescriptorPool create_pool();
+
+		VkDevice m_device;
+		VolkDeviceTable const& m_device_functions;
+		uint32_t m_sets_per_pool = DEFAULT_SETS_PER_POOL;
+
+		datastructures::fixed_vector<frame_pools> m_frames;
+		uint32_t m_current_frame = 0;
+	};
+}
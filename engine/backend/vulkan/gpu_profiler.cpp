@@ -0,0 +1,230 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/gpu_profiler.h"
+
+#include "engine/backend/vulkan/formatters.h"
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <iostream>
+
+namespace engine
+{
+	std::unique_ptr<gpu_profiler> gpu_profiler::create(VkPhysicalDevice physical_device, VkDevice device, VolkDeviceTable const& device_functions,
+													   uint32_t queue_family_index, uint32_t frames_in_flight,
+													   uint32_t max_regions /* = DEFAULT_MAX_REGIONS */)
+	{
+		uint32_t queue_family_count;
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, nullptr);
+		datastructures::fixed_vector<VkQueueFamilyProperties> queue_family_properties(queue_family_count);
+		vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_family_properties.data());
+
+		auto valid_bits = queue_family_properties[queue_family_index].timestampValidBits;
+		if (valid_bits == 0)
+		{
+			std::cout << std::format("Queue family {} doesn't support timestamps, GPU profiling is disabled", queue_family_index) << std::endl;
+			return nullptr;
+		}
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+		auto profiler = std::make_unique<gpu_profiler>(device, device_functions, frames_in_flight);
+		profiler->m_timestamp_period_ns = properties.limits.timestampPeriod;
+		profiler->m_timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+		profiler->m_max_queries = max_regions * 2;
+
+		VkQueryPoolCreateInfo create_info{};
+		create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		create_info.queryCount = profiler->m_max_queries;
+
+		for (size_t i = 0; i < profiler->m_frames.size(); ++i)
+		{
+			auto result = device_functions.vkCreateQueryPool(device, &create_info, nullptr, &profiler->m_frames[i].pool);
+			if (result != VK_SUCCESS)
+			{
+				std::cerr << std::format("Failed to create timestamp query pool: {}", result) << std::endl;
+				profiler->m_frames[i].pool = VK_NULL_HANDLE;
+				return nullptr;
+			}
+		}
+
+		return profiler;
+	}
+
+	gpu_profiler::~gpu_profiler()
+	{
+		for (auto& frame : m_frames)
+		{
+			if (frame.pool != VK_NULL_HANDLE)
+				m_device_functions.vkDestroyQueryPool(m_device, frame.pool, nullptr);
+		}
+	}
+
+	void gpu_profiler::begin_frame(uint32_t frame_index, VkCommandBuffer command_buffer)
+	{
+		m_current_frame = frame_index;
+
+		auto& frame = m_frames[frame_index];
+		collect_results(frame);
+
+		if (m_output_interval > 0 && ++m_frames_since_output >= m_output_interval)
+		{
+			output_statistics();
+			m_frames_since_output = 0;
+		}
+
+		m_device_functions.vkCmdResetQueryPool(command_buffer, frame.pool, 0, m_max_queries);
+
+		begin_region(command_buffer, FRAME_REGION);
+	}
+
+	void gpu_profiler::end_frame(VkCommandBuffer command_buffer)
+	{
+		// The frame region is always the first one of the frame.
+		end_region(command_buffer, 0);
+	}
+
+	void gpu_profiler::discard_frame()
+	{
+		auto& frame = m_frames[m_current_frame];
+		frame.regions.clear();
+		frame.query_count = 0;
+	}
+
+	uint32_t gpu_profiler::begin_region(VkCommandBuffer command_buffer, char const* name)
+	{
+		auto& frame = m_frames[m_current_frame];
+		if (frame.query_count + 2 > m_max_queries)
+			return NO_REGION;
+
+		frame_region region{ find_history(name), frame.query_count };
+		frame.regions.push_back(region);
+		frame.query_count += 2;
+
+		m_device_functions.vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.pool, region.first_query);
+		return (uint32_t)frame.regions.size() - 1;
+	}
+
+	void gpu_profiler::end_region(VkCommandBuffer command_buffer, uint32_t region)
+	{
+		if (region == NO_REGION)
+			return;
+
+		auto& frame = m_frames[m_current_frame];
+		m_device_functions.vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.pool, frame.regions[region].first_query + 1);
+	}
+
+	void gpu_profiler::collect()
+	{
+		for (auto& frame : m_frames)
+			collect_results(frame);
+	}
+
+	void gpu_profiler::reset_history()
+	{
+		for (auto& history : m_history)
+		{
+			history.sample_count = 0;
+			history.next_sample = 0;
+		}
+	}
+
+	datastructures::fixed_vector<gpu_region_timing> gpu_profiler::timings() const
+	{
+		datastructures::fixed_vector<gpu_region_timing> result(m_history.size());
+		for (size_t i = 0; i < m_history.size(); ++i)
+		{
+			auto const& history = m_history[i];
+
+			gpu_region_timing timing{ history.name, 0.0, 0.0, 0.0, history.sample_count };
+			if (history.sample_count > 0)
+			{
+				timing.min_ms = *std::min_element(history.samples_ms, history.samples_ms + history.sample_count);
+				timing.max_ms = *std::max_element(history.samples_ms, history.samples_ms + history.sample_count);
+
+				for (uint32_t j = 0; j < history.sample_count; ++j)
+					timing.average_ms += history.samples_ms[j];
+				timing.average_ms /= history.sample_count;
+			}
+
+			result[i] = timing;
+		}
+
+		return result;
+	}
+
+	void gpu_profiler::output_statistics() const
+	{
+		std::cout << "GPU time per region:" << std::endl;
+		for (auto const& timing : timings())
+		{
+			std::cout << std::format("\t{}: {:.3f} ms average, {:.3f} ms min, {:.3f} ms max over {} frame(s)", timing.name, timing.average_ms,
+									 timing.min_ms, timing.max_ms, timing.sample_count)
+					  << std::endl;
+		}
+	}
+
+	void gpu_profiler::collect_results(frame_queries& frame)
+	{
+		if (frame.query_count == 0)
+			return;
+
+		// Without the wait flag this fails with VK_NOT_READY instead of blocking, which only happens when a region
+		// was never ended. The whole frame is dropped then. Either way the frame is forgotten, so collect followed
+		// by begin_frame doesn't count it twice.
+		m_results.resize(frame.query_count);
+		auto result = m_device_functions.vkGetQueryPoolResults(m_device, frame.pool, 0, frame.query_count, sizeof(uint64_t) * frame.query_count,
+															   m_results.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		frame.query_count = 0;
+		if (result != VK_SUCCESS)
+		{
+			frame.regions.clear();
+			if (result != VK_NOT_READY)
+				std::cerr << std::format("Failed to get timestamp query results: {}", result) << std::endl;
+			return;
+		}
+
+		m_frame_totals_ms.resize(m_history.size());
+		for (auto& total : m_frame_totals_ms)
+			total = -1.0;
+
+		for (auto const& region : frame.regions)
+		{
+			auto ticks = (m_results[region.first_query + 1] - m_results[region.first_query]) & m_timestamp_mask;
+			auto& total = m_frame_totals_ms[region.history];
+			total = std::max(total, 0.0) + ticks * m_timestamp_period_ns / 1'000'000.0;
+		}
+		frame.regions.clear();
+
+		for (size_t i = 0; i < m_history.size(); ++i)
+		{
+			if (m_frame_totals_ms[i] < 0.0)
+				continue;
+
+			auto& history = m_history[i];
+			history.samples_ms[history.next_sample] = m_frame_totals_ms[i];
+			history.next_sample = (history.next_sample + 1) % HISTORY_SIZE;
+			history.sample_count = std::min(history.sample_count + 1, HISTORY_SIZE);
+		}
+	}
+
+	uint32_t gpu_profiler::find_history(char const* name)
+	{
+		for (uint32_t i = 0; i < m_history.size(); ++i)
+		{
+			if (m_history[i].name == name || std::strcmp(m_history[i].name, name) == 0)
+				return i;
+		}
+
+		region_history history{};
+		history.name = name;
+		m_history.push_back(history);
+		return (uint32_t)m_history.size() - 1;
+	}
+}
@@ -0,0 +1,116 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "datastructures/fixed_vector.h"
+#include "datastructures/vector.h"
+
+#include <memory>
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	struct gpu_region_timing
+	{
+		char const* name;
+		double min_ms;
+		double average_ms;
+		double max_ms;
+		uint32_t sample_count;
+	};
+
+	// Measures GPU time of named regions of a command buffer with timestamp queries. Every frame in flight has its
+	// own query pool, whose results are read when that frame index begins again. The frame has finished by then, so
+	// reading them never stalls, at the cost of reporting times a few frames late.
+	//
+	// Regions may nest, and a region with the same name recorded more than once in a frame adds up. Names are kept
+	// by pointer, so they have to outlive the profiler, string literals are the intended use.
+	class gpu_profiler
+	{
+	public:
+		static constexpr uint32_t DEFAULT_MAX_REGIONS = 64;
+		static constexpr uint32_t HISTORY_SIZE = 128; // Frames the rolling statistics cover.
+		static constexpr char const* FRAME_REGION = "frame";
+
+		// Returns nullptr when the queue family can't write timestamps.
+		static std::unique_ptr<gpu_profiler> create(VkPhysicalDevice, VkDevice, VolkDeviceTable const&, uint32_t queue_family_index,
+													uint32_t frames_in_flight, uint32_t max_regions = DEFAULT_MAX_REGIONS);
+
+		gpu_profiler(VkDevice device, VolkDeviceTable const& device_functions, uint32_t frames_in_flight)
+			: m_device(device), m_device_functions(device_functions), m_frames(frames_in_flight) {}
+		~gpu_profiler();
+
+		gpu_profiler(gpu_profiler const&) = delete;
+		gpu_profiler& operator=(gpu_profiler const&) = delete;
+
+		// The previous use of this frame index has to have finished on the GPU. Collects its results, then resets
+		// the queries and starts the frame region, so it has to be recorded outside of any render pass.
+		void begin_frame(uint32_t frame_index, VkCommandBuffer);
+		void end_frame(VkCommandBuffer);
+		// Forgets the regions recorded since begin_frame, for a frame whose command buffer is never submitted. Its
+		// queries are never reset nor written then, so reading them would return an older frame's timestamps.
+		void discard_frame();
+
+		// Returns the region to end, regions beyond max_regions in a frame are not measured.
+		uint32_t begin_region(VkCommandBuffer, char const* name);
+		void end_region(VkCommandBuffer, uint32_t region);
+
+		// Reads the results of all finished frames, for when frames stop being recorded, e.g. after wait_idle.
+		void collect();
+		// Drops the samples so far, so the statistics only cover what is measured after it.
+		void reset_history();
+
+		// Rolling statistics of every region measured so far, in the order they were first seen.
+		datastructures::fixed_vector<gpu_region_timing> timings() const;
+		// Prints the timings every interval frames, 0 turns it off.
+		void set_output_interval(uint32_t frames) { m_output_interval = frames; }
+		void output_statistics() const;
+
+	private:
+		static constexpr uint32_t NO_REGION = ~0u;
+
+		struct frame_region
+		{
+			uint32_t history; // Index into m_history.
+			uint32_t first_query;
+		};
+
+		struct frame_queries
+		{
+			VkQueryPool pool = VK_NULL_HANDLE;
+			datastructures::vector<frame_region> regions;
+			uint32_t query_count = 0;
+		};
+
+		// The last HISTORY_SIZE frame totals of a region, frames that didn't record it are left out.
+		struct region_history
+		{
+			char const* name;
+			double samples_ms[HISTORY_SIZE];
+			uint32_t sample_count;
+			uint32_t next_sample;
+		};
+
+		void collect_results(frame_queries&);
+		uint32_t find_history(char const* name);
+
+		VkDevice m_device;
+		VolkDeviceTable const& m_device_functions;
+		double m_timestamp_period_ns = 1.0;
+		uint64_t m_timestamp_mask = ~0ull;
+		uint32_t m_max_queries = 0;
+
+		datastructures::fixed_vector<frame_queries> m_frames;
+		uint32_t m_current_frame = 0;
+		datastructures::vector<region_history> m_history;
+		datastructures::vector<uint64_t> m_results;
+		datastructures::vector<double> m_frame_totals_ms; // Per history, negative when the frame didn't record it.
+
+		uint32_t m_output_interval = 0;
+		uint32_t m_frames_since_output = 0;
+	};
+}
@@ -0,0 +1,98 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/linear_allocator.h"
+
+#include <algorithm>
+#include <format>
+#include <iostream>
+
+namespace engine
+{
+	std::unique_ptr<frame_linear_allocator> frame_linear_allocator::create(VkPhysicalDevice physical_device, memory_allocator& allocator,
+																		   uint32_t frames_in_flight,
+																		   VkDeviceSize page_size /* = DEFAULT_PAGE_SIZE */)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+		auto linear_allocator = std::make_unique<frame_linear_allocator>(allocator, frames_in_flight);
+		linear_allocator->m_page_size = page_size;
+		linear_allocator->m_min_alignment = std::max({ properties.limits.minUniformBufferOffsetAlignment,
+													   properties.limits.minStorageBufferOffsetAlignment, (VkDeviceSize)16 });
+
+		// Start every frame with one page, so the first frames don't create them while recording.
+		for (auto& frame : linear_allocator->m_frames)
+		{
+			if (!linear_allocator->create_page(frame, page_size))
+				return nullptr;
+		}
+
+		return linear_allocator;
+	}
+
+	frame_linear_allocator::~frame_linear_allocator()
+	{
+		for (auto& frame : m_frames)
+		{
+			for (auto& page : frame.pages)
+				m_allocator.destroy_buffer(page.buffer, page.allocation);
+		}
+	}
+
+	void frame_linear_allocator::begin_frame(uint32_t frame_index)
+	{
+		m_current_frame = frame_index;
+		m_frame_bytes = 0;
+
+		auto& frame = m_frames[frame_index];
+		frame.current = 0;
+		frame.offset = 0;
+	}
+
+	frame_allocation frame_linear_allocator::allocate(VkDeviceSize size, VkDeviceSize alignment /* = 0 */)
+	{
+		alignment = std::max(alignment, m_min_alignment);
+
+		auto& frame = m_frames[m_current_frame];
+		while (true)
+		{
+			if (frame.current == frame.pages.size() && !create_page(frame, std::max(m_page_size, size)))
+				return {};
+
+			auto& page = frame.pages[frame.current];
+			auto offset = (frame.offset + alignment - 1) / alignment * alignment;
+			if (offset + size <= page.size)
+			{
+				frame.offset = offset + size;
+				m_frame_bytes += size;
+				return { page.buffer, offset, static_cast<char*>(page.allocation.mapped) + offset };
+			}
+
+			++frame.current;
+			frame.offset = 0;
+		}
+	}
+
+	bool frame_linear_allocator::create_page(frame_pages& frame, VkDeviceSize size)
+	{
+		VkBufferCreateInfo create_info{};
+		create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		create_info.size = size;
+		create_info.usage = BUFFER_USAGE;
+		create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		page new_page{};
+		new_page.size = size;
+		if (!m_allocator.create_buffer(create_info, memory_usage::cpu_to_gpu, new_page.buffer, new_page.allocation))
+		{
+			std::cerr << std::format("Failed to create frame linear allocator page of {} bytes", size) << std::endl;
+			return false;
+		}
+
+		frame.pages.push_back(new_page);
+		return true;
+	}
+}
@@ -0,0 +1,102 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "datastructures/fixed_vector.h"
+#include "datastructures/vector.h"
+#include "engine/backend/vulkan/memory_allocator.h"
+
+#include <cstring>
+#include <memory>
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	// Memory that the GPU reads during a single frame. The offset doubles as the dynamic offset of a
+	// *_BUFFER_DYNAMIC descriptor of the buffer.
+	struct frame_allocation
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		void* mapped = nullptr;
+
+		bool is_valid() const { return buffer != VK_NULL_HANDLE; }
+	};
+
+	// Streams data that changes every frame, like constants, skinning matrices and dynamic vertices, without
+	// creating buffers per frame. Every frame in flight owns persistently mapped host visible pages that are bump
+	// allocated from front to back, so writing the data is a memcpy. Nothing is freed on its own: once the frame
+	// timeline has reached the frame's value, begin_frame rewinds all of its pages at once. A frame that runs out of
+	// its pages gets another one, which it keeps, so the pages settle at what the busiest frame needs.
+	class frame_linear_allocator
+	{
+	public:
+		static constexpr VkDeviceSize DEFAULT_PAGE_SIZE = 4ull * 1024 * 1024;
+
+		static constexpr VkBufferUsageFlags BUFFER_USAGE = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+														   VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+														   VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+
+		static std::unique_ptr<frame_linear_allocator> create(VkPhysicalDevice, memory_allocator&, uint32_t frames_in_flight,
+															  VkDeviceSize page_size = DEFAULT_PAGE_SIZE);
+
+		frame_linear_allocator(memory_allocator& allocator, uint32_t frames_in_flight)
+			: m_allocator(allocator), m_frames(frames_in_flight) {}
+		~frame_linear_allocator();
+
+		frame_linear_allocator(frame_linear_allocator const&) = delete;
+		frame_linear_allocator& operator=(frame_linear_allocator const&) = delete;
+
+		// Rewinds the pages of this frame, so the frame timeline has to have reached its value. Allocations after
+		// this belong to it.
+		void begin_frame(uint32_t frame_index);
+
+		// Aligned to at least the minimum uniform and storage buffer offset alignment. Invalid when no page can be
+		// created. The memory is valid until this frame index begins again.
+		frame_allocation allocate(VkDeviceSize size, VkDeviceSize alignment = 0);
+
+		frame_allocation write(void const* data, VkDeviceSize size)
+		{
+			auto allocation = allocate(size);
+			if (allocation.is_valid())
+				std::memcpy(allocation.mapped, data, size);
+			return allocation;
+		}
+
+		template <typename T>
+		frame_allocation write(T const& value) { return write(&value, sizeof(T)); }
+
+		VkDeviceSize min_alignment() const { return m_min_alignment; }
+		// Bytes allocated by the frame that is being recorded, so far.
+		VkDeviceSize frame_bytes() const { return m_frame_bytes; }
+
+	private:
+		struct page
+		{
+			VkBuffer buffer = VK_NULL_HANDLE;
+			memory_allocation allocation;
+			VkDeviceSize size = 0;
+		};
+
+		struct frame_pages
+		{
+			datastructures::vector<page> pages;
+			uint32_t current = 0;
+			VkDeviceSize offset = 0; // Into the current page.
+		};
+
+		bool create_page(frame_pages&, VkDeviceSize size);
+
+		memory_allocator& m_allocator;
+		VkDeviceSize m_page_size = DEFAULT_PAGE_SIZE;
+		VkDeviceSize m_min_alignment = 1;
+
+		datastructures::fixed_vector<frame_pages> m_frames;
+		uint32_t m_current_frame = 0;
+		VkDeviceSize m_frame_bytes = 0;
+	};
+}
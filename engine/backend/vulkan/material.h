@@ -0,0 +1,44 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "engine/backend/vulkan/memory_allocator.h"
+#include "engine/backend/vulkan/upload_manager.h"
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	using material_handle = uint32_t;
+	using texture_handle = uint32_t;
+
+	constexpr texture_handle NO_TEXTURE = ~0u;
+
+	struct material_description
+	{
+		float base_color[4]{ 1.f, 1.f, 1.f, 1.f };
+		texture_handle base_color_texture = NO_TEXTURE;
+	};
+
+	// Layout of a material in the material buffer, see mesh.frag.glsl. Textures are referenced by their bindless index.
+	struct gpu_material
+	{
+		float base_color[4];
+		uint32_t base_color_texture;
+		uint32_t padding[3];
+	};
+
+	static_assert(sizeof(gpu_material) == 32);
+
+	struct texture
+	{
+		VkImage image = VK_NULL_HANDLE;
+		memory_allocation allocation;
+		VkImageView view = VK_NULL_HANDLE;
+		uint32_t bindless_index = 0;
+		upload_manager::ticket upload = 0;
+	};
+}
@@ -0,0 +1,553 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/memory_allocator.h"
+
+#include "engine/backend/vulkan/formatters.h"
+
+#include <algorithm>
+#include <bit>
+#include <format>
+#include <iostream>
+
+namespace engine
+{
+	static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	// Whether the last byte before end and the byte at start fall into the same page. Page sizes are powers of two.
+	static bool on_same_page(VkDeviceSize end, VkDeviceSize start, VkDeviceSize page_size)
+	{
+		return ((end - 1) & ~(page_size - 1)) == (start & ~(page_size - 1));
+	}
+
+	static constexpr double bytes_to_mib(VkDeviceSize bytes)
+	{
+		return bytes / (1024.0 * 1024.0);
+	}
+
+	static constexpr char const* CATEGORY_NAMES[MEMORY_CATEGORY_COUNT]{ "buffers", "textures", "attachments", "staging" };
+
+	memory_allocator::memory_allocator(VkPhysicalDevice physical_device, VkDevice device, VolkDeviceTable const& device_functions,
+									   bool memory_budget, VkDeviceSize preferred_block_size /* = DEFAULT_BLOCK_SIZE */)
+		: m_physical_device(physical_device), m_device(device), m_device_functions(device_functions), m_memory_budget(memory_budget)
+	{
+		vkGetPhysicalDeviceMemoryProperties(physical_device, &m_memory_properties);
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physical_device, &properties);
+		m_buffer_image_granularity = std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+		m_max_allocation_count = properties.limits.maxMemoryAllocationCount;
+
+		for (uint32_t i = 0; i < m_memory_properties.memoryHeapCount; ++i)
+			m_heap_statistics[i].heap_size = m_memory_properties.memoryHeaps[i].size;
+
+		// Small heaps (e.g. the 256 MiB host visible device local window) get proportionally smaller blocks, so a
+		// single block cannot claim most of the heap.
+		for (uint32_t i = 0; i < m_memory_properties.memoryTypeCount; ++i)
+		{
+			auto heap_size = m_memory_properties.memoryHeaps[m_memory_properties.memoryTypes[i].heapIndex].size;
+			m_block_sizes[i] = std::min(preferred_block_size, std::bit_floor(std::max<VkDeviceSize>(heap_size / 8, 1)));
+		}
+
+		update_budget();
+	}
+
+	memory_allocator::~memory_allocator()
+	{
+		for (uint32_t i = 0; i < m_memory_properties.memoryHeapCount; ++i)
+		{
+			auto const& statistics = m_heap_statistics[i];
+			if (statistics.allocation_count != 0)
+				std::cerr << std::format("Memory heap {} still has {} allocation(s) ({:.2f} MiB) at shutdown", i,
+										 statistics.allocation_count, bytes_to_mib(statistics.allocated_bytes))
+						  << std::endl;
+		}
+
+		for (auto& blocks : m_blocks)
+		{
+			for (auto& block : blocks)
+				m_device_functions.vkFreeMemory(m_device, block->memory, nullptr);
+		}
+	}
+
+	memory_allocation memory_allocator::allocate(VkMemoryRequirements const& requirements, memory_usage usage, resource_tiling tiling,
+												 memory_category category, bool dedicated /* = false */)
+	{
+		auto allocation = allocate_memory(requirements, usage, tiling, dedicated);
+		if (!allocation.is_valid())
+			return allocation;
+
+		allocation.category = category;
+		m_heap_statistics[m_memory_properties.memoryTypes[allocation.memory_type].heapIndex].category_bytes[(uint32_t)category] += allocation.size;
+		return allocation;
+	}
+
+	memory_allocation memory_allocator::allocate_memory(VkMemoryRequirements const& requirements, memory_usage usage, resource_tiling tiling,
+														bool dedicated)
+	{
+		auto memory_type = find_memory_type(requirements.memoryTypeBits, usage);
+		if (!memory_type.has_value())
+		{
+			std::cerr << std::format("Failed to find a memory type for memory type bits {:#x}", requirements.memoryTypeBits) << std::endl;
+			return {};
+		}
+
+		auto type = memory_type.value();
+		if (dedicated || requirements.size > m_block_sizes[type] / 2)
+			return allocate_dedicated(requirements.size, type);
+
+		memory_allocation allocation;
+		for (auto& block : m_blocks[type])
+		{
+			if (allocate_from_block(*block, requirements, tiling, allocation))
+				return allocation;
+		}
+
+		auto* block = create_block(type);
+		if (block == nullptr || !allocate_from_block(*block, requirements, tiling, allocation))
+			return {};
+
+		return allocation;
+	}
+
+	void memory_allocator::free(memory_allocation& allocation)
+	{
+		if (!allocation.is_valid())
+			return;
+
+		auto& statistics = m_heap_statistics[m_memory_properties.memoryTypes[allocation.memory_type].heapIndex];
+		statistics.allocated_bytes -= allocation.size;
+		statistics.category_bytes[(uint32_t)allocation.category] -= allocation.size;
+		--statistics.allocation_count;
+
+		if (allocation.block == nullptr)
+		{
+			m_device_functions.vkFreeMemory(m_device, allocation.memory, nullptr);
+			--m_allocation_count;
+			statistics.reserved_bytes -= allocation.size;
+			--statistics.dedicated_allocation_count;
+			allocation = {};
+			return;
+		}
+
+		auto& block = *static_cast<memory_block*>(allocation.block);
+		auto& regions = block.regions;
+
+		size_t first = 0;
+		size_t last = regions.size();
+		while (first < last)
+		{
+			auto middle = first + (last - first) / 2;
+			if (regions[middle].offset < allocation.offset)
+				first = middle + 1;
+			else
+				last = middle;
+		}
+
+		auto index = first;
+		if (index == regions.size() || regions[index].offset != allocation.offset || regions[index].state == region_state::free)
+		{
+			std::cerr << std::format("Freeing unknown allocation at offset {}", allocation.offset) << std::endl;
+			allocation = {};
+			return;
+		}
+
+		regions[index].state = region_state::free;
+		if (index + 1 < regions.size() && regions[index + 1].state == region_state::free)
+		{
+			regions[index].size += regions[index + 1].size;
+			regions.erase(index + 1);
+		}
+
+		if (index > 0 && regions[index - 1].state == region_state::free)
+		{
+			regions[index - 1].size += regions[index].size;
+			regions.erase(index);
+		}
+
+		// Keep one empty block per memory type around, so allocation patterns that oscillate around a block
+		// boundary don't keep reallocating device memory.
+		auto& blocks = m_blocks[allocation.memory_type];
+		if (regions.size() == 1 && blocks.size() > 1)
+		{
+			auto it = std::find_if(blocks.begin(), blocks.end(), [&](auto const& candidate) { return candidate.get() == &block; });
+			destroy_block(block);
+			blocks.erase(it);
+		}
+
+		allocation = {};
+	}
+
+	bool memory_allocator::create_buffer(VkBufferCreateInfo const& create_info, memory_usage usage, VkBuffer& buffer, memory_allocation& allocation)
+	{
+		auto result = m_device_functions.vkCreateBuffer(m_device, &create_info, nullptr, &buffer);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create buffer: {}", result) << std::endl;
+			buffer = VK_NULL_HANDLE;
+			return false;
+		}
+
+		VkMemoryRequirements memory_requirements;
+		m_device_functions.vkGetBufferMemoryRequirements(m_device, buffer, &memory_requirements);
+
+		auto category = usage == memory_usage::staging || usage == memory_usage::gpu_to_cpu ? memory_category::staging : memory_category::buffer;
+		allocation = allocate(memory_requirements, usage, resource_tiling::linear, category);
+		if (!allocation.is_valid())
+		{
+			destroy_buffer(buffer, allocation);
+			return false;
+		}
+
+		result = m_device_functions.vkBindBufferMemory(m_device, buffer, allocation.memory, allocation.offset);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to bind buffer memory: {}", result) << std::endl;
+			destroy_buffer(buffer, allocation);
+			return false;
+		}
+
+		return true;
+	}
+
+	void memory_allocator::destroy_buffer(VkBuffer& buffer, memory_allocation& allocation)
+	{
+		if (buffer != VK_NULL_HANDLE)
+			m_device_functions.vkDestroyBuffer(m_device, buffer, nullptr);
+
+		free(allocation);
+		buffer = VK_NULL_HANDLE;
+	}
+
+	bool memory_allocator::create_image(VkImageCreateInfo const& create_info, memory_usage usage, VkImage& image, memory_allocation& allocation,
+										bool dedicated /* = false */)
+	{
+		auto result = m_device_functions.vkCreateImage(m_device, &create_info, nullptr, &image);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create image: {}", result) << std::endl;
+			image = VK_NULL_HANDLE;
+			return false;
+		}
+
+		VkMemoryRequirements memory_requirements;
+		m_device_functions.vkGetImageMemoryRequirements(m_device, image, &memory_requirements);
+
+		auto tiling = create_info.tiling == VK_IMAGE_TILING_LINEAR ? resource_tiling::linear : resource_tiling::optimal;
+		constexpr VkImageUsageFlags attachment_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+													   VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		auto category = (create_info.usage & attachment_usage) != 0 ? memory_category::attachment : memory_category::texture;
+		allocation = allocate(memory_requirements, usage, tiling, category, dedicated);
+		if (!allocation.is_valid())
+		{
+			destroy_image(image, allocation);
+			return false;
+		}
+
+		result = m_device_functions.vkBindImageMemory(m_device, image, allocation.memory, allocation.offset);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to bind image memory: {}", result) << std::endl;
+			destroy_image(image, allocation);
+			return false;
+		}
+
+		return true;
+	}
+
+	void memory_allocator::destroy_image(VkImage& image, memory_allocation& allocation)
+	{
+		if (image != VK_NULL_HANDLE)
+			m_device_functions.vkDestroyImage(m_device, image, nullptr);
+
+		free(allocation);
+		image = VK_NULL_HANDLE;
+	}
+
+	void memory_allocator::output_statistics() const
+	{
+		std::cout << "Device memory usage:" << std::endl;
+		for (uint32_t i = 0; i < m_memory_properties.memoryHeapCount; ++i)
+		{
+			auto const& statistics = m_heap_statistics[i];
+			bool device_local = (m_memory_properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+			std::cout << std::format("\tHeap {} ({}, {:.0f} MiB): {:.2f} MiB used of {:.2f} MiB reserved in {} block(s), {} allocation(s) ({} dedicated)",
+									 i, device_local ? "device local" : "host", bytes_to_mib(statistics.heap_size),
+									 bytes_to_mib(statistics.allocated_bytes), bytes_to_mib(statistics.reserved_bytes),
+									 statistics.block_count, statistics.allocation_count, statistics.dedicated_allocation_count)
+					  << std::endl;
+
+			std::cout << std::format("\t\t{:.2f} MiB of {:.2f} MiB budget in use ({}); ", bytes_to_mib(statistics.usage_bytes),
+									 bytes_to_mib(statistics.budget_bytes), m_memory_budget ? "VK_EXT_memory_budget" : "estimated");
+			for (uint32_t category = 0; category < MEMORY_CATEGORY_COUNT; ++category)
+				std::cout << std::format("{}{} {:.2f} MiB", category > 0 ? ", " : "", CATEGORY_NAMES[category],
+										 bytes_to_mib(statistics.category_bytes[category]));
+			std::cout << std::endl;
+		}
+	}
+
+	void memory_allocator::update_budget()
+	{
+		if (m_memory_budget)
+		{
+			VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_properties{};
+			budget_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+			VkPhysicalDeviceMemoryProperties2 memory_properties{};
+			memory_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+			memory_properties.pNext = &budget_properties;
+			vkGetPhysicalDeviceMemoryProperties2(m_physical_device, &memory_properties);
+
+			for (uint32_t i = 0; i < m_memory_properties.memoryHeapCount; ++i)
+			{
+				m_heap_statistics[i].budget_bytes = budget_properties.heapBudget[i];
+				m_heap_statistics[i].usage_bytes = budget_properties.heapUsage[i];
+			}
+		}
+		else
+		{
+			// Leave room for the driver and other processes that use the heap as well.
+			for (uint32_t i = 0; i < m_memory_properties.memoryHeapCount; ++i)
+			{
+				m_heap_statistics[i].budget_bytes = m_heap_statistics[i].heap_size / 10 * 8;
+				m_heap_statistics[i].usage_bytes = m_heap_statistics[i].reserved_bytes;
+			}
+		}
+
+		for (auto& watch : m_budget_watches)
+		{
+			for (uint32_t i = 0; i < m_memory_properties.memoryHeapCount; ++i)
+			{
+				auto const& statistics = m_heap_statistics[i];
+				bool exceeded = statistics.budget_bytes > 0 && statistics.usage_bytes > (double)watch.fraction * statistics.budget_bytes;
+				if (exceeded && !watch.exceeded[i])
+					watch.callback(i, statistics);
+
+				watch.exceeded[i] = exceeded;
+			}
+		}
+	}
+
+	void memory_allocator::add_budget_callback(float fraction, budget_callback callback)
+	{
+		m_budget_watches.push_back({ fraction, std::move(callback) });
+	}
+
+	// Best fit over the free regions of a block, taking both the requested alignment and bufferImageGranularity
+	// against the neighboring allocations into account.
+	bool memory_allocator::allocate_from_block(memory_block& block, VkMemoryRequirements const& requirements, resource_tiling tiling,
+											   memory_allocation& allocation)
+	{
+		auto state = tiling == resource_tiling::linear ? region_state::linear : region_state::optimal;
+		auto conflicts = [](region_state a, region_state b) {
+			return (a == region_state::linear && b == region_state::optimal) || (a == region_state::optimal && b == region_state::linear);
+		};
+
+		auto& regions = block.regions;
+		auto best_index = regions.size();
+		VkDeviceSize best_offset = 0;
+		VkDeviceSize best_size = ~0ull;
+		for (size_t i = 0; i < regions.size(); ++i)
+		{
+			auto const& region = regions[i];
+			if (region.state != region_state::free || region.size < requirements.size || region.size >= best_size)
+				continue;
+
+			auto offset = align_up(region.offset, std::max<VkDeviceSize>(requirements.alignment, 1));
+			if (m_buffer_image_granularity > 1 && i > 0)
+			{
+				auto const& previous = regions[i - 1];
+				if (conflicts(previous.state, state) && on_same_page(previous.offset + previous.size, offset, m_buffer_image_granularity))
+					offset = align_up(offset, m_buffer_image_granularity);
+			}
+
+			auto end = offset + requirements.size;
+			if (end > region.offset + region.size)
+				continue;
+
+			if (m_buffer_image_granularity > 1 && i + 1 < regions.size())
+			{
+				auto const& next = regions[i + 1];
+				if (conflicts(state, next.state) && on_same_page(end, next.offset, m_buffer_image_granularity))
+					continue;
+			}
+
+			best_index = i;
+			best_offset = offset;
+			best_size = region.size;
+		}
+
+		if (best_index == regions.size())
+			return false;
+
+		auto chosen = regions[best_index];
+		auto padding = best_offset - chosen.offset;
+		auto remainder = chosen.offset + chosen.size - (best_offset + requirements.size);
+
+		auto index = best_index;
+		if (padding > 0)
+		{
+			regions[index] = { chosen.offset, padding, region_state::free };
+			regions.insert(++index, { best_offset, requirements.size, state });
+		}
+		else
+			regions[index] = { best_offset, requirements.size, state };
+
+		if (remainder > 0)
+			regions.insert(index + 1, { best_offset + requirements.size, remainder, region_state::free });
+
+		allocation.memory = block.memory;
+		allocation.offset = best_offset;
+		allocation.size = requirements.size;
+		allocation.mapped = block.mapped != nullptr ? static_cast<char*>(block.mapped) + best_offset : nullptr;
+		allocation.memory_type = block.memory_type;
+		allocation.block = &block;
+
+		auto& statistics = m_heap_statistics[m_memory_properties.memoryTypes[block.memory_type].heapIndex];
+		statistics.allocated_bytes += requirements.size;
+		++statistics.allocation_count;
+
+		return true;
+	}
+
+	memory_allocation memory_allocator::allocate_dedicated(VkDeviceSize size, uint32_t memory_type)
+	{
+		memory_allocation allocation;
+		allocation.memory = allocate_device_memory(size, memory_type, &allocation.mapped);
+		if (allocation.memory == VK_NULL_HANDLE)
+			return {};
+
+		allocation.size = size;
+		allocation.memory_type = memory_type;
+
+		auto& statistics = m_heap_statistics[m_memory_properties.memoryTypes[memory_type].heapIndex];
+		statistics.reserved_bytes += size;
+		statistics.allocated_bytes += size;
+		++statistics.allocation_count;
+		++statistics.dedicated_allocation_count;
+
+		return allocation;
+	}
+
+	memory_allocator::memory_block* memory_allocator::create_block(uint32_t memory_type)
+	{
+		auto block = std::make_unique<memory_block>();
+		block->size = m_block_sizes[memory_type];
+		block->memory_type = memory_type;
+		block->memory = allocate_device_memory(block->size, memory_type, &block->mapped);
+		if (block->memory == VK_NULL_HANDLE)
+			return nullptr;
+
+		block->regions.push_back({ 0, block->size, region_state::free });
+
+		auto& statistics = m_heap_statistics[m_memory_properties.memoryTypes[memory_type].heapIndex];
+		statistics.reserved_bytes += block->size;
+		++statistics.block_count;
+
+		m_blocks[memory_type].push_back(std::move(block));
+		return m_blocks[memory_type].back().get();
+	}
+
+	void memory_allocator::destroy_block(memory_block& block)
+	{
+		m_device_functions.vkFreeMemory(m_device, block.memory, nullptr);
+		--m_allocation_count;
+
+		auto& statistics = m_heap_statistics[m_memory_properties.memoryTypes[block.memory_type].heapIndex];
+		statistics.reserved_bytes -= block.size;
+		--statistics.block_count;
+	}
+
+	datastructures::optional<uint32_t> memory_allocator::find_memory_type(uint32_t memory_type_bits, memory_usage usage) const
+	{
+		VkMemoryPropertyFlags required = 0;
+		VkMemoryPropertyFlags preferred = 0;
+		VkMemoryPropertyFlags avoided = 0;
+		switch (usage)
+		{
+		case memory_usage::gpu_only:
+			required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+			break;
+		case memory_usage::cpu_to_gpu:
+			required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			break;
+		case memory_usage::gpu_to_cpu:
+			required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+			break;
+		case memory_usage::staging:
+			required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			avoided = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			break;
+		}
+
+		datastructures::optional<uint32_t> memory_type;
+		int best_score = -1;
+		for (uint32_t i = 0; i < m_memory_properties.memoryTypeCount; ++i)
+		{
+			auto flags = m_memory_properties.memoryTypes[i].propertyFlags;
+			if ((memory_type_bits & (1u << i)) == 0 || (flags & required) != required)
+				continue;
+
+			// Exotic memory (protected, lazily allocated, ...) is never what a plain resource wants.
+			if ((flags & ~(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+						   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT)) != 0)
+				continue;
+
+			int score = 2 * std::popcount((uint32_t)(flags & preferred)) - std::popcount((uint32_t)(flags & avoided)) + 2;
+			if (score > best_score)
+			{
+				memory_type = i;
+				best_score = score;
+			}
+		}
+
+		return memory_type;
+	}
+
+	VkDeviceMemory memory_allocator::allocate_device_memory(VkDeviceSize size, uint32_t memory_type, void** mapped)
+	{
+		*mapped = nullptr;
+		if (m_allocation_count >= m_max_allocation_count)
+		{
+			std::cerr << std::format("Failed to allocate device memory: reached maxMemoryAllocationCount ({})", m_max_allocation_count) << std::endl;
+			return VK_NULL_HANDLE;
+		}
+
+		VkMemoryAllocateInfo allocate_info{};
+		allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocate_info.allocationSize = size;
+		allocate_info.memoryTypeIndex = memory_type;
+
+		VkDeviceMemory memory;
+		auto result = m_device_functions.vkAllocateMemory(m_device, &allocate_info, nullptr, &memory);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to allocate {:.2f} MiB of device memory: {}", bytes_to_mib(size), result) << std::endl;
+			return VK_NULL_HANDLE;
+		}
+
+		++m_allocation_count;
+
+		if ((m_memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0)
+		{
+			result = m_device_functions.vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, mapped);
+			if (result != VK_SUCCESS)
+			{
+				std::cerr << std::format("Failed to map device memory: {}", result) << std::endl;
+				m_device_functions.vkFreeMemory(m_device, memory, nullptr);
+				--m_allocation_count;
+				return VK_NULL_HANDLE;
+			}
+		}
+
+		return memory;
+	}
+}
@@ -0,0 +1,165 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "datastructures/optional.h"
+#include "datastructures/vector.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	enum class memory_usage
+	{
+		gpu_only,   // Device local, never touched by the CPU.
+		cpu_to_gpu, // Written by the CPU every frame and read by the GPU, preferably device local.
+		gpu_to_cpu, // Written by the GPU and read back by the CPU, preferably cached.
+		staging     // Upload source, kept out of device local memory to leave it for resources.
+	};
+
+	// Linear resources (buffers, linear images) and optimally tiled images may not share a bufferImageGranularity page.
+	enum class resource_tiling
+	{
+		linear,
+		optimal
+	};
+
+	// What the memory is used for, so budget pressure can be traced back to the systems that cause it.
+	enum class memory_category : uint8_t
+	{
+		buffer,     // Buffers the GPU reads or writes, including those written by the CPU every frame.
+		texture,    // Images that are only sampled.
+		attachment, // Images that are rendered to, including the render graph's transient images.
+		staging     // Buffers that only carry uploads to, or read backs from, other resources.
+	};
+
+	constexpr uint32_t MEMORY_CATEGORY_COUNT = 4;
+
+	struct memory_allocation
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		void* mapped = nullptr;
+		uint32_t memory_type = 0;
+		void* block = nullptr; // Owning block, nullptr for dedicated allocations.
+		memory_category category = memory_category::buffer;
+
+		bool is_valid() const { return memory != VK_NULL_HANDLE; }
+	};
+
+	struct memory_heap_statistics
+	{
+		VkDeviceSize heap_size = 0;
+		VkDeviceSize reserved_bytes = 0;  // Total size of the VkDeviceMemory objects in this heap.
+		VkDeviceSize allocated_bytes = 0; // Bytes handed out to resources.
+		uint32_t block_count = 0;
+		uint32_t allocation_count = 0;
+		uint32_t dedicated_allocation_count = 0;
+		VkDeviceSize category_bytes[MEMORY_CATEGORY_COUNT]{}; // allocated_bytes, split by memory_category.
+
+		// Set by update_budget. With VK_EXT_memory_budget, usage covers the whole process, including memory that
+		// wasn't allocated here like the swapchain's. Without it, usage is reserved_bytes and the budget 80% of the heap.
+		VkDeviceSize budget_bytes = 0;
+		VkDeviceSize usage_bytes = 0;
+	};
+
+	// Reserves large VkDeviceMemory blocks per memory type and sub-allocates resources from them, keeping the number
+	// of driver allocations far below maxMemoryAllocationCount. Resources larger than half a block get their own
+	// dedicated allocation. Host visible blocks are persistently mapped.
+	class memory_allocator
+	{
+	public:
+		static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+		// Called with the heap's statistics when its usage goes past the fraction of its budget it was added with.
+		// Called once, and only again after the usage has dropped below the fraction in between.
+		using budget_callback = std::function<void(uint32_t heap_index, memory_heap_statistics const&)>;
+
+		// memory_budget is whether VK_EXT_memory_budget is enabled on the device.
+		memory_allocator(VkPhysicalDevice, VkDevice, VolkDeviceTable const&, bool memory_budget,
+						 VkDeviceSize preferred_block_size = DEFAULT_BLOCK_SIZE);
+		~memory_allocator();
+
+		memory_allocator(memory_allocator const&) = delete;
+		memory_allocator& operator=(memory_allocator const&) = delete;
+
+		memory_allocation allocate(VkMemoryRequirements const&, memory_usage, resource_tiling, memory_category, bool dedicated = false);
+		void free(memory_allocation&);
+
+		bool create_buffer(VkBufferCreateInfo const&, memory_usage, VkBuffer&, memory_allocation&);
+		void destroy_buffer(VkBuffer&, memory_allocation&);
+		bool create_image(VkImageCreateInfo const&, memory_usage, VkImage&, memory_allocation&, bool dedicated = false);
+		void destroy_image(VkImage&, memory_allocation&);
+
+		uint32_t heap_count() const { return m_memory_properties.memoryHeapCount; }
+		memory_heap_statistics const& heap_statistics(uint32_t heap_index) const { return m_heap_statistics[heap_index]; }
+		void output_statistics() const;
+
+		// Reads the budget and usage of every heap and calls the budget callbacks. Meant to be called once per frame.
+		void update_budget();
+		void add_budget_callback(float fraction, budget_callback);
+		bool has_memory_budget() const { return m_memory_budget; }
+
+	private:
+		enum class region_state : uint8_t
+		{
+			free,
+			linear,
+			optimal
+		};
+
+		// Blocks are covered by a sorted list of regions without gaps, adjacent free regions are always merged.
+		struct region
+		{
+			VkDeviceSize offset;
+			VkDeviceSize size;
+			region_state state;
+		};
+
+		struct memory_block
+		{
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			VkDeviceSize size = 0;
+			void* mapped = nullptr;
+			uint32_t memory_type = 0;
+			datastructures::vector<region> regions;
+		};
+
+		struct budget_watch
+		{
+			float fraction;
+			budget_callback callback;
+			bool exceeded[VK_MAX_MEMORY_HEAPS]{};
+		};
+
+		memory_allocation allocate_memory(VkMemoryRequirements const&, memory_usage, resource_tiling, bool dedicated);
+		bool allocate_from_block(memory_block&, VkMemoryRequirements const&, resource_tiling, memory_allocation&);
+		memory_allocation allocate_dedicated(VkDeviceSize size, uint32_t memory_type);
+		memory_block* create_block(uint32_t memory_type);
+		void destroy_block(memory_block&);
+		datastructures::optional<uint32_t> find_memory_type(uint32_t memory_type_bits, memory_usage) const;
+		VkDeviceMemory allocate_device_memory(VkDeviceSize size, uint32_t memory_type, void** mapped);
+
+		VkPhysicalDevice m_physical_device;
+		VkDevice m_device;
+		VolkDeviceTable const& m_device_functions;
+		bool m_memory_budget;
+		VkPhysicalDeviceMemoryProperties m_memory_properties{};
+		VkDeviceSize m_buffer_image_granularity = 1;
+		uint32_t m_max_allocation_count = 0;
+		uint32_t m_allocation_count = 0;
+
+		VkDeviceSize m_block_sizes[VK_MAX_MEMORY_TYPES]{};
+		std::vector<std::unique_ptr<memory_block>> m_blocks[VK_MAX_MEMORY_TYPES];
+		memory_heap_statistics m_heap_statistics[VK_MAX_MEMORY_HEAPS]{};
+		std::vector<budget_watch> m_budget_watches;
+	};
+}
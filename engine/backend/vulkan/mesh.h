@@ -0,0 +1,76 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "engine/backend/vulkan/material.h"
+#include "engine/backend/vulkan/memory_allocator.h"
+#include "engine/backend/vulkan/upload_manager.h"
+#include "math/math.h"
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	using mesh_handle = uint32_t;
+
+	struct mesh_vertex
+	{
+		math::vec3 position;
+		math::vec3 normal;
+		float uv[2];
+	};
+
+	// Per-instance vertex attributes, read from a second vertex buffer binding. Also read as a storage buffer by
+	// cull.comp.glsl, so the size is padded to the std430 size of the struct there.
+	struct mesh_instance
+	{
+		math::mat4 transform;
+		float color[4];
+		material_handle material = 0;
+		uint32_t padding[3];
+	};
+
+	static_assert(sizeof(mesh_instance) == 96);
+
+	struct mesh
+	{
+		VkBuffer vertex_buffer = VK_NULL_HANDLE;
+		memory_allocation vertex_allocation;
+		VkBuffer index_buffer = VK_NULL_HANDLE;
+		memory_allocation index_allocation;
+		uint32_t index_count = 0;
+		math::vec3 bounds_center{};
+		float bounds_radius = 0.f;
+		upload_manager::ticket upload = 0;
+	};
+
+	// A set of instances of the same mesh, drawn together.
+	struct mesh_instance_batch
+	{
+		mesh_handle mesh = 0;
+		VkBuffer instance_buffer = VK_NULL_HANDLE;
+		memory_allocation instance_allocation;
+		uint32_t instance_count = 0;
+		upload_manager::ticket upload = 0;
+
+		// Written by the culling pass, with one instanced draw command and a range of instance_count visible instance
+		// indices per frame in flight. The draw reads the instances and their indices through the bindless heap.
+		VkBuffer draw_command_buffer = VK_NULL_HANDLE;
+		memory_allocation draw_command_allocation;
+		VkBuffer visible_instance_buffer = VK_NULL_HANDLE;
+		memory_allocation visible_instance_allocation;
+		VkDescriptorSet culling_descriptor_set = VK_NULL_HANDLE;
+		uint32_t instance_buffer_index = 0;
+		uint32_t visible_instance_buffer_index = 0;
+	};
+
+	enum class mesh_draw_mode
+	{
+		gpu_driven, // Frustum culled in a compute pass, which compacts the visible instances into one indirect draw.
+		instanced,  // One draw per batch.
+		individual  // One draw per instance, to measure what instancing saves.
+	};
+}
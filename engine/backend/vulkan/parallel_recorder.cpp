@@ -0,0 +1,220 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/parallel_recorder.h"
+
+#include "engine/backend/vulkan/formatters.h"
+
+#include <algorithm>
+#include <format>
+#include <iostream>
+
+namespace engine
+{
+	uint32_t parallel_command_recorder::default_worker_count()
+	{
+		// hardware_concurrency may not know and return 0. Past a handful of threads, submitting is what limits.
+		return std::clamp(std::thread::hardware_concurrency(), 1u, 8u) - 1;
+	}
+
+	std::unique_ptr<parallel_command_recorder> parallel_command_recorder::create(VkDevice device, VolkDeviceTable const& device_functions,
+																				 uint32_t queue_family_index, uint32_t frames_in_flight,
+																				 uint32_t worker_count /* = default_worker_count() */)
+	{
+		auto recorder = std::make_unique<parallel_command_recorder>(device, device_functions, frames_in_flight, worker_count);
+		if (!recorder->create_pools(queue_family_index))
+			return nullptr;
+
+		for (uint32_t thread = 0; thread < worker_count; ++thread)
+			recorder->m_workers.emplace_back(&parallel_command_recorder::run_worker, recorder.get(), thread);
+
+		std::cout << std::format("Recording command buffers on {} threads", recorder->m_thread_count) << std::endl;
+		return recorder;
+	}
+
+	parallel_command_recorder::~parallel_command_recorder()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_stopping = true;
+		}
+
+		m_work_available.notify_all();
+		for (auto& worker : m_workers)
+			worker.join();
+
+		// Destroying a pool frees its command buffers.
+		for (auto const& thread_pool : m_pools)
+		{
+			if (thread_pool.pool != VK_NULL_HANDLE)
+				m_device_functions.vkDestroyCommandPool(m_device, thread_pool.pool, nullptr);
+		}
+	}
+
+	bool parallel_command_recorder::create_pools(uint32_t queue_family_index)
+	{
+		// Command buffers are only ever reset with their pool.
+		VkCommandPoolCreateInfo create_info{};
+		create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		create_info.queueFamilyIndex = queue_family_index;
+
+		for (auto& thread_pool : m_pools)
+		{
+			auto result = m_device_functions.vkCreateCommandPool(m_device, &create_info, nullptr, &thread_pool.pool);
+			if (result != VK_SUCCESS)
+			{
+				std::cerr << std::format("Failed to create recording command pool: {}", result) << std::endl;
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void parallel_command_recorder::begin_frame(uint32_t frame_index)
+	{
+		m_current_frame = frame_index;
+
+		for (uint32_t thread = 0; thread < m_thread_count; ++thread)
+		{
+			auto& thread_pool = m_pools[frame_index * m_thread_count + thread];
+			if (thread_pool.used == 0)
+				continue;
+
+			m_device_functions.vkResetCommandPool(m_device, thread_pool.pool, 0);
+			thread_pool.used = 0;
+		}
+	}
+
+	bool parallel_command_recorder::record(VkCommandBufferInheritanceInfo const& inheritance_info, VkCommandBufferUsageFlags usage,
+										   uint32_t task_count, record_function const& record_task,
+										   datastructures::vector<VkCommandBuffer>& command_buffers)
+	{
+		command_buffers.resize(task_count);
+
+		m_inheritance_info = &inheritance_info;
+		m_usage = usage;
+		m_record_task = &record_task;
+		m_recorded = command_buffers.data();
+		m_task_count = task_count;
+		m_next_task = 0;
+		m_failed = false;
+
+		// A single task isn't worth waking the workers for.
+		bool parallel = task_count > 1 && !m_workers.empty();
+		if (parallel)
+		{
+			{
+				std::lock_guard lock(m_mutex);
+				m_finished_workers = 0;
+				++m_recording;
+			}
+
+			m_work_available.notify_all();
+		}
+
+		record_tasks(m_thread_count - 1);
+
+		if (parallel)
+		{
+			std::unique_lock lock(m_mutex);
+			m_work_done.wait(lock, [this] { return m_finished_workers == m_workers.size(); });
+		}
+
+		return !m_failed;
+	}
+
+	void parallel_command_recorder::run_worker(uint32_t thread)
+	{
+		uint64_t recording = 0;
+		while (true)
+		{
+			{
+				std::unique_lock lock(m_mutex);
+				m_work_available.wait(lock, [&] { return m_stopping || m_recording != recording; });
+				if (m_stopping)
+					return;
+
+				recording = m_recording;
+			}
+
+			record_tasks(thread);
+
+			{
+				std::lock_guard lock(m_mutex);
+				++m_finished_workers;
+			}
+
+			m_work_done.notify_one();
+		}
+	}
+
+	// Threads take the next task until none are left, so a thread stuck on a heavy task doesn't hold up the rest.
+	void parallel_command_recorder::record_tasks(uint32_t thread)
+	{
+		auto& thread_pool = m_pools[m_current_frame * m_thread_count + thread];
+
+		VkCommandBufferBeginInfo begin_info{};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = m_usage;
+		begin_info.pInheritanceInfo = m_inheritance_info;
+
+		for (auto task = m_next_task++; task < m_task_count; task = m_next_task++)
+		{
+			m_recorded[task] = VK_NULL_HANDLE;
+
+			auto command_buffer = next_command_buffer(thread_pool);
+			if (command_buffer == VK_NULL_HANDLE)
+			{
+				m_failed = true;
+				continue;
+			}
+
+			auto result = m_device_functions.vkBeginCommandBuffer(command_buffer, &begin_info);
+			if (result != VK_SUCCESS)
+			{
+				std::cerr << std::format("Failed to begin recording secondary command buffer: {}", result) << std::endl;
+				m_failed = true;
+				continue;
+			}
+
+			(*m_record_task)(command_buffer, task);
+
+			result = m_device_functions.vkEndCommandBuffer(command_buffer);
+			if (result != VK_SUCCESS)
+			{
+				std::cerr << std::format("Failed to end recording secondary command buffer: {}", result) << std::endl;
+				m_failed = true;
+				continue;
+			}
+
+			m_recorded[task] = command_buffer;
+		}
+	}
+
+	VkCommandBuffer parallel_command_recorder::next_command_buffer(pool_entry& thread_pool)
+	{
+		if (thread_pool.used == thread_pool.command_buffers.size())
+		{
+			VkCommandBufferAllocateInfo allocate_info{};
+			allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocate_info.commandPool = thread_pool.pool;
+			allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocate_info.commandBufferCount = 1;
+
+			VkCommandBuffer command_buffer;
+			auto result = m_device_functions.vkAllocateCommandBuffers(m_device, &allocate_info, &command_buffer);
+			if (result != VK_SUCCESS)
+			{
+				std::cerr << std::format("Failed to allocate secondary command buffer: {}", result) << std::endl;
+				return VK_NULL_HANDLE;
+			}
+
+			thread_pool.command_buffers.push_back(command_buffer);
+		}
+
+		return thread_pool.command_buffers[thread_pool.used++];
+	}
+}
@@ -0,0 +1,96 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "datastructures/fixed_vector.h"
+#include "datastructures/vector.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	// Records secondary command buffers on several threads at once. Command pools can't be used by two threads
+	// at the same time, so every worker, and the thread that calls record, owns a pool per frame in flight. The
+	// command buffers of a frame are never freed or reset one by one: begin_frame resets all of the frame's pools
+	// at once and their command buffers are handed out again.
+	class parallel_command_recorder
+	{
+	public:
+		using record_function = std::function<void(VkCommandBuffer, uint32_t task)>;
+
+		// A worker per core but one, the thread that calls record records as well.
+		static uint32_t default_worker_count();
+
+		static std::unique_ptr<parallel_command_recorder> create(VkDevice, VolkDeviceTable const&, uint32_t queue_family_index,
+																 uint32_t frames_in_flight, uint32_t worker_count = default_worker_count());
+
+		parallel_command_recorder(VkDevice device, VolkDeviceTable const& device_functions, uint32_t frames_in_flight, uint32_t worker_count)
+			: m_device(device), m_device_functions(device_functions), m_thread_count(worker_count + 1),
+			  m_pools(frames_in_flight * (worker_count + 1)) {}
+		~parallel_command_recorder();
+
+		parallel_command_recorder(parallel_command_recorder const&) = delete;
+		parallel_command_recorder& operator=(parallel_command_recorder const&) = delete;
+
+		// Resets the pools of this frame, so nothing recorded for it since it last began may still be pending on
+		// the GPU. Recordings after this belong to it.
+		void begin_frame(uint32_t frame_index);
+
+		// Calls record_task once for every task, spread over the threads, each with a command buffer of its own that
+		// has been begun with the inheritance info. The command buffers come back in task order, so executing them
+		// gives the same commands no matter which thread recorded what. record_task runs on several threads at
+		// once, it may only read state that nothing writes until record returns. Blocks until all tasks are done.
+		bool record(VkCommandBufferInheritanceInfo const&, VkCommandBufferUsageFlags, uint32_t task_count, record_function const& record_task,
+					datastructures::vector<VkCommandBuffer>& command_buffers);
+
+		uint32_t thread_count() const { return m_thread_count; }
+
+	private:
+		struct pool_entry
+		{
+			VkCommandPool pool = VK_NULL_HANDLE;
+			datastructures::vector<VkCommandBuffer> command_buffers; // Allocated from the pool, in use up to used.
+			uint32_t used = 0;
+		};
+
+		bool create_pools(uint32_t queue_family_index);
+		void run_worker(uint32_t thread);
+		void record_tasks(uint32_t thread);
+		VkCommandBuffer next_command_buffer(pool_entry&);
+
+		VkDevice m_device;
+		VolkDeviceTable const& m_device_functions;
+		uint32_t m_thread_count;
+
+		datastructures::fixed_vector<pool_entry> m_pools; // Per frame, per thread. The calling thread is the last.
+		uint32_t m_current_frame = 0;
+
+		// The current recording, written before the workers are woken and read by them until they're done.
+		VkCommandBufferInheritanceInfo const* m_inheritance_info = nullptr;
+		VkCommandBufferUsageFlags m_usage = 0;
+		record_function const* m_record_task = nullptr;
+		VkCommandBuffer* m_recorded = nullptr;
+		uint32_t m_task_count = 0;
+		std::atomic<uint32_t> m_next_task = 0;
+		std::atomic<bool> m_failed = false;
+
+		std::mutex m_mutex;
+		std::condition_variable m_work_available;
+		std::condition_variable m_work_done;
+		uint64_t m_recording = 0; // Guarded by m_mutex, like m_finished_workers and m_stopping.
+		uint32_t m_finished_workers = 0;
+		bool m_stopping = false;
+		std::vector<std::thread> m_workers;
+	};
+}
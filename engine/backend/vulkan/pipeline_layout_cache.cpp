@@ -0,0 +1,256 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/pipeline_layout_cache.h"
+
+#include "engine/backend/vulkan/formatters.h"
+
+#include <algorithm>
+#include <format>
+#include <iostream>
+
+namespace engine
+{
+	pipeline_layout_cache::~pipeline_layout_cache()
+	{
+		for (auto const& entry : m_pipeline_layouts)
+			m_device_functions.vkDestroyPipelineLayout(m_device, entry.layout, nullptr);
+
+		for (auto const& entry : m_set_layouts)
+		{
+			if (!entry.external)
+				m_device_functions.vkDestroyDescriptorSetLayout(m_device, entry.layout, nullptr);
+		}
+	}
+
+	void pipeline_layout_cache::set_external_set_layout(uint32_t set, VkDescriptorSetLayout layout, std::vector<shader_binding> bindings)
+	{
+		m_external_set_layouts[set] = layout;
+		m_set_layouts.push_back({ std::move(bindings), layout, true });
+	}
+
+	VkPipelineLayout pipeline_layout_cache::get_pipeline_layout(shader_reflection const* shaders, uint32_t shader_count)
+	{
+		std::vector<shader_binding> set_bindings[MAX_DESCRIPTOR_SETS];
+		uint32_t set_count = 0;
+
+		VkPushConstantRange push_constant_range{ 0, ~0u, 0 };
+		uint32_t push_constant_end = 0;
+
+		for (uint32_t i = 0; i < shader_count; ++i)
+		{
+			auto const& shader = shaders[i];
+			for (auto const& binding : shader.bindings)
+			{
+				if (binding.set >= MAX_DESCRIPTOR_SETS)
+				{
+					std::cerr << std::format("Failed to create pipeline layout: set {} exceeds the maximum of {}", binding.set, MAX_DESCRIPTOR_SETS)
+							  << std::endl;
+					return VK_NULL_HANDLE;
+				}
+
+				set_count = std::max(set_count, binding.set + 1);
+
+				auto& bindings = set_bindings[binding.set];
+				auto existing = std::find_if(bindings.begin(), bindings.end(), [&](shader_binding const& other) {
+					return other.binding == binding.binding;
+				});
+
+				if (existing == bindings.end())
+				{
+					bindings.push_back(binding);
+					continue;
+				}
+
+				if (existing->type != binding.type || existing->count != binding.count)
+				{
+					std::cerr << std::format("Failed to create pipeline layout: stages declare binding {}.{} differently", binding.set, binding.binding)
+							  << std::endl;
+					return VK_NULL_HANDLE;
+				}
+
+				existing->stages |= binding.stages;
+			}
+
+			if (shader.push_constant_size > 0)
+			{
+				push_constant_range.stageFlags |= shader.stage;
+				push_constant_range.offset = std::min(push_constant_range.offset, shader.push_constant_offset);
+				push_constant_end = std::max(push_constant_end, shader.push_constant_offset + shader.push_constant_size);
+			}
+		}
+
+		if (push_constant_end == 0)
+			push_constant_range = {};
+		else
+			push_constant_range.size = push_constant_end - push_constant_range.offset;
+
+		// Sets without bindings below the highest used one get an empty layout.
+		pipeline_layout_entry entry{};
+		entry.set_count = set_count;
+		entry.push_constant_range = push_constant_range;
+		for (uint32_t set = 0; set < set_count; ++set)
+		{
+			auto& bindings = set_bindings[set];
+			if (auto external = m_external_set_layouts[set]; external != VK_NULL_HANDLE)
+			{
+				auto const& declared = find_set_layout(external)->bindings;
+				if (std::all_of(bindings.begin(), bindings.end(), [&](shader_binding const& binding) { return fits(declared, binding); }))
+				{
+					entry.set_layouts[set] = external;
+					continue;
+				}
+			}
+
+			auto runtime_array = std::find_if(bindings.begin(), bindings.end(), [](shader_binding const& binding) { return binding.count == 0; });
+			if (runtime_array != bindings.end())
+			{
+				std::cerr << std::format("Failed to create pipeline layout: binding {}.{} is a runtime array that fits no external set layout",
+										 set, runtime_array->binding)
+						  << std::endl;
+				return VK_NULL_HANDLE;
+			}
+
+			std::sort(bindings.begin(), bindings.end(), [](shader_binding const& a, shader_binding const& b) { return a.binding < b.binding; });
+
+			entry.set_layouts[set] = get_set_layout(bindings);
+			if (entry.set_layouts[set] == VK_NULL_HANDLE)
+				return VK_NULL_HANDLE;
+		}
+
+		for (auto const& existing : m_pipeline_layouts)
+		{
+			if (existing.set_count == entry.set_count &&
+				std::equal(existing.set_layouts, existing.set_layouts + existing.set_count, entry.set_layouts) &&
+				existing.push_constant_range.stageFlags == entry.push_constant_range.stageFlags &&
+				existing.push_constant_range.offset == entry.push_constant_range.offset &&
+				existing.push_constant_range.size == entry.push_constant_range.size)
+				return existing.layout;
+		}
+
+		VkPipelineLayoutCreateInfo create_info{};
+		create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		create_info.pSetLayouts = entry.set_layouts;
+		create_info.setLayoutCount = entry.set_count;
+		if (entry.push_constant_range.size > 0)
+		{
+			create_info.pPushConstantRanges = &entry.push_constant_range;
+			create_info.pushConstantRangeCount = 1;
+		}
+
+		auto result = m_device_functions.vkCreatePipelineLayout(m_device, &create_info, nullptr, &entry.layout);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create pipeline layout: {}", result) << std::endl;
+			return VK_NULL_HANDLE;
+		}
+
+		m_pipeline_layouts.push_back(entry);
+		return entry.layout;
+	}
+
+	bool pipeline_layout_cache::is_compatible(VkPipelineLayout layout, shader_reflection const* shaders, uint32_t shader_count) const
+	{
+		auto const* entry = find_pipeline_layout(layout);
+		if (entry == nullptr)
+			return false;
+
+		for (uint32_t i = 0; i < shader_count; ++i)
+		{
+			auto const& shader = shaders[i];
+			for (auto const& binding : shader.bindings)
+			{
+				if (binding.set >= entry->set_count || !fits(find_set_layout(entry->set_layouts[binding.set])->bindings, binding))
+					return false;
+			}
+
+			if (shader.push_constant_size > 0)
+			{
+				auto const& range = entry->push_constant_range;
+				if ((range.stageFlags & shader.stage) == 0 || shader.push_constant_offset < range.offset ||
+					shader.push_constant_offset + shader.push_constant_size > range.offset + range.size)
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	VkDescriptorSetLayout pipeline_layout_cache::set_layout(VkPipelineLayout layout, uint32_t set) const
+	{
+		auto const* entry = find_pipeline_layout(layout);
+		return entry != nullptr && set < entry->set_count ? entry->set_layouts[set] : VK_NULL_HANDLE;
+	}
+
+	VkPushConstantRange pipeline_layout_cache::push_constant_range(VkPipelineLayout layout) const
+	{
+		auto const* entry = find_pipeline_layout(layout);
+		return entry != nullptr ? entry->push_constant_range : VkPushConstantRange{};
+	}
+
+	// A runtime sized array fits any array of the same type, a sized one only an array at least as large.
+	bool pipeline_layout_cache::fits(std::vector<shader_binding> const& declared, shader_binding const& binding)
+	{
+		auto match = std::find_if(declared.begin(), declared.end(), [&](shader_binding const& other) { return other.binding == binding.binding; });
+		return match != declared.end() && match->type == binding.type && (binding.stages & ~match->stages) == 0 &&
+			   (binding.count == 0 || (match->count != 0 && match->count >= binding.count));
+	}
+
+	VkDescriptorSetLayout pipeline_layout_cache::get_set_layout(std::vector<shader_binding> const& bindings)
+	{
+		for (auto const& existing : m_set_layouts)
+		{
+			if (!existing.external && existing.bindings == bindings)
+				return existing.layout;
+		}
+
+		std::vector<VkDescriptorSetLayoutBinding> layout_bindings(bindings.size());
+		for (size_t i = 0; i < bindings.size(); ++i)
+		{
+			layout_bindings[i].binding = bindings[i].binding;
+			layout_bindings[i].descriptorType = bindings[i].type;
+			layout_bindings[i].descriptorCount = bindings[i].count;
+			layout_bindings[i].stageFlags = bindings[i].stages;
+		}
+
+		VkDescriptorSetLayoutCreateInfo create_info{};
+		create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		create_info.pBindings = layout_bindings.data();
+		create_info.bindingCount = (uint32_t)layout_bindings.size();
+
+		VkDescriptorSetLayout layout;
+		auto result = m_device_functions.vkCreateDescriptorSetLayout(m_device, &create_info, nullptr, &layout);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create descriptor set layout: {}", result) << std::endl;
+			return VK_NULL_HANDLE;
+		}
+
+		m_set_layouts.push_back({ bindings, layout, false });
+		return layout;
+	}
+
+	pipeline_layout_cache::set_layout_entry const* pipeline_layout_cache::find_set_layout(VkDescriptorSetLayout layout) const
+	{
+		for (auto const& entry : m_set_layouts)
+		{
+			if (entry.layout == layout)
+				return &entry;
+		}
+
+		return nullptr;
+	}
+
+	pipeline_layout_cache::pipeline_layout_entry const* pipeline_layout_cache::find_pipeline_layout(VkPipelineLayout layout) const
+	{
+		for (auto const& entry : m_pipeline_layouts)
+		{
+			if (entry.layout == layout)
+				return &entry;
+		}
+
+		return nullptr;
+	}
+}
@@ -0,0 +1,77 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "engine/backend/vulkan/shader_reflection.h"
+
+#include <vector>
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	// Builds descriptor set layouts and pipeline layouts from the reflection of a pipeline's shaders, and owns
+	// them. Equal layouts are created once, so pipelines whose shaders declare the same interface share a layout
+	// and descriptor sets stay bound when switching between them.
+	class pipeline_layout_cache
+	{
+	public:
+		pipeline_layout_cache(VkDevice device, VolkDeviceTable const& device_functions)
+			: m_device(device), m_device_functions(device_functions) {}
+		~pipeline_layout_cache();
+
+		pipeline_layout_cache(pipeline_layout_cache const&) = delete;
+		pipeline_layout_cache& operator=(pipeline_layout_cache const&) = delete;
+
+		// Offers a layout owned by someone else, e.g. the bindless heap's, for a set. Shaders whose bindings in that
+		// set all fit its bindings get it, the only way to get runtime sized arrays, which need flags reflection can't
+		// know about. Other shaders get a layout of their own for the set.
+		void set_external_set_layout(uint32_t set, VkDescriptorSetLayout, std::vector<shader_binding> bindings);
+
+		// The bindings of all stages are merged per set and the push constants become a single range for all stages
+		// that use them. VK_NULL_HANDLE when the stages disagree about a binding.
+		VkPipelineLayout get_pipeline_layout(shader_reflection const* shaders, uint32_t shader_count);
+
+		// Whether pipelines with these shaders can be created with the layout, which may declare more than they use.
+		bool is_compatible(VkPipelineLayout, shader_reflection const* shaders, uint32_t shader_count) const;
+
+		// Only valid for layouts of this cache.
+		VkDescriptorSetLayout set_layout(VkPipelineLayout, uint32_t set) const;
+		VkPushConstantRange push_constant_range(VkPipelineLayout) const;
+
+		size_t set_layout_count() const { return m_set_layouts.size(); }
+		size_t pipeline_layout_count() const { return m_pipeline_layouts.size(); }
+
+	private:
+		struct set_layout_entry
+		{
+			std::vector<shader_binding> bindings; // Sorted by binding.
+			VkDescriptorSetLayout layout;
+			bool external;
+		};
+
+		struct pipeline_layout_entry
+		{
+			VkDescriptorSetLayout set_layouts[MAX_DESCRIPTOR_SETS];
+			uint32_t set_count;
+			VkPushConstantRange push_constant_range; // Size 0 without push constants.
+			VkPipelineLayout layout;
+		};
+
+		static bool fits(std::vector<shader_binding> const& declared, shader_binding const&);
+
+		VkDescriptorSetLayout get_set_layout(std::vector<shader_binding> const&);
+		set_layout_entry const* find_set_layout(VkDescriptorSetLayout) const;
+		pipeline_layout_entry const* find_pipeline_layout(VkPipelineLayout) const;
+
+		VkDevice m_device;
+		VolkDeviceTable const& m_device_functions;
+
+		VkDescriptorSetLayout m_external_set_layouts[MAX_DESCRIPTOR_SETS]{};
+		std::vector<set_layout_entry> m_set_layouts;
+		std::vector<pipeline_layout_entry> m_pipeline_layouts;
+	};
+}
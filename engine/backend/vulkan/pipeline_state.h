@@ -0,0 +1,105 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "datastructures/hash.h"
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	enum class vertex_layout
+	{
+		none,         // Vertices are generated in the vertex shader.
+		mesh,         // mesh_vertex per vertex and mesh_instance per instance, see mesh.h.
+		mesh_vertices // mesh_vertex per vertex only, the vertex shader reads the instances from storage buffers.
+	};
+
+	// Overrides the default value of a constant_id in the shaders of a pipeline, so one SPIR-V file can be compiled
+	// into variants whose branches on the constant fold away.
+	struct specialization_constant
+	{
+		uint32_t id;
+		uint32_t value; // Bools as VK_TRUE or VK_FALSE, floats through std::bit_cast.
+
+		bool operator==(specialization_constant const&) const = default;
+	};
+
+	// All state that goes into a graphics pipeline. Viewport and scissor are always dynamic and therefore not part
+	// of it, so a pipeline stays valid across swapchain recreation.
+	struct graphics_pipeline_description
+	{
+		std::string vertex_shader;
+		std::string fragment_shader;
+		vertex_layout vertex_input = vertex_layout::none;
+		VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		VkPolygonMode polygon_mode = VK_POLYGON_MODE_FILL;
+		VkCullModeFlags cull_mode = VK_CULL_MODE_BACK_BIT;
+		VkFrontFace front_face = VK_FRONT_FACE_CLOCKWISE;
+		bool blend_enabled = false;
+		bool depth_test_enabled = false; // Tests against and writes depth with VK_COMPARE_OP_LESS.
+		VkPipelineLayout layout = VK_NULL_HANDLE;
+		VkRenderPass render_pass = VK_NULL_HANDLE;
+		uint32_t subpass = 0;
+		VkFormat color_format = VK_FORMAT_UNDEFINED; // Only for dynamic rendering, without a render pass.
+		VkFormat depth_format = VK_FORMAT_UNDEFINED; // Only for dynamic rendering, without a render pass.
+
+		bool operator==(graphics_pipeline_description const&) const = default;
+
+		// Keeps the constants sorted, so variants compare equal whatever order their constants were set in.
+		void specialize(uint32_t id, uint32_t value)
+		{
+			auto it = std::lower_bound(m_specialization_constants.begin(), m_specialization_constants.end(), id,
+									   [](specialization_constant const& constant, uint32_t id) { return constant.id < id; });
+			if (it != m_specialization_constants.end() && it->id == id)
+				it->value = value;
+			else
+				m_specialization_constants.insert(it, { id, value });
+		}
+
+		// Sorted by id, a stage gets the ones it declares.
+		std::vector<specialization_constant> const& specialization_constants() const { return m_specialization_constants; }
+
+		size_t hash() const
+		{
+			size_t seed = std::hash<std::string>{}(vertex_shader);
+			datastructures::hash_combine(seed, std::hash<std::string>{}(fragment_shader));
+			datastructures::hash_combine(seed, (size_t)vertex_input);
+			datastructures::hash_combine(seed, topology);
+			datastructures::hash_combine(seed, polygon_mode);
+			datastructures::hash_combine(seed, cull_mode);
+			datastructures::hash_combine(seed, front_face);
+			datastructures::hash_combine(seed, blend_enabled);
+			datastructures::hash_combine(seed, depth_test_enabled);
+			datastructures::hash_combine(seed, std::hash<VkPipelineLayout>{}(layout));
+			datastructures::hash_combine(seed, std::hash<VkRenderPass>{}(render_pass));
+			datastructures::hash_combine(seed, subpass);
+			datastructures::hash_combine(seed, color_format);
+			datastructures::hash_combine(seed, depth_format);
+			for (auto const& constant : m_specialization_constants)
+			{
+				datastructures::hash_combine(seed, constant.id);
+				datastructures::hash_combine(seed, constant.value);
+			}
+			return seed;
+		}
+
+	private:
+		// Only set through specialize, which keeps them sorted.
+		std::vector<specialization_constant> m_specialization_constants;
+	};
+}
+
+template <>
+struct std::hash<engine::graphics_pipeline_description>
+{
+	size_t operator()(engine::graphics_pipeline_description const& description) const { return description.hash(); }
+};
@@ -0,0 +1,121 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/pipeline_statistics.h"
+
+#include "engine/backend/vulkan/formatters.h"
+
+#include <format>
+#include <iostream>
+
+namespace engine
+{
+	static_assert(sizeof(pipeline_statistics) == 6 * sizeof(uint64_t));
+
+	pipeline_statistics& pipeline_statistics::operator+=(pipeline_statistics const& other)
+	{
+		input_assembly_vertices += other.input_assembly_vertices;
+		input_assembly_primitives += other.input_assembly_primitives;
+		vertex_shader_invocations += other.vertex_shader_invocations;
+		clipping_invocations += other.clipping_invocations;
+		clipping_primitives += other.clipping_primitives;
+		fragment_shader_invocations += other.fragment_shader_invocations;
+		return *this;
+	}
+
+	std::unique_ptr<pipeline_statistics_query> pipeline_statistics_query::create(VkDevice device, VolkDeviceTable const& device_functions,
+																				 uint32_t frames_in_flight)
+	{
+		auto query = std::make_unique<pipeline_statistics_query>(device, device_functions, frames_in_flight);
+
+		VkQueryPoolCreateInfo create_info{};
+		create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		create_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+		create_info.queryCount = 1;
+		create_info.pipelineStatistics = STATISTIC_FLAGS;
+
+		for (size_t i = 0; i < query->m_frames.size(); ++i)
+		{
+			auto result = device_functions.vkCreateQueryPool(device, &create_info, nullptr, &query->m_frames[i].pool);
+			if (result != VK_SUCCESS)
+			{
+				std::cerr << std::format("Failed to create pipeline statistics query pool: {}", result) << std::endl;
+				query->m_frames[i].pool = VK_NULL_HANDLE;
+				return nullptr;
+			}
+		}
+
+		return query;
+	}
+
+	pipeline_statistics_query::~pipeline_statistics_query()
+	{
+		for (auto& frame : m_frames)
+		{
+			if (frame.pool != VK_NULL_HANDLE)
+				m_device_functions.vkDestroyQueryPool(m_device, frame.pool, nullptr);
+		}
+	}
+
+	void pipeline_statistics_query::begin_frame(uint32_t frame_index, VkCommandBuffer command_buffer)
+	{
+		m_current_frame = frame_index;
+
+		auto& frame = m_frames[frame_index];
+		collect_results(frame);
+		m_device_functions.vkCmdResetQueryPool(command_buffer, frame.pool, 0, 1);
+	}
+
+	void pipeline_statistics_query::begin(VkCommandBuffer command_buffer)
+	{
+		m_device_functions.vkCmdBeginQuery(command_buffer, m_frames[m_current_frame].pool, 0, 0);
+	}
+
+	void pipeline_statistics_query::end(VkCommandBuffer command_buffer)
+	{
+		auto& frame = m_frames[m_current_frame];
+		m_device_functions.vkCmdEndQuery(command_buffer, frame.pool, 0);
+		frame.pending = true;
+	}
+
+	void pipeline_statistics_query::discard_frame()
+	{
+		m_frames[m_current_frame].pending = false;
+	}
+
+	void pipeline_statistics_query::collect()
+	{
+		for (auto& frame : m_frames)
+			collect_results(frame);
+	}
+
+	void pipeline_statistics_query::reset_totals()
+	{
+		m_totals = {};
+		m_total_frame_count = 0;
+	}
+
+	void pipeline_statistics_query::collect_results(frame_query& frame)
+	{
+		if (!frame.pending)
+			return;
+
+		// Not ready only happens when the frame was never submitted, its results are dropped then.
+		pipeline_statistics statistics;
+		auto result = m_device_functions.vkGetQueryPoolResults(m_device, frame.pool, 0, 1, sizeof(statistics), &statistics, sizeof(statistics),
+															   VK_QUERY_RESULT_64_BIT);
+		frame.pending = false;
+		if (result != VK_SUCCESS)
+		{
+			if (result != VK_NOT_READY)
+				std::cerr << std::format("Failed to get pipeline statistics query results: {}", result) << std::endl;
+			return;
+		}
+
+		m_last_frame = statistics;
+		m_totals += statistics;
+		++m_total_frame_count;
+	}
+}
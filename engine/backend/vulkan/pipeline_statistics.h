@@ -0,0 +1,89 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "datastructures/fixed_vector.h"
+
+#include <memory>
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	// Counters of one frame's draw workload. Comparing vertex and fragment shader invocations per frame tells a
+	// vertex bound regression apart from one caused by overdraw.
+	struct pipeline_statistics
+	{
+		uint64_t input_assembly_vertices = 0;
+		uint64_t input_assembly_primitives = 0;
+		uint64_t vertex_shader_invocations = 0;
+		uint64_t clipping_invocations = 0;
+		uint64_t clipping_primitives = 0;
+		uint64_t fragment_shader_invocations = 0;
+
+		pipeline_statistics& operator+=(pipeline_statistics const&);
+	};
+
+	// Counts the pipeline statistics of the draws recorded between begin and end, once per frame. Like the timestamps
+	// of gpu_profiler, every frame in flight has its own query that is read when the frame index begins again, so
+	// collecting never stalls. Results are also summed until reset_totals, for averages over a benchmark run.
+	class pipeline_statistics_query
+	{
+	public:
+		// Results are written in the order of the bits, which is the order of the pipeline_statistics members.
+		// Secondary command buffers executed while the query is active have to inherit all of them.
+		static constexpr VkQueryPipelineStatisticFlags STATISTIC_FLAGS = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+																		 VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+																		 VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+																		 VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+																		 VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+																		 VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+		static std::unique_ptr<pipeline_statistics_query> create(VkDevice, VolkDeviceTable const&, uint32_t frames_in_flight);
+
+		pipeline_statistics_query(VkDevice device, VolkDeviceTable const& device_functions, uint32_t frames_in_flight)
+			: m_device(device), m_device_functions(device_functions), m_frames(frames_in_flight) {}
+		~pipeline_statistics_query();
+
+		pipeline_statistics_query(pipeline_statistics_query const&) = delete;
+		pipeline_statistics_query& operator=(pipeline_statistics_query const&) = delete;
+
+		// The previous use of this frame index has to have finished on the GPU. Resets the query, so it has to be
+		// recorded outside of any render pass. Begin and end have to be both inside or both outside of one.
+		void begin_frame(uint32_t frame_index, VkCommandBuffer);
+		void begin(VkCommandBuffer);
+		void end(VkCommandBuffer);
+		// For a frame whose command buffer is never submitted, whose query would still hold an older frame's results.
+		void discard_frame();
+
+		// Reads the results of all finished frames, for when frames stop being recorded, e.g. after wait_idle.
+		void collect();
+
+		pipeline_statistics const& last_frame() const { return m_last_frame; }
+		pipeline_statistics const& totals() const { return m_totals; }
+		uint32_t total_frame_count() const { return m_total_frame_count; }
+		void reset_totals();
+
+	private:
+		struct frame_query
+		{
+			VkQueryPool pool = VK_NULL_HANDLE;
+			bool pending = false; // Ended in a frame whose results haven't been read yet.
+		};
+
+		void collect_results(frame_query&);
+
+		VkDevice m_device;
+		VolkDeviceTable const& m_device_functions;
+
+		datastructures::fixed_vector<frame_query> m_frames;
+		uint32_t m_current_frame = 0;
+
+		pipeline_statistics m_last_frame;
+		pipeline_statistics m_totals;
+		uint32_t m_total_frame_count = 0;
+	};
+}
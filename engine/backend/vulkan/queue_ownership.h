@@ -0,0 +1,64 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	// Resources created with VK_SHARING_MODE_EXCLUSIVE belong to one queue family at a time. Moving one to another
+	// family takes a release barrier recorded on the source queue and an acquire barrier on the destination queue,
+	// which must execute after the release (through a semaphore, or a fence the CPU waited on before submitting).
+	// Both barriers describe the same transfer; only the source access mask matters for the release and only the
+	// destination access mask for the acquire. Nothing needs to be recorded when both families are the same.
+
+	inline VkBufferMemoryBarrier buffer_ownership_release(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, VkAccessFlags src_access,
+														  uint32_t src_queue_family, uint32_t dst_queue_family)
+	{
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = src_access;
+		barrier.srcQueueFamilyIndex = src_queue_family;
+		barrier.dstQueueFamilyIndex = dst_queue_family;
+		barrier.buffer = buffer;
+		barrier.offset = offset;
+		barrier.size = size;
+		return barrier;
+	}
+
+	inline VkBufferMemoryBarrier buffer_ownership_acquire(VkBufferMemoryBarrier const& release, VkAccessFlags dst_access)
+	{
+		auto barrier = release;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = dst_access;
+		return barrier;
+	}
+
+	// A layout transition in an ownership transfer is performed once, but both barriers have to specify it.
+	inline VkImageMemoryBarrier image_ownership_release(VkImage image, VkImageSubresourceRange const& range, VkImageLayout old_layout,
+														VkImageLayout new_layout, VkAccessFlags src_access, uint32_t src_queue_family,
+														uint32_t dst_queue_family)
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = src_access;
+		barrier.oldLayout = old_layout;
+		barrier.newLayout = new_layout;
+		barrier.srcQueueFamilyIndex = src_queue_family;
+		barrier.dstQueueFamilyIndex = dst_queue_family;
+		barrier.image = image;
+		barrier.subresourceRange = range;
+		return barrier;
+	}
+
+	inline VkImageMemoryBarrier image_ownership_acquire(VkImageMemoryBarrier const& release, VkAccessFlags dst_access)
+	{
+		auto barrier = release;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = dst_access;
+		return barrier;
+	}
+}
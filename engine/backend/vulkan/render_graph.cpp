@@ -0,0 +1,770 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/render_graph.h"
+
+#include "engine/backend/vulkan/formatters.h"
+#include "engine/backend/vulkan/gpu_profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <format>
+#include <iostream>
+
+namespace engine
+{
+	namespace
+	{
+		struct access_info
+		{
+			VkPipelineStageFlags2 stages;
+			VkAccessFlags2 accesses;
+			VkImageLayout layout; // Undefined for accesses that only apply to buffers.
+			VkImageUsageFlags usage;
+		};
+
+		access_info get_access_info(render_graph::access type)
+		{
+			constexpr VkPipelineStageFlags2 SHADER_STAGES = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT |
+															VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+			constexpr VkPipelineStageFlags2 DEPTH_STAGES = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+
+			switch (type)
+			{
+			case render_graph::access::color_attachment:
+				return { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+						 VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT };
+			case render_graph::access::depth_attachment:
+				return { DEPTH_STAGES, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+						 VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT };
+			case render_graph::access::depth_read:
+				return { DEPTH_STAGES | SHADER_STAGES, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+						 VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT };
+			case render_graph::access::sampled:
+				return { SHADER_STAGES, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT };
+			case render_graph::access::storage_read:
+				return { SHADER_STAGES, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT };
+			case render_graph::access::storage_write:
+				return { SHADER_STAGES, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
+						 VK_IMAGE_USAGE_STORAGE_BIT };
+			case render_graph::access::transfer_read:
+				return { VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+						 VK_IMAGE_USAGE_TRANSFER_SRC_BIT };
+			case render_graph::access::transfer_write:
+				return { VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+						 VK_IMAGE_USAGE_TRANSFER_DST_BIT };
+			case render_graph::access::indirect_read:
+				return { VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+			case render_graph::access::vertex_read:
+				return { VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+			}
+
+			return {};
+		}
+
+		VkImageAspectFlags get_aspect(VkFormat format)
+		{
+			switch (format)
+			{
+			case VK_FORMAT_D16_UNORM:
+			case VK_FORMAT_X8_D24_UNORM_PACK32:
+			case VK_FORMAT_D32_SFLOAT:
+				return VK_IMAGE_ASPECT_DEPTH_BIT;
+			case VK_FORMAT_D16_UNORM_S8_UINT:
+			case VK_FORMAT_D24_UNORM_S8_UINT:
+			case VK_FORMAT_D32_SFLOAT_S8_UINT:
+				return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+			default:
+				return VK_IMAGE_ASPECT_COLOR_BIT;
+			}
+		}
+
+		char const* get_layout_name(VkImageLayout layout)
+		{
+			switch (layout)
+			{
+			case VK_IMAGE_LAYOUT_UNDEFINED:
+				return "UNDEFINED";
+			case VK_IMAGE_LAYOUT_GENERAL:
+				return "GENERAL";
+			case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+				return "COLOR_ATTACHMENT_OPTIMAL";
+			case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+				return "DEPTH_STENCIL_ATTACHMENT_OPTIMAL";
+			case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+				return "DEPTH_STENCIL_READ_ONLY_OPTIMAL";
+			case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+				return "SHADER_READ_ONLY_OPTIMAL";
+			case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+				return "TRANSFER_SRC_OPTIMAL";
+			case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+				return "TRANSFER_DST_OPTIMAL";
+			case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+				return "PRESENT_SRC_KHR";
+			default:
+				return "other";
+			}
+		}
+	}
+
+	render_graph::~render_graph()
+	{
+		destroy_transient_images();
+	}
+
+	void render_graph::reset()
+	{
+		m_resources.clear();
+		m_uses.clear();
+		m_passes.clear();
+		m_image_barriers.clear();
+		m_final_barriers.clear();
+	}
+
+	render_graph::resource render_graph::import_image(VkImage image, VkImageView image_view, VkFormat format, VkExtent2D extent,
+													  VkImageLayout initial_layout, VkImageLayout final_layout)
+	{
+		resource_data data{};
+		data.type = resource_type::imported_image;
+		data.description = { format, extent };
+		data.image = image;
+		data.view = image_view;
+		data.initial_layout = initial_layout;
+		data.final_layout = final_layout;
+		m_resources.push_back(data);
+		return (resource)m_resources.size() - 1;
+	}
+
+	render_graph::resource render_graph::import_buffer(VkBuffer buffer)
+	{
+		resource_data data{};
+		data.type = resource_type::imported_buffer;
+		data.buffer = buffer;
+		m_resources.push_back(data);
+		return (resource)m_resources.size() - 1;
+	}
+
+	render_graph::resource render_graph::create_image(image_description const& description)
+	{
+		resource_data data{};
+		data.type = resource_type::transient_image;
+		data.description = description;
+		m_resources.push_back(data);
+		return (resource)m_resources.size() - 1;
+	}
+
+	render_graph::pass render_graph::add_pass(char const* name, execute_callback execute)
+	{
+		auto& new_pass = m_passes.emplace_back();
+		new_pass.name = name;
+		new_pass.execute = std::move(execute);
+		return (pass)m_passes.size() - 1;
+	}
+
+	void render_graph::read(pass user, resource target, access type)
+	{
+		m_uses.push_back({ user, target, type, false });
+	}
+
+	void render_graph::write(pass user, resource target, access type)
+	{
+		m_uses.push_back({ user, target, type, true });
+	}
+
+	void render_graph::set_color_attachment(pass user, resource target, VkAttachmentLoadOp load_op, VkClearColorValue clear_color /* = {} */)
+	{
+		auto& data = m_passes[user];
+		assert(data.color_attachment_count < MAX_COLOR_ATTACHMENTS);
+
+		auto& color_attachment = data.color_attachments[data.color_attachment_count++];
+		color_attachment.target = target;
+		color_attachment.load_op = load_op;
+		color_attachment.clear.color = clear_color;
+
+		// Loading the old contents makes the pass depend on whatever wrote them.
+		if (load_op == VK_ATTACHMENT_LOAD_OP_LOAD)
+			read(user, target, access::color_attachment);
+		write(user, target, access::color_attachment);
+	}
+
+	void render_graph::set_depth_attachment(pass user, resource target, VkAttachmentLoadOp load_op, float clear_depth /* = 1.f */)
+	{
+		auto& depth_attachment = m_passes[user].depth_attachment;
+		depth_attachment.target = target;
+		depth_attachment.load_op = load_op;
+		depth_attachment.clear.depthStencil = { clear_depth, 0 };
+
+		if (load_op == VK_ATTACHMENT_LOAD_OP_LOAD)
+			read(user, target, access::depth_attachment);
+		write(user, target, access::depth_attachment);
+	}
+
+	void render_graph::keep(pass user)
+	{
+		m_passes[user].kept = true;
+	}
+
+	void render_graph::use_secondary_command_buffers(pass user)
+	{
+		m_passes[user].secondary_command_buffers = true;
+	}
+
+	bool render_graph::compile()
+	{
+		cull_passes();
+
+		for (uint32_t i = 0; i < m_passes.size(); ++i)
+		{
+			auto const& data = m_passes[i];
+			if (data.culled)
+				continue;
+
+			// Dynamic rendering has a single render area, so every attachment has to cover it.
+			resource targets[MAX_COLOR_ATTACHMENTS + 1];
+			uint32_t target_count = 0;
+			for (uint32_t j = 0; j < data.color_attachment_count; ++j)
+				targets[target_count++] = data.color_attachments[j].target;
+			if (data.depth_attachment.target != INVALID_RESOURCE)
+				targets[target_count++] = data.depth_attachment.target;
+
+			auto render_area = target_count > 0 ? extent(targets[0]) : VkExtent2D{};
+			for (uint32_t j = 1; j < target_count; ++j)
+			{
+				auto attachment_extent = extent(targets[j]);
+				if (attachment_extent.width != render_area.width || attachment_extent.height != render_area.height)
+				{
+					std::cerr << std::format("Failed to compile render graph: pass {} has attachments of different sizes", data.name) << std::endl;
+					return false;
+				}
+			}
+		}
+
+		for (auto const& use : m_uses)
+		{
+			if (m_passes[use.user].culled)
+				continue;
+
+			auto& data = m_resources[use.target];
+			data.first_pass = std::min(data.first_pass, use.user);
+			data.last_pass = std::max(data.last_pass, use.user);
+			data.usage |= get_access_info(use.type).usage;
+		}
+
+		if (!allocate_transient_images())
+			return false;
+
+		compute_barriers();
+		return true;
+	}
+
+	void render_graph::execute(VkCommandBuffer command_buffer, gpu_profiler* profiler /* = nullptr */)
+	{
+		for (uint32_t i = 0; i < m_passes.size(); ++i)
+		{
+			auto const& data = m_passes[i];
+			if (data.culled)
+				continue;
+
+			// Nothing reads a transient image after its last pass, so tilers don't have to write it to memory.
+			auto store_op = [&](resource target) {
+				auto const& target_data = m_resources[target];
+				return target_data.type == resource_type::transient_image && target_data.last_pass == i ? VK_ATTACHMENT_STORE_OP_DONT_CARE
+																										: VK_ATTACHMENT_STORE_OP_STORE;
+			};
+
+			auto region = profiler != nullptr ? profiler->begin_region(command_buffer, data.name) : 0;
+
+			if (data.image_barrier_count > 0 || data.memory_barrier.srcStageMask != VK_PIPELINE_STAGE_2_NONE)
+			{
+				VkDependencyInfo dependency_info{};
+				dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+				if (data.memory_barrier.srcStageMask != VK_PIPELINE_STAGE_2_NONE)
+				{
+					dependency_info.pMemoryBarriers = &data.memory_barrier;
+					dependency_info.memoryBarrierCount = 1;
+				}
+				dependency_info.pImageMemoryBarriers = m_image_barriers.data() + data.first_image_barrier;
+				dependency_info.imageMemoryBarrierCount = data.image_barrier_count;
+				m_device_functions.vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+			}
+
+			bool has_attachments = data.color_attachment_count > 0 || data.depth_attachment.target != INVALID_RESOURCE;
+			if (has_attachments)
+			{
+				VkRenderingAttachmentInfo color_attachments[MAX_COLOR_ATTACHMENTS]{};
+				for (uint32_t j = 0; j < data.color_attachment_count; ++j)
+				{
+					auto const& color_attachment = data.color_attachments[j];
+					color_attachments[j].sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+					color_attachments[j].imageView = image_view(color_attachment.target);
+					color_attachments[j].imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+					color_attachments[j].loadOp = color_attachment.load_op;
+					color_attachments[j].storeOp = store_op(color_attachment.target);
+					color_attachments[j].clearValue = color_attachment.clear;
+				}
+
+				VkRenderingAttachmentInfo depth_attachment{};
+				if (data.depth_attachment.target != INVALID_RESOURCE)
+				{
+					depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+					depth_attachment.imageView = image_view(data.depth_attachment.target);
+					depth_attachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+					depth_attachment.loadOp = data.depth_attachment.load_op;
+					depth_attachment.storeOp = store_op(data.depth_attachment.target);
+					depth_attachment.clearValue = data.depth_attachment.clear;
+				}
+
+				auto render_target = data.color_attachment_count > 0 ? data.color_attachments[0].target : data.depth_attachment.target;
+
+				VkRenderingInfo rendering_info{};
+				rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+				rendering_info.renderArea.extent = extent(render_target);
+				rendering_info.layerCount = 1;
+				if (data.secondary_command_buffers)
+					rendering_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+				rendering_info.pColorAttachments = color_attachments;
+				rendering_info.colorAttachmentCount = data.color_attachment_count;
+				if (data.depth_attachment.target != INVALID_RESOURCE)
+					rendering_info.pDepthAttachment = &depth_attachment;
+				m_device_functions.vkCmdBeginRendering(command_buffer, &rendering_info);
+			}
+
+			if (data.execute)
+				data.execute(command_buffer);
+
+			if (has_attachments)
+				m_device_functions.vkCmdEndRendering(command_buffer);
+
+			if (profiler != nullptr)
+				profiler->end_region(command_buffer, region);
+		}
+
+		if (!m_final_barriers.empty())
+		{
+			VkDependencyInfo dependency_info{};
+			dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+			dependency_info.pImageMemoryBarriers = m_final_barriers.data();
+			dependency_info.imageMemoryBarrierCount = (uint32_t)m_final_barriers.size();
+			m_device_functions.vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+		}
+	}
+
+	bool render_graph::allocate_transient_images()
+	{
+		datastructures::vector<physical_image> wanted;
+		for (uint32_t i = 0; i < m_resources.size(); ++i)
+		{
+			auto& data = m_resources[i];
+			if (data.type != resource_type::transient_image || data.first_pass == ~0u)
+				continue;
+
+			physical_image image{};
+			image.description = data.description;
+			image.usage = data.usage;
+			image.first_pass = data.first_pass;
+			image.last_pass = data.last_pass;
+			image.previous = ~0u;
+			image.owner = i;
+			data.physical_image = (uint32_t)wanted.size();
+			wanted.push_back(image);
+		}
+
+		// A graph that compiles to the same transient images as last time keeps using them, aliasing included.
+		bool unchanged = wanted.size() == m_physical_images.size();
+		for (uint32_t i = 0; unchanged && i < wanted.size(); ++i)
+		{
+			auto const& cached = m_physical_images[i];
+			unchanged = wanted[i].description == cached.description && wanted[i].usage == cached.usage &&
+						wanted[i].first_pass == cached.first_pass && wanted[i].last_pass == cached.last_pass;
+		}
+
+		if (!unchanged)
+		{
+			destroy_transient_images();
+			if (!wanted.empty() && !create_transient_images(wanted))
+			{
+				destroy_transient_images();
+				return false;
+			}
+		}
+
+		for (uint32_t i = 0; i < m_physical_images.size(); ++i)
+		{
+			auto& image = m_physical_images[i];
+			image.owner = wanted[i].owner;
+
+			auto& data = m_resources[image.owner];
+			data.image = image.image;
+			data.view = image.view;
+		}
+
+		return true;
+	}
+
+	bool render_graph::create_transient_images(datastructures::vector<physical_image>& wanted)
+	{
+		for (auto const& image : wanted)
+			m_physical_images.push_back(image);
+
+		struct memory_slot
+		{
+			VkDeviceSize size;
+			VkDeviceSize alignment;
+			uint32_t memory_type_bits;
+			uint32_t last_pass;
+			uint32_t last_image;
+		};
+
+		datastructures::vector<memory_slot> slots;
+
+		// Images are placed in order of their first pass, each in the first slot whose images are all done with
+		// their memory by then, which keeps the number of slots close to the most images alive at once.
+		datastructures::vector<uint32_t> order;
+		for (uint32_t i = 0; i < m_physical_images.size(); ++i)
+			order.push_back(i);
+		std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) { return m_physical_images[a].first_pass < m_physical_images[b].first_pass; });
+
+		for (auto index : order)
+		{
+			auto& image = m_physical_images[index];
+
+			VkImageCreateInfo create_info{};
+			create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			create_info.imageType = VK_IMAGE_TYPE_2D;
+			create_info.format = image.description.format;
+			create_info.extent = { image.description.extent.width, image.description.extent.height, 1 };
+			create_info.mipLevels = 1;
+			create_info.arrayLayers = 1;
+			create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+			create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+			create_info.usage = image.usage;
+			create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+			auto result = m_device_functions.vkCreateImage(m_device, &create_info, nullptr, &image.image);
+			if (result != VK_SUCCESS)
+			{
+				std::cerr << std::format("Failed to create transient image: {}", result) << std::endl;
+				image.image = VK_NULL_HANDLE;
+				return false;
+			}
+
+			VkMemoryRequirements requirements;
+			m_device_functions.vkGetImageMemoryRequirements(m_device, image.image, &requirements);
+
+			uint32_t slot = 0;
+			while (slot < slots.size() &&
+				   (slots[slot].last_pass >= image.first_pass || (slots[slot].memory_type_bits & requirements.memoryTypeBits) == 0))
+				++slot;
+
+			if (slot == slots.size())
+				slots.push_back({ 0, 1, ~0u, 0, ~0u });
+
+			auto& memory = slots[slot];
+			memory.size = std::max(memory.size, requirements.size);
+			memory.alignment = std::max(memory.alignment, requirements.alignment);
+			memory.memory_type_bits &= requirements.memoryTypeBits;
+			memory.last_pass = image.last_pass;
+
+			image.slot = slot;
+			image.previous = memory.last_image;
+			memory.last_image = index;
+		}
+
+		m_transient_memory_size = 0;
+		for (auto const& memory : slots)
+		{
+			VkMemoryRequirements requirements{ memory.size, memory.alignment, memory.memory_type_bits };
+			auto allocation = m_allocator.allocate(requirements, memory_usage::gpu_only, resource_tiling::optimal, memory_category::attachment);
+			if (!allocation.is_valid())
+				return false;
+
+			m_slots.push_back(allocation);
+			m_transient_memory_size += memory.size;
+		}
+
+		for (auto& image : m_physical_images)
+		{
+			auto const& allocation = m_slots[image.slot];
+			auto result = m_device_functions.vkBindImageMemory(m_device, image.image, allocation.memory, allocation.offset);
+			if (result != VK_SUCCESS)
+			{
+				std::cerr << std::format("Failed to bind transient image memory: {}", result) << std::endl;
+				return false;
+			}
+
+			VkImageViewCreateInfo view_create_info{};
+			view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			view_create_info.image = image.image;
+			view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			view_create_info.format = image.description.format;
+			view_create_info.subresourceRange.aspectMask = get_aspect(image.description.format) & ~VK_IMAGE_ASPECT_STENCIL_BIT;
+			view_create_info.subresourceRange.levelCount = 1;
+			view_create_info.subresourceRange.layerCount = 1;
+
+			result = m_device_functions.vkCreateImageView(m_device, &view_create_info, nullptr, &image.view);
+			if (result != VK_SUCCESS)
+			{
+				std::cerr << std::format("Failed to create transient image view: {}", result) << std::endl;
+				image.view = VK_NULL_HANDLE;
+				return false;
+			}
+		}
+
+		std::cout << std::format("Render graph placed {} transient image(s) in {} memory slot(s), {} bytes", m_physical_images.size(), m_slots.size(),
+								 m_transient_memory_size)
+				  << std::endl;
+		return true;
+	}
+
+	void render_graph::compute_barriers()
+	{
+		m_barrier_count = 0;
+
+		for (auto& data : m_resources)
+		{
+			data.state = {};
+			if (data.type == resource_type::imported_image)
+			{
+				// Whatever used the image before this command buffer is only known to the caller, so the first
+				// barrier waits for everything. That also chains with a semaphore wait at any stage.
+				data.state.layout = data.initial_layout;
+				data.state.stages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+			}
+		}
+
+		for (uint32_t i = 0; i < m_passes.size(); ++i)
+		{
+			auto& data = m_passes[i];
+			if (data.culled)
+				continue;
+
+			data.first_image_barrier = (uint32_t)m_image_barriers.size();
+			data.memory_barrier = {};
+			data.memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+
+			for (auto const& use : m_uses)
+			{
+				if (use.user != i)
+					continue;
+
+				auto& target = m_resources[use.target];
+				auto info = get_access_info(use.type);
+				auto& state = target.state;
+
+				// The previous image in an aliased memory slot has to be done with it, its contents are discarded.
+				if (target.type == resource_type::transient_image && target.first_pass == i && state.stages == VK_PIPELINE_STAGE_2_NONE)
+				{
+					auto previous = m_physical_images[target.physical_image].previous;
+					if (previous != ~0u)
+					{
+						auto const& previous_state = m_resources[m_physical_images[previous].owner].state;
+						state.stages = previous_state.stages;
+						state.accesses = previous_state.written ? previous_state.accesses : VK_ACCESS_2_NONE;
+					}
+				}
+
+				bool is_image = target.type != resource_type::imported_buffer;
+				bool layout_change = is_image && state.layout != info.layout;
+
+				// Reads of something nobody wrote since the last barrier only need to be added to the state.
+				if (!layout_change && !state.written && !use.write)
+				{
+					state.stages |= info.stages;
+					state.accesses |= info.accesses;
+					continue;
+				}
+
+				// A second use of the resource in the same pass was already covered by the first one.
+				if (!layout_change && target.last_barrier_pass == i)
+				{
+					state.stages |= info.stages;
+					state.accesses |= info.accesses;
+					state.written |= use.write;
+					continue;
+				}
+
+				// Write after read only needs the reads to have finished, not their memory to be made available.
+				auto src_accesses = state.written ? state.accesses : VK_ACCESS_2_NONE;
+				if (is_image)
+				{
+					VkImageMemoryBarrier2 barrier{};
+					barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+					barrier.srcStageMask = state.stages;
+					barrier.srcAccessMask = src_accesses;
+					barrier.dstStageMask = info.stages;
+					barrier.dstAccessMask = info.accesses;
+					barrier.oldLayout = state.layout;
+					barrier.newLayout = info.layout;
+					barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+					barrier.image = target.image;
+					barrier.subresourceRange.aspectMask = get_aspect(target.description.format);
+					barrier.subresourceRange.levelCount = 1;
+					barrier.subresourceRange.layerCount = 1;
+					m_image_barriers.push_back(barrier);
+				}
+				else
+				{
+					// Buffers are covered by a single global barrier per pass, which is cheaper than one per buffer.
+					data.memory_barrier.srcStageMask |= state.stages;
+					data.memory_barrier.srcAccessMask |= src_accesses;
+					data.memory_barrier.dstStageMask |= info.stages;
+					data.memory_barrier.dstAccessMask |= info.accesses;
+				}
+
+				state.layout = info.layout;
+				state.stages = info.stages;
+				state.accesses = info.accesses;
+				state.written = use.write;
+				target.last_barrier_pass = i;
+			}
+
+			data.image_barrier_count = (uint32_t)m_image_barriers.size() - data.first_image_barrier;
+			m_barrier_count += data.image_barrier_count + (data.memory_barrier.srcStageMask != VK_PIPELINE_STAGE_2_NONE ? 1 : 0);
+		}
+
+		// Imported images are handed back in the layout the caller expects.
+		for (auto const& data : m_resources)
+		{
+			if (data.type != resource_type::imported_image || data.final_layout == VK_IMAGE_LAYOUT_UNDEFINED ||
+				data.state.layout == data.final_layout)
+				continue;
+
+			VkImageMemoryBarrier2 barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+			barrier.srcStageMask = data.state.stages;
+			barrier.srcAccessMask = data.state.written ? data.state.accesses : VK_ACCESS_2_NONE;
+			barrier.oldLayout = data.state.layout;
+			barrier.newLayout = data.final_layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = data.image;
+			barrier.subresourceRange.aspectMask = get_aspect(data.description.format);
+			barrier.subresourceRange.levelCount = 1;
+			barrier.subresourceRange.layerCount = 1;
+
+			// Presentation needs no destination scope, the semaphore signaled after the submit covers it.
+			if (data.final_layout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL)
+			{
+				barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+				barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+			}
+			else if (data.final_layout != VK_IMAGE_LAYOUT_PRESENT_SRC_KHR)
+			{
+				barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+				barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+			}
+
+			m_final_barriers.push_back(barrier);
+		}
+
+		m_barrier_count += (uint32_t)m_final_barriers.size();
+	}
+
+	void render_graph::cull_passes()
+	{
+		// Walking backwards, a pass is needed when it writes something outside the graph or something a needed
+		// pass reads. Everything it reads is then needed as well.
+		m_culled_pass_count = 0;
+		for (uint32_t i = (uint32_t)m_passes.size(); i-- > 0;)
+		{
+			auto& data = m_passes[i];
+
+			bool needed = data.kept;
+			for (auto const& use : m_uses)
+			{
+				if (use.user == i && use.write)
+					needed |= m_resources[use.target].type != resource_type::transient_image || m_resources[use.target].needed;
+			}
+
+			data.culled = !needed;
+			if (data.culled)
+			{
+				++m_culled_pass_count;
+				continue;
+			}
+
+			for (auto const& use : m_uses)
+			{
+				if (use.user == i && !use.write)
+					m_resources[use.target].needed = true;
+			}
+		}
+	}
+
+	void render_graph::output_compiled_graph() const
+	{
+		std::cout << std::format("Render graph of {} pass(es), {} culled, with {} barrier(s):", m_passes.size(), m_culled_pass_count, m_barrier_count)
+				  << std::endl;
+		for (auto const& data : m_passes)
+		{
+			std::cout << std::format("\t{}{}", data.name, data.culled ? " (culled)" : "") << std::endl;
+			if (data.culled)
+				continue;
+
+			if (data.memory_barrier.srcStageMask != VK_PIPELINE_STAGE_2_NONE)
+			{
+				auto const& barrier = data.memory_barrier;
+				std::cout << std::format("\t\tbuffers: stages {:#x} -> {:#x}, accesses {:#x} -> {:#x}", barrier.srcStageMask, barrier.dstStageMask,
+										 barrier.srcAccessMask, barrier.dstAccessMask)
+						  << std::endl;
+			}
+
+			for (uint32_t i = 0; i < data.image_barrier_count; ++i)
+				output_image_barrier(m_image_barriers[data.first_image_barrier + i]);
+		}
+
+		if (!m_final_barriers.empty())
+			std::cout << "\tafter the last pass" << std::endl;
+		for (auto const& barrier : m_final_barriers)
+			output_image_barrier(barrier);
+
+		// An image aliases the previous image in its slot, whose last pass has to come before its first one.
+		for (auto const& image : m_physical_images)
+		{
+			auto aliased = image.previous != ~0u ? std::format(", aliases image {} used until pass {}", m_physical_images[image.previous].owner,
+																m_physical_images[image.previous].last_pass)
+												 : std::string();
+			std::cout << std::format("\ttransient image {} in slot {}, used by passes {} to {}{}", image.owner, image.slot, image.first_pass,
+									 image.last_pass, aliased)
+					  << std::endl;
+		}
+	}
+
+	void render_graph::output_image_barrier(VkImageMemoryBarrier2 const& barrier) const
+	{
+		resource target = INVALID_RESOURCE;
+		for (uint32_t i = 0; i < m_resources.size() && target == INVALID_RESOURCE; ++i)
+		{
+			if (m_resources[i].type != resource_type::imported_buffer && m_resources[i].image == barrier.image)
+				target = i;
+		}
+
+		std::cout << std::format("\t\timage {}: {} -> {}, stages {:#x} -> {:#x}, accesses {:#x} -> {:#x}", target,
+								 get_layout_name(barrier.oldLayout), get_layout_name(barrier.newLayout), barrier.srcStageMask,
+								 barrier.dstStageMask, barrier.srcAccessMask, barrier.dstAccessMask)
+				  << std::endl;
+	}
+
+	void render_graph::destroy_transient_images()
+	{
+		for (auto& image : m_physical_images)
+		{
+			if (image.view != VK_NULL_HANDLE)
+				m_device_functions.vkDestroyImageView(m_device, image.view, nullptr);
+
+			if (image.image != VK_NULL_HANDLE)
+				m_device_functions.vkDestroyImage(m_device, image.image, nullptr);
+		}
+
+		for (auto& allocation : m_slots)
+			m_allocator.free(allocation);
+
+		m_physical_images.clear();
+		m_slots.clear();
+		m_transient_memory_size = 0;
+	}
+}
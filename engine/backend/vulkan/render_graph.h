@@ -0,0 +1,210 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "datastructures/vector.h"
+#include "engine/backend/vulkan/memory_allocator.h"
+
+#include <functional>
+#include <vector>
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	class gpu_profiler;
+
+	// A frame described as passes that declare which images and buffers they read and write. Compiling the graph
+	// culls passes whose results are never used, works out every layout transition and dependency, and batches them
+	// into one synchronization2 barrier per pass. Transient images only live inside the graph, and the ones whose
+	// lifetimes don't overlap share memory. Passes with attachments are recorded with dynamic rendering.
+	//
+	// The graph is rebuilt every frame by reset, declaring and compile. Transient images are kept as long as the
+	// graph compiles to the same set of them. Each frame in flight needs its own graph, so the transient images of
+	// a frame the GPU is still working on are never touched.
+	class render_graph
+	{
+	public:
+		using resource = uint32_t;
+		using pass = uint32_t;
+
+		static constexpr resource INVALID_RESOURCE = ~0u;
+		static constexpr uint32_t MAX_COLOR_ATTACHMENTS = 8;
+
+		enum class access
+		{
+			color_attachment,
+			depth_attachment,
+			depth_read,
+			sampled,
+			storage_read,
+			storage_write,
+			transfer_read,
+			transfer_write,
+			indirect_read,
+			vertex_read
+		};
+
+		struct image_description
+		{
+			VkFormat format = VK_FORMAT_UNDEFINED;
+			VkExtent2D extent{};
+
+			bool operator==(image_description const&) const = default;
+		};
+
+		using execute_callback = std::function<void(VkCommandBuffer)>;
+
+		render_graph(VkDevice device, VolkDeviceTable const& device_functions, memory_allocator& allocator)
+			: m_device(device), m_device_functions(device_functions), m_allocator(allocator) {}
+		~render_graph();
+
+		render_graph(render_graph const&) = delete;
+		render_graph& operator=(render_graph const&) = delete;
+
+		// Forgets all passes and resources, but keeps the transient images for the next compile.
+		void reset();
+
+		// Imported resources outlive the graph. An imported image starts in initial_layout and is left in
+		// final_layout, writing one keeps the pass that does so.
+		resource import_image(VkImage, VkImageView, VkFormat, VkExtent2D, VkImageLayout initial_layout, VkImageLayout final_layout);
+		resource import_buffer(VkBuffer);
+		resource create_image(image_description const&);
+
+		pass add_pass(char const* name, execute_callback);
+		void read(pass, resource, access);
+		void write(pass, resource, access);
+		// Both also declare the write. Passes with attachments are recorded inside vkCmdBeginRendering.
+		void set_color_attachment(pass, resource, VkAttachmentLoadOp, VkClearColorValue clear_color = {});
+		void set_depth_attachment(pass, resource, VkAttachmentLoadOp, float clear_depth = 1.f);
+		// Keeps a pass that only has effects outside the graph, such as writing an imported buffer nothing reads.
+		void keep(pass);
+		// The pass only executes secondary command buffers inside its vkCmdBeginRendering, which have to be recorded
+		// with the formats of its attachments.
+		void use_secondary_command_buffers(pass);
+
+		bool compile();
+		// Each pass is timed as a region named after it when a profiler is given.
+		void execute(VkCommandBuffer, gpu_profiler* profiler = nullptr);
+
+		VkImage image(resource value) const { return m_resources[value].image; }
+		VkImageView image_view(resource value) const { return m_resources[value].view; }
+		VkExtent2D extent(resource value) const { return m_resources[value].description.extent; }
+
+		uint32_t culled_pass_count() const { return m_culled_pass_count; }
+		uint32_t barrier_count() const { return m_barrier_count; }
+		VkDeviceSize transient_memory_size() const { return m_transient_memory_size; }
+		// Prints the barriers recorded before every pass and the memory slot of every transient image, to check the
+		// synchronization and aliasing a compiled graph ends up with.
+		void output_compiled_graph() const;
+
+	private:
+		enum class resource_type : uint8_t
+		{
+			imported_image,
+			imported_buffer,
+			transient_image
+		};
+
+		// The state a resource was left in by the last pass that used it.
+		struct resource_state
+		{
+			VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VkPipelineStageFlags2 stages = VK_PIPELINE_STAGE_2_NONE;
+			VkAccessFlags2 accesses = VK_ACCESS_2_NONE;
+			bool written = false;
+		};
+
+		struct resource_data
+		{
+			resource_type type;
+			image_description description;
+			VkImage image = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VkImageLayout final_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VkImageUsageFlags usage = 0;
+			uint32_t first_pass = ~0u;
+			uint32_t last_pass = 0;
+			uint32_t physical_image = ~0u; // Index into m_physical_images for transient images.
+			uint32_t last_barrier_pass = ~0u;
+			bool needed = false;
+			resource_state state;
+		};
+
+		struct resource_use
+		{
+			pass user;
+			resource target;
+			access type;
+			bool write;
+		};
+
+		struct attachment
+		{
+			resource target = INVALID_RESOURCE;
+			VkAttachmentLoadOp load_op = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			VkClearValue clear{};
+		};
+
+		struct pass_data
+		{
+			char const* name;
+			execute_callback execute;
+			attachment color_attachments[MAX_COLOR_ATTACHMENTS];
+			uint32_t color_attachment_count = 0;
+			attachment depth_attachment;
+			bool kept = false;
+			bool culled = false;
+			bool secondary_command_buffers = false;
+
+			// Barriers recorded before the pass, a range of m_image_barriers and one global memory barrier for buffers.
+			uint32_t first_image_barrier = 0;
+			uint32_t image_barrier_count = 0;
+			VkMemoryBarrier2 memory_barrier{};
+		};
+
+		// A transient image together with the memory slot it is bound to. Images in the same slot alias, the
+		// previous image in the slot has to be done with the memory before this one is first used.
+		struct physical_image
+		{
+			image_description description;
+			VkImageUsageFlags usage = 0;
+			uint32_t first_pass = 0;
+			uint32_t last_pass = 0;
+			uint32_t slot = 0;
+			uint32_t previous = ~0u;
+			resource owner = INVALID_RESOURCE;
+			VkImage image = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+		};
+
+		void output_image_barrier(VkImageMemoryBarrier2 const&) const;
+		bool allocate_transient_images();
+		void compute_barriers();
+		bool create_transient_images(datastructures::vector<physical_image>&);
+		void cull_passes();
+		void destroy_transient_images();
+
+		VkDevice m_device;
+		VolkDeviceTable const& m_device_functions;
+		memory_allocator& m_allocator;
+
+		datastructures::vector<resource_data> m_resources;
+		datastructures::vector<resource_use> m_uses;
+		std::vector<pass_data> m_passes;
+		datastructures::vector<VkImageMemoryBarrier2> m_image_barriers;
+		datastructures::vector<VkImageMemoryBarrier2> m_final_barriers;
+
+		datastructures::vector<physical_image> m_physical_images;
+		datastructures::vector<memory_allocation> m_slots;
+
+		uint32_t m_culled_pass_count = 0;
+		uint32_t m_barrier_count = 0;
+		VkDeviceSize m_transient_memory_size = 0;
+	};
+}
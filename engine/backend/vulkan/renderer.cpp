@@ -12,10 +12,13 @@
 #include "io/file.h"
 #include "math/math.h"
 
+#include <algorithm>
+#include <cmath>
 #include <format>
 #include <map>
 #include <iostream>
 #include <set>
+#include <utility>
 
 #define VOLK_IMPLEMENTATION
 #include <volk/volk.h>
@@ -24,7 +27,9 @@ using namespace engine;
 
 using datastructures::fixed_vector;
 using datastructures::vector;
+using io::file_exists;
 using io::read_entire_file;
+using io::write_entire_file;
 using math::clamp;
 
 struct swapchain_support_details
@@ -35,22 +40,145 @@ struct swapchain_support_details
 };
 
 fixed_vector<char const*> REQUIRED_DEVICE_EXTENSION_NAMES{ VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+// VK_EXT_swapchain_maintenance1 needs these on the instance, which enables them whenever it has them.
+fixed_vector<char const*> SURFACE_MAINTENANCE_EXTENSION_NAMES{ VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME,
+															   VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME };
+
+char const* PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+char const* CULLING_SHADER = "shaders/cull.comp.spv";
+
+// Every device supports it as a depth attachment, or X8_D24, which would need a fallback.
+constexpr VkFormat DEPTH_FORMAT = VK_FORMAT_D32_SFLOAT;
+
+constexpr uint32_t CULLING_DESCRIPTOR_SETS_PER_POOL = 64;
+// Fewer batches than this aren't worth a secondary command buffer of their own.
+constexpr uint32_t SCENE_BATCHES_PER_TASK = 16;
+
+constexpr VkVertexInputBindingDescription MESH_VERTEX_BINDINGS[]{
+	{ 0, sizeof(mesh_vertex), VK_VERTEX_INPUT_RATE_VERTEX },
+	{ 1, sizeof(mesh_instance), VK_VERTEX_INPUT_RATE_INSTANCE }
+};
+
+// Matches the push constants in mesh.vert.glsl and mesh.frag.glsl, whose reflected range ends at the material buffer.
+struct mesh_constants
+{
+	math::mat4 view_projection;
+	uint32_t material_buffer;
+};
+
+static_assert(sizeof(mesh_constants) == 68);
+
+// Follows mesh_constants in the push constants of mesh_culled.vert.glsl, pushed for every batch of GPU driven draws.
+struct culled_mesh_constants
+{
+	uint32_t instance_buffer;
+	uint32_t visible_instance_buffer;
+	uint32_t first_visible_instance;
+};
+
+static_assert(sizeof(culled_mesh_constants) == 12);
+
+// Matches frame_constants in cull.comp.glsl, the uniform buffer that every batch's dispatch reads.
+struct culling_frame_constants
+{
+	float frustum_planes[6][4];
+	uint32_t draw_command_index;
+};
+
+static_assert(sizeof(culling_frame_constants) == 100);
+
+// Matches the push constants in cull.comp.glsl, which change with every batch.
+struct culling_constants
+{
+	float bounding_sphere[4];
+	uint32_t instance_count;
+	uint32_t first_visible_instance;
+};
+
+static_assert(sizeof(culling_constants) == 24);
+
+// A mat4 attribute takes up four consecutive locations, one per column. The per vertex attributes come first, they're
+// all that vertex_layout::mesh_vertices uses.
+constexpr VkVertexInputAttributeDescription MESH_VERTEX_ATTRIBUTES[]{
+	{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(mesh_vertex, position) },
+	{ 1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(mesh_vertex, normal) },
+	{ 2, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(mesh_vertex, uv) },
+	{ 3, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(mesh_instance, transform) },
+	{ 4, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(mesh_instance, transform) + 4 * sizeof(float) },
+	{ 5, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(mesh_instance, transform) + 8 * sizeof(float) },
+	{ 6, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(mesh_instance, transform) + 12 * sizeof(float) },
+	{ 7, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(mesh_instance, color) },
+	{ 8, 1, VK_FORMAT_R32_UINT, offsetof(mesh_instance, material) }
+};
+
+constexpr uint32_t PER_VERTEX_ATTRIBUTE_COUNT = 3;
 
 bool check_device_extension_support(VkPhysicalDevice, fixed_vector<char const*> const& extensionNames);
 bool check_extension_support(fixed_vector<char const*>& extensionNames);
+bool check_instance_extension_support(fixed_vector<char const*> const& extensionNames);
 bool check_layer_support(fixed_vector<char const*>& layerNames);
+bool check_pipeline_cache_compatibility(fixed_vector<char> const& data, VkPhysicalDeviceProperties const&);
+bool check_vertex_inputs(vertex_layout, shader_reflection const& vertex_shader);
+uint32_t specialization_constant_size(shader_reflection const&, uint32_t id);
+void extract_frustum_planes(math::mat4 const& view_projection, float (&planes)[6][4]);
 VkExtent2D choose_surface_extent(VkSurfaceCapabilitiesKHR const&, uint32_t ideal_width, uint32_t ideal_height);
 VkPresentModeKHR choose_present_mode(vector<VkPresentModeKHR> const&);
 VkSurfaceFormatKHR choose_surface_format(vector<VkSurfaceFormatKHR> const&);
-VkInstance create_instance(renderer_vulkan::debug_output);
+VkInstance create_instance(renderer_vulkan::debug_output, bool headless);
 VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(VkDebugUtilsMessageSeverityFlagBitsEXT, VkDebugUtilsMessageTypeFlagsEXT, VkDebugUtilsMessengerCallbackDataEXT const*, void* userData);
-fixed_vector<char const*> get_required_extension_names(renderer_vulkan::debug_output);
+fixed_vector<char const*> get_required_extension_names(renderer_vulkan::debug_output, bool headless);
 swapchain_support_details get_swapchain_support_details(VkPhysicalDevice, VkSurfaceKHR);
 void output_vulkan_details();
 void output_vulkan_device_details(VkInstance);
+bool reflect_shader_file(char const* path, shader_reflection&);
+
+std::unique_ptr<renderer_vulkan> renderer_vulkan::create_with_window(window const& window, debug_output debugOutput /* = debug_output::enabled */,
+																	uint32_t frames_in_flight /* = DEFAULT_FRAMES_IN_FLIGHT */,
+																	render_path path /* = render_path::dynamic_rendering */)
+{
+	auto renderer = create_with_instance(debugOutput, frames_in_flight, false);
+	if (renderer == nullptr)
+		return nullptr;
+
+	// The surface decides which devices can present, so it has to exist before one is picked.
+	renderer->m_window = &window;
+	if (!renderer->create_window_surface(window))
+		return nullptr;
+
+	if (!renderer->initialize(debugOutput, path, [&] { return renderer->create_swapchain(window); }))
+		return nullptr;
+
+	return renderer;
+}
+
+std::unique_ptr<renderer_vulkan> renderer_vulkan::create_headless(uint32_t width, uint32_t height, debug_output debugOutput /* = debug_output::enabled */,
+																 uint32_t frames_in_flight /* = DEFAULT_FRAMES_IN_FLIGHT */,
+																 render_path path /* = render_path::dynamic_rendering */)
+{
+	if (width == 0 || height == 0)
+	{
+		std::cerr << std::format("Invalid headless render size {}x{}", width, height) << std::endl;
+		return nullptr;
+	}
+
+	auto renderer = create_with_instance(debugOutput, frames_in_flight, true);
+	if (renderer == nullptr)
+		return nullptr;
+
+	if (!renderer->initialize(debugOutput, path, [&] { return renderer->create_offscreen_images(width, height); }))
+		return nullptr;
+
+	return renderer;
+}
 
-std::unique_ptr<renderer_vulkan> renderer_vulkan::create_with_window(window const& window, debug_output debugOutput /* = debug_output::enabled */)
+std::unique_ptr<renderer_vulkan> renderer_vulkan::create_with_instance(debug_output debugOutput, uint32_t frames_in_flight, bool headless)
 {
+	if (frames_in_flight == 0)
+	{
+		std::cerr << "At least one frame in flight is required" << std::endl;
+		return nullptr;
+	}
+
 	if (volkInitialize() != VK_SUCCESS)
 	{
 		std::cerr << "Failed to initialize Volk" << std::endl;
@@ -61,11 +189,11 @@ std::unique_ptr<renderer_vulkan> renderer_vulkan::create_with_window(window cons
 	if (debugOutputEnabled)
 		output_vulkan_details();
 
-	auto instance = create_instance(debugOutput);
+	auto instance = create_instance(debugOutput, headless);
 	if (instance == nullptr)
 		return nullptr;
 
-	auto renderer = std::make_unique<renderer_vulkan>(instance);
+	auto renderer = std::make_unique<renderer_vulkan>(instance, frames_in_flight);
 
 	if (debugOutputEnabled)
 	{
@@ -74,49 +202,103 @@ std::unique_ptr<renderer_vulkan> renderer_vulkan::create_with_window(window cons
 		output_vulkan_device_details(instance);
 	}
 
-	if (!renderer->create_window_surface(window))
-		return nullptr;
+	return renderer;
+}
 
-	if (!renderer->create_logical_device(debugOutput))
-		return nullptr;
+// Everything after the device depends on the images that are rendered to, but only their creation differs between
+// rendering to a window and headless.
+bool renderer_vulkan::initialize(debug_output debugOutput, render_path path, std::function<bool()> const& create_render_targets)
+{
+	m_render_path = path;
 
-	if (!renderer->create_swapchain(window))
-		return nullptr;
+	if (!create_logical_device(debugOutput))
+		return false;
 
-	if (!renderer->create_render_pass())
-		return nullptr;
+	if (!create_pipeline_cache())
+		return false;
 
-	if (!renderer->create_graphics_pipeline())
-		return nullptr;
+	if (!create_render_targets())
+		return false;
 
-	if (!renderer->create_framebuffers())
-		return nullptr;
+	if (!create_render_pass())
+		return false;
 
-	if (!renderer->create_command_pool())
-		return nullptr;
+	if (!create_bindless_heap())
+		return false;
 
-	if (!renderer->create_command_buffer())
-		return nullptr;
+	if (!create_pipeline_layout())
+		return false;
 
-	if (!renderer->create_synchronization_objects())
-		return nullptr;
+	if (!create_graphics_pipeline())
+		return false;
 
-	return renderer;
+	if (!create_culling_pipeline())
+		return false;
+
+	if (!create_depth_image())
+		return false;
+
+	if (!create_framebuffers())
+		return false;
+
+	if (!create_command_pool())
+		return false;
+
+	if (!create_command_buffers())
+		return false;
+
+	if (!create_command_recorder())
+		return false;
+
+	if (!create_synchronization_objects())
+		return false;
+
+	create_deletion_queue();
+
+	if (!create_upload_manager())
+		return false;
+
+	if (!create_frame_descriptor_allocator())
+		return false;
+
+	if (!create_frame_linear_allocator())
+		return false;
+
+	create_render_graphs();
+	create_gpu_profiler();
+	return create_pipeline_statistics_query();
 }
 
 renderer_vulkan::~renderer_vulkan()
 {
-	m_device_functions.vkDeviceWaitIdle(m_device);
+	if (m_device != VK_NULL_HANDLE)
+		m_device_functions.vkDeviceWaitIdle(m_device);
 
-	if (m_in_flight_fence != VK_NULL_HANDLE)
-		m_device_functions.vkDestroyFence(m_device, m_in_flight_fence, nullptr);
+	m_deletion_queue.reset();
+
+	for (auto& render_finished_semaphore : m_render_finished_semaphores)
+	{
+		if (render_finished_semaphore != VK_NULL_HANDLE)
+			m_device_functions.vkDestroySemaphore(m_device, render_finished_semaphore, nullptr);
+	}
 
-	if (m_render_finished_semaphore != VK_NULL_HANDLE)
-		m_device_functions.vkDestroySemaphore(m_device, m_render_finished_semaphore, nullptr);
+	for (size_t i = 0; i < m_frames.size(); ++i)
+	{
+		auto& frame = m_frames[i];
+		if (frame.image_available_semaphore != VK_NULL_HANDLE)
+			m_device_functions.vkDestroySemaphore(m_device, frame.image_available_semaphore, nullptr);
+		if (frame.present_fence != VK_NULL_HANDLE)
+		{
+			if (frame.present_pending)
+				m_device_functions.vkWaitForFences(m_device, 1, &frame.present_fence, VK_TRUE, UINT64_MAX);
+			m_device_functions.vkDestroyFence(m_device, frame.present_fence, nullptr);
+		}
+	}
 
-	if (m_image_available_semaphore != VK_NULL_HANDLE)
-		m_device_functions.vkDestroySemaphore(m_device, m_image_available_semaphore, nullptr);
+	if (m_frame_timeline != VK_NULL_HANDLE)
+		m_device_functions.vkDestroySemaphore(m_device, m_frame_timeline, nullptr);
 
+	m_command_recorder.reset();
 	if (m_command_pool != VK_NULL_HANDLE)
 		m_device_functions.vkDestroyCommandPool(m_device, m_command_pool, nullptr);
 
@@ -126,15 +308,31 @@ renderer_vulkan::~renderer_vulkan()
 			m_device_functions.vkDestroyFramebuffer(m_device, swapchain_framebuffer, nullptr);
 	}
 
-	if (m_graphics_pipeline != VK_NULL_HANDLE)
-		m_device_functions.vkDestroyPipeline(m_device, m_graphics_pipeline, nullptr);
+	destroy_graphics_pipelines();
+
+	for (auto& culling_descriptor_pool : m_culling_descriptor_pools)
+		m_device_functions.vkDestroyDescriptorPool(m_device, culling_descriptor_pool, nullptr);
 
-	if (m_pipeline_layout != VK_NULL_HANDLE)
-		m_device_functions.vkDestroyPipelineLayout(m_device, m_pipeline_layout, nullptr);
+	if (m_culling_pipeline != VK_NULL_HANDLE)
+		m_device_functions.vkDestroyPipeline(m_device, m_culling_pipeline, nullptr);
+
+	m_pipeline_layouts.reset();
 
 	if (m_render_pass != VK_NULL_HANDLE)
 		m_device_functions.vkDestroyRenderPass(m_device, m_render_pass, nullptr);
 
+	if (m_depth_image_view != VK_NULL_HANDLE)
+		m_device_functions.vkDestroyImageView(m_device, m_depth_image_view, nullptr);
+
+	if (m_memory_allocator != nullptr)
+		m_memory_allocator->destroy_image(m_depth_image, m_depth_allocation);
+
+	if (m_pipeline_cache != VK_NULL_HANDLE)
+	{
+		save_pipeline_cache();
+		m_device_functions.vkDestroyPipelineCache(m_device, m_pipeline_cache, nullptr);
+	}
+
 	for (auto& swapchain_image_view : m_swapchain_image_views)
 	{
 		if (swapchain_image_view != VK_NULL_HANDLE)
@@ -143,6 +341,46 @@ renderer_vulkan::~renderer_vulkan()
 
 	if (m_swapchain != VK_NULL_HANDLE)
 		m_device_functions.vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
+	else
+	{
+		for (size_t i = 0; i < m_swapchain_images.size(); ++i)
+			m_memory_allocator->destroy_image(m_swapchain_images[i], m_offscreen_image_allocations[i]);
+	}
+
+	for (auto& instance_batch : m_instance_batches)
+	{
+		m_memory_allocator->destroy_buffer(instance_batch.instance_buffer, instance_batch.instance_allocation);
+		m_memory_allocator->destroy_buffer(instance_batch.draw_command_buffer, instance_batch.draw_command_allocation);
+		m_memory_allocator->destroy_buffer(instance_batch.visible_instance_buffer, instance_batch.visible_instance_allocation);
+	}
+
+	for (auto& mesh : m_meshes)
+	{
+		m_memory_allocator->destroy_buffer(mesh.vertex_buffer, mesh.vertex_allocation);
+		m_memory_allocator->destroy_buffer(mesh.index_buffer, mesh.index_allocation);
+	}
+
+	for (auto& texture : m_textures)
+	{
+		m_device_functions.vkDestroyImageView(m_device, texture.view, nullptr);
+		m_memory_allocator->destroy_image(texture.image, texture.allocation);
+	}
+
+	if (m_memory_allocator != nullptr)
+		m_memory_allocator->destroy_buffer(m_material_buffer, m_material_allocation);
+
+	if (m_default_sampler != VK_NULL_HANDLE)
+		m_device_functions.vkDestroySampler(m_device, m_default_sampler, nullptr);
+
+	m_bindless_heap.reset();
+	m_frame_descriptor_allocator.reset();
+	m_frame_linear_allocator.reset();
+	m_render_graphs.clear();
+	m_gpu_profiler.reset();
+	m_pipeline_statistics_query.reset();
+	m_shader_reloader.reset();
+	m_upload_manager.reset();
+	m_memory_allocator.reset();
 
 	if (m_device != VK_NULL_HANDLE)
 		m_device_functions.vkDestroyDevice(m_device, nullptr);
@@ -159,157 +397,1077 @@ renderer_vulkan::~renderer_vulkan()
 
 void renderer_vulkan::render()
 {
-	m_device_functions.vkWaitForFences(m_device, 1, &m_in_flight_fence, VK_TRUE, UINT64_MAX);
-	m_device_functions.vkResetFences(m_device, 1, &m_in_flight_fence);
+	if (!is_headless())
+	{
+		// A minimized window has nothing to present to, and a zero sized swapchain cannot be created.
+		if (m_window->width() == 0 || m_window->height() == 0)
+			return;
+
+		// Not every platform reports VK_ERROR_OUT_OF_DATE_KHR on resize, so don't rely on it alone.
+		if ((m_window->width() != m_window_extent.width || m_window->height() != m_window_extent.height) &&
+			!recreate_swapchain())
+			return;
+	}
 
-	uint32_t image_index;
-	m_device_functions.vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, m_image_available_semaphore,
-											 VK_NULL_HANDLE, &image_index);
+	if (m_shader_reloader != nullptr)
+		reload_changed_shaders();
 
-	m_device_functions.vkResetCommandBuffer(m_command_buffer, 0);
-	if (!record_command_buffer(m_command_buffer, image_index))
-		return;
+	auto& frame = m_frames[m_current_frame];
+
+	// Only wait for the GPU to finish the frame that last used these resources, so recording this frame overlaps
+	// with the execution of the (frames in flight - 1) frames submitted before it.
+	wait_for_frame_timeline(frame.timeline_value);
+	m_frame_descriptor_allocator->begin_frame(m_current_frame);
+	m_frame_linear_allocator->begin_frame(m_current_frame);
+	m_deletion_queue->collect();
+	m_memory_allocator->update_budget();
+
+	uint32_t image_index = m_current_frame;
+	if (!is_headless())
+	{
+		auto result = m_device_functions.vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, frame.image_available_semaphore,
+															   VK_NULL_HANDLE, &image_index);
+		if (result == VK_ERROR_OUT_OF_DATE_KHR)
+		{
+			recreate_swapchain();
+			return;
+		}
+
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+		{
+			std::cerr << std::format("Failed to acquire swapchain image: {}", result) << std::endl;
+			return;
+		}
+	}
+
+	// After a successful acquire, image_available_semaphore is signaled and has to be waited on before it can be
+	// acquired with again, and the image has to be presented before the swapchain runs out of images to acquire.
+	// So when recording fails, the frame is still submitted with just the image's transition to presentation.
+	m_device_functions.vkResetCommandBuffer(frame.command_buffer, 0);
+	bool recorded = record_command_buffer(frame.command_buffer, image_index);
+	bool presentable = recorded;
+	if (!recorded)
+	{
+		if (m_gpu_profiler != nullptr)
+			m_gpu_profiler->discard_frame();
+		if (m_pipeline_statistics_query != nullptr)
+			m_pipeline_statistics_query->discard_frame();
+
+		if (is_headless())
+			return;
+
+		m_device_functions.vkResetCommandBuffer(frame.command_buffer, 0);
+		presentable = record_present_transition(frame.command_buffer, image_index);
+	}
+
+	// Binary semaphores ignore their value. Only uploads that have already finished are used by the frame, so the
+	// wait on the upload timeline orders their writes without ever waiting for transfers in flight.
+	VkSemaphore wait_semaphores[2];
+	VkPipelineStageFlags wait_stages[2];
+	uint64_t wait_values[2];
+	uint32_t wait_count = 0;
+	if (!is_headless())
+	{
+		wait_semaphores[wait_count] = frame.image_available_semaphore;
+		wait_stages[wait_count] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		wait_values[wait_count++] = 0;
+	}
+
+	if (m_upload_manager->wait_value() > 0)
+	{
+		wait_semaphores[wait_count] = m_upload_manager->timeline();
+		wait_stages[wait_count] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		wait_values[wait_count++] = m_upload_manager->wait_value();
+	}
 
-	VkPipelineStageFlags wait_stages[]{ VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	uint64_t timeline_value = m_frame_timeline_value + 1;
+	VkSemaphore signal_semaphores[2]{ m_frame_timeline };
+	uint64_t signal_values[2]{ timeline_value, 0 };
+	uint32_t signal_count = 1;
+	if (!is_headless() && presentable)
+		signal_semaphores[signal_count++] = m_render_finished_semaphores[image_index];
+
+	VkTimelineSemaphoreSubmitInfo timeline_submit_info{};
+	timeline_submit_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timeline_submit_info.pWaitSemaphoreValues = wait_values;
+	timeline_submit_info.waitSemaphoreValueCount = wait_count;
+	timeline_submit_info.pSignalSemaphoreValues = signal_values;
+	timeline_submit_info.signalSemaphoreValueCount = signal_count;
 
 	VkSubmitInfo submit_info{};
 	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pNext = &timeline_submit_info;
+	submit_info.pCommandBuffers = &frame.command_buffer;
+	submit_info.commandBufferCount = presentable ? 1 : 0;
 	submit_info.pWaitDstStageMask = wait_stages;
-	submit_info.pWaitSemaphores = &m_image_available_semaphore;
-	submit_info.waitSemaphoreCount = 1;
-	submit_info.pCommandBuffers = &m_command_buffer;
-	submit_info.commandBufferCount = 1;
-	submit_info.pSignalSemaphores = &m_render_finished_semaphore;
-	submit_info.signalSemaphoreCount = 1;
+	submit_info.pWaitSemaphores = wait_semaphores;
+	submit_info.waitSemaphoreCount = wait_count;
+	submit_info.pSignalSemaphores = signal_semaphores;
+	submit_info.signalSemaphoreCount = signal_count;
 
-	auto result = m_device_functions.vkQueueSubmit(m_queues.graphics, 1, &submit_info, m_in_flight_fence);
+	// Nothing to undo when this fails, the frame keeps the value of its previous submission.
+	auto result = m_device_functions.vkQueueSubmit(m_queues.graphics, 1, &submit_info, VK_NULL_HANDLE);
 	if (result != VK_SUCCESS)
 	{
 		std::cerr << std::format("Failed to submit queue: {}", result) << std::endl;
 		return;
 	}
 
+	// Every submission signals the timeline, so the next acquire on this frame waits until the semaphore wait is
+	// done. An image that can't even be transitioned is never presented, retiring its swapchain releases it.
+	frame.timeline_value = m_frame_timeline_value = timeline_value;
+	if (recorded)
+		m_upload_manager->commit_pending_barriers();
+
+	if (!presentable)
+	{
+		recreate_swapchain();
+		return;
+	}
+
+	m_last_rendered_frame = m_current_frame;
+	m_current_frame = (m_current_frame + 1) % (uint32_t)m_frames.size();
+
+	if (is_headless())
+		return;
+
 	VkPresentInfoKHR present_info{};
 	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	present_info.pWaitSemaphores = &m_render_finished_semaphore;
+	present_info.pWaitSemaphores = &m_render_finished_semaphores[image_index];
 	present_info.waitSemaphoreCount = 1;
 	present_info.pSwapchains = &m_swapchain;
 	present_info.swapchainCount = 1;
 	present_info.pImageIndices = &image_index;
 
-	result = m_device_functions.vkQueuePresentKHR(m_queues.present, &present_info);
-	if (result != VK_SUCCESS)
+	// The fence's previous present was queued frames in flight presents ago, so this rarely waits.
+	VkSwapchainPresentFenceInfoEXT present_fence_info{};
+	if (m_present_fences_supported)
 	{
-		std::cerr << std::format("Failed to present queue: {}", result) << std::endl;
-		return;
+		if (frame.present_pending)
+		{
+			m_device_functions.vkWaitForFences(m_device, 1, &frame.present_fence, VK_TRUE, UINT64_MAX);
+			m_device_functions.vkResetFences(m_device, 1, &frame.present_fence);
+		}
+
+		present_fence_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT;
+		present_fence_info.pFences = &frame.present_fence;
+		present_fence_info.swapchainCount = 1;
+		present_info.pNext = &present_fence_info;
 	}
+
+	// An out of date swapchain still queues the present's semaphore wait, and with it the fence.
+	result = m_device_functions.vkQueuePresentKHR(m_queues.present, &present_info);
+	frame.present_pending = m_present_fences_supported &&
+							(result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+		recreate_swapchain();
+	else if (result != VK_SUCCESS)
+		std::cerr << std::format("Failed to present queue: {}", result) << std::endl;
 }
 
-bool renderer_vulkan::create_command_buffer()
+datastructures::optional<mesh_handle> renderer_vulkan::create_mesh(mesh_vertex const* vertices, uint32_t vertex_count, uint32_t const* indices,
+																   uint32_t index_count)
 {
-	VkCommandBufferAllocateInfo allocate_info{};
-	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocate_info.commandPool = m_command_pool;
-	allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocate_info.commandBufferCount = 1;
+	datastructures::optional<mesh_handle> handle;
 
-	auto result = m_device_functions.vkAllocateCommandBuffers(m_device, &allocate_info, &m_command_buffer);
-	if (result != VK_SUCCESS)
+	mesh new_mesh;
+	new_mesh.index_count = index_count;
+
+	// The sphere around the bounding box is not the tightest fit, but good enough for culling.
+	if (vertex_count > 0)
 	{
-		std::cerr << std::format("Failed to allocate command buffer: {}", result) << std::endl;
-		return false;
+		auto min = vertices[0].position;
+		auto max = vertices[0].position;
+		for (uint32_t i = 1; i < vertex_count; ++i)
+		{
+			auto const& position = vertices[i].position;
+			min = { std::min(min.x, position.x), std::min(min.y, position.y), std::min(min.z, position.z) };
+			max = { std::max(max.x, position.x), std::max(max.y, position.y), std::max(max.z, position.z) };
+		}
+
+		new_mesh.bounds_center = (min + max) * 0.5f;
+		auto extent = (max - min) * 0.5f;
+		new_mesh.bounds_radius = std::sqrt(math::dot(extent, extent));
+	}
+	auto vertex_upload = create_device_local_buffer(vertices, sizeof(mesh_vertex) * vertex_count, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+													new_mesh.vertex_buffer, new_mesh.vertex_allocation);
+	if (vertex_upload == 0)
+		return handle;
+
+	auto index_upload = create_device_local_buffer(indices, sizeof(uint32_t) * index_count, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+												   new_mesh.index_buffer, new_mesh.index_allocation);
+	if (index_upload == 0)
+	{
+		m_memory_allocator->destroy_buffer(new_mesh.vertex_buffer, new_mesh.vertex_allocation);
+		return handle;
 	}
 
-	return true;
+	new_mesh.upload = std::max(vertex_upload, index_upload);
+	m_meshes.push_back(new_mesh);
+	handle = (mesh_handle)(m_meshes.size() - 1);
+	return handle;
 }
 
-bool renderer_vulkan::create_command_pool()
+bool renderer_vulkan::add_instances(mesh_handle mesh, mesh_instance const* instances, uint32_t instance_count)
 {
-	auto queue_family_indices = find_queue_families(m_physical_device);
+	if (mesh >= m_meshes.size())
+	{
+		std::cerr << std::format("Failed to add instances of unknown mesh {}", mesh) << std::endl;
+		return false;
+	}
 
-	VkCommandPoolCreateInfo create_info{};
-	create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-	create_info.queueFamilyIndex = queue_family_indices.graphics.value();
+	// Tickets complete in order, so waiting for the newest texture upload covers all of them.
+	upload_manager::ticket texture_upload = 0;
+	for (uint32_t i = 0; i < instance_count; ++i)
+	{
+		auto material = instances[i].material;
+		if (material == 0)
+			continue;
 
-	auto result = m_device_functions.vkCreateCommandPool(m_device, &create_info, nullptr, &m_command_pool);
-	if (result != VK_SUCCESS)
+		if (material >= m_material_uploads.size())
+		{
+			std::cerr << std::format("Failed to add instances with unknown material {}", material) << std::endl;
+			return false;
+		}
+
+		texture_upload = std::max(texture_upload, m_material_uploads[material]);
+	}
+
+	mesh_instance_batch batch;
+	batch.mesh = mesh;
+	batch.instance_count = instance_count;
+	batch.upload = create_device_local_buffer(instances, sizeof(mesh_instance) * instance_count,
+											  VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+											  batch.instance_buffer, batch.instance_allocation);
+	if (batch.upload == 0)
+		return false;
+
+	batch.upload = std::max(batch.upload, texture_upload);
+
+	if (m_culling_pipeline != VK_NULL_HANDLE && !create_culling_resources(batch))
 	{
-		std::cerr << std::format("Failed to create command pool: {}", result) << std::endl;
+		m_memory_allocator->destroy_buffer(batch.instance_buffer, batch.instance_allocation);
+		m_memory_allocator->destroy_buffer(batch.draw_command_buffer, batch.draw_command_allocation);
+		m_memory_allocator->destroy_buffer(batch.visible_instance_buffer, batch.visible_instance_allocation);
 		return false;
 	}
 
+	m_instance_batches.push_back(batch);
 	return true;
 }
 
-void renderer_vulkan::create_debug_messenger()
+datastructures::optional<texture_handle> renderer_vulkan::create_texture(uint32_t width, uint32_t height, void const* rgba8_pixels)
 {
-	VkDebugUtilsMessengerCreateInfoEXT debugUtilsMessengerCreateInfo{};
-	debugUtilsMessengerCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-	debugUtilsMessengerCreateInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
-													VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-	debugUtilsMessengerCreateInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT |
-												VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT;
-	debugUtilsMessengerCreateInfo.pfnUserCallback = debug_callback;
+	datastructures::optional<texture_handle> handle;
 
-	vkCreateDebugUtilsMessengerEXT(m_instance, &debugUtilsMessengerCreateInfo, nullptr, &m_debugMessenger);
+	if (m_bindless_heap == nullptr)
+	{
+		std::cerr << "Failed to create texture, the device does not support bindless descriptors" << std::endl;
+		return handle;
+	}
+
+	VkImageCreateInfo image_create_info{};
+	image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_create_info.imageType = VK_IMAGE_TYPE_2D;
+	image_create_info.format = VK_FORMAT_R8G8B8A8_SRGB;
+	image_create_info.extent = { width, height, 1 };
+	image_create_info.mipLevels = 1;
+	image_create_info.arrayLayers = 1;
+	image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_create_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	texture new_texture;
+	if (!m_memory_allocator->create_image(image_create_info, memory_usage::gpu_only, new_texture.image, new_texture.allocation))
+		return handle;
+
+	VkImageViewCreateInfo view_create_info{};
+	view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view_create_info.image = new_texture.image;
+	view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	view_create_info.format = image_create_info.format;
+	view_create_info.components = { VK_COMPONENT_SWIZZLE_IDENTITY };
+	view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	view_create_info.subresourceRange.levelCount = 1;
+	view_create_info.subresourceRange.layerCount = 1;
+
+	auto result = m_device_functions.vkCreateImageView(m_device, &view_create_info, nullptr, &new_texture.view);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to create texture image view: {}", result) << std::endl;
+		m_memory_allocator->destroy_image(new_texture.image, new_texture.allocation);
+		return handle;
+	}
+
+	new_texture.upload = m_upload_manager->upload_image(new_texture.image, image_create_info.extent, rgba8_pixels,
+														(VkDeviceSize)width * height * 4);
+	// The descriptor can be written right away, no draw samples the texture before its upload is complete.
+	if (new_texture.upload != 0)
+		new_texture.bindless_index = m_bindless_heap->add_texture(new_texture.view, m_default_sampler);
+
+	if (new_texture.upload == 0 || new_texture.bindless_index == bindless_heap::INVALID_INDEX)
+	{
+		// A failed upload was never submitted and a successful one has to finish before the image goes away.
+		if (new_texture.upload != 0)
+			wait_idle();
+
+		m_device_functions.vkDestroyImageView(m_device, new_texture.view, nullptr);
+		m_memory_allocator->destroy_image(new_texture.image, new_texture.allocation);
+		return handle;
+	}
+
+	m_textures.push_back(new_texture);
+	handle = (texture_handle)(m_textures.size() - 1);
+	return handle;
 }
 
-bool renderer_vulkan::create_framebuffers()
+datastructures::optional<material_handle> renderer_vulkan::create_material(material_description const& description)
 {
-	m_swapchain_framebuffers.resize(m_swapchain_image_views.size());
-	VkFramebufferCreateInfo create_info{};
-	create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	create_info.renderPass = m_render_pass;
-	create_info.attachmentCount = 1;
-	create_info.width = m_swapchain_extent.width;
-	create_info.height = m_swapchain_extent.height;
-	create_info.layers = 1;
-	for (size_t i = 0; i < m_swapchain_image_views.size(); ++i)
+	datastructures::optional<material_handle> handle;
+
+	if (m_bindless_heap == nullptr)
+	{
+		std::cerr << "Failed to create material, the device does not support bindless descriptors" << std::endl;
+		return handle;
+	}
+
+	if (m_material_uploads.size() >= MAX_MATERIALS)
 	{
-		create_info.pAttachments = &m_swapchain_image_views[i];
+		std::cerr << std::format("Failed to create material, all {} materials are in use", MAX_MATERIALS) << std::endl;
+		return handle;
+	}
 
-		auto result = m_device_functions.vkCreateFramebuffer(m_device, &create_info, nullptr,
-															 &m_swapchain_framebuffers[i]);
-		if (result != VK_SUCCESS)
+	gpu_material material{};
+	std::copy(std::begin(description.base_color), std::end(description.base_color), material.base_color);
+	material.base_color_texture = bindless_heap::INVALID_INDEX;
+
+	upload_manager::ticket texture_upload = 0;
+	if (description.base_color_texture != NO_TEXTURE)
+	{
+		if (description.base_color_texture >= m_textures.size())
 		{
-			std::cerr << std::format("Failed to create framebuffer: {}", result) << std::endl;
-			return false;
+			std::cerr << std::format("Failed to create material with unknown texture {}", description.base_color_texture) << std::endl;
+			return handle;
 		}
+
+		auto const& base_color_texture = m_textures[description.base_color_texture];
+		material.base_color_texture = base_color_texture.bindless_index;
+		texture_upload = base_color_texture.upload;
 	}
 
-	return true;
+	// Materials are never changed after creation, so no frame in flight can be reading this one yet.
+	auto* materials = static_cast<gpu_material*>(m_material_allocation.mapped);
+	materials[m_material_uploads.size()] = material;
+
+	m_material_uploads.push_back(texture_upload);
+	handle = (material_handle)(m_material_uploads.size() - 1);
+	return handle;
 }
 
-bool renderer_vulkan::create_graphics_pipeline()
+VkPipeline renderer_vulkan::get_graphics_pipeline(graphics_pipeline_description const& description)
 {
-	auto vertex_shader_code = read_entire_file("shaders/triangle.vert.spv", io::file_mode::binary);
-	if (vertex_shader_code.empty())
-		return false;
+	auto it = m_graphics_pipelines.find(description);
+	if (it != m_graphics_pipelines.end())
+		return it->second.pipeline;
 
-	auto fragment_shader_code = read_entire_file("shaders/triangle.frag.spv", io::file_mode::binary);
-	if (fragment_shader_code.empty())
-		return false;
+	VkPipelineLayout layout;
+	auto pipeline = compile_graphics_pipeline(description, layout);
+	if (pipeline != VK_NULL_HANDLE)
+		m_graphics_pipelines.emplace(description, compiled_graphics_pipeline{ pipeline, layout });
 
-	VkShaderModule vertex_shader = create_shader_module(vertex_shader_code);
-	if (vertex_shader == VK_NULL_HANDLE)
-		return false;
+	return pipeline;
+}
 
-	VkShaderModule fragment_shader = create_shader_module(fragment_shader_code);
-	if (fragment_shader == VK_NULL_HANDLE)
+bool renderer_vulkan::enable_shader_hot_reload()
+{
+	if (m_shader_reloader != nullptr)
+		return true;
+
+	m_shader_reloader = shader_reloader::create(ENGINE_SHADER_SOURCE_DIRECTORY, "shaders", ENGINE_GLSLC_EXECUTABLE);
+	if (m_shader_reloader == nullptr)
+	{
+		std::cerr << "Shader hot reload is disabled, shaders changed on disk will not be reloaded" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+VkQueue renderer_vulkan::queue(queue_type type) const
+{
+	switch (type)
+	{
+	case queue_type::graphics:
+		return m_queues.graphics;
+	case queue_type::compute:
+		return m_queues.compute;
+	case queue_type::transfer:
+		return m_queues.transfer;
+	}
+
+	return VK_NULL_HANDLE;
+}
+
+uint32_t renderer_vulkan::queue_family(queue_type type) const
+{
+	datastructures::optional<uint32_t> family;
+	switch (type)
+	{
+	case queue_type::graphics:
+		family = m_queue_families.graphics;
+		break;
+	case queue_type::compute:
+		family = m_queue_families.compute;
+		break;
+	case queue_type::transfer:
+		family = m_queue_families.transfer;
+		break;
+	}
+
+	return family.has_value() ? family.value() : VK_QUEUE_FAMILY_IGNORED;
+}
+
+render_graph const* renderer_vulkan::last_render_graph() const
+{
+	if (m_render_path != render_path::dynamic_rendering)
+		return nullptr;
+
+	return m_render_graphs[m_last_rendered_frame].get();
+}
+
+void renderer_vulkan::wait_idle()
+{
+	m_device_functions.vkDeviceWaitIdle(m_device);
+	m_deletion_queue->collect();
+}
+
+fixed_vector<char> renderer_vulkan::read_back_last_frame()
+{
+	if (!is_headless())
+	{
+		std::cerr << "Reading back frames is only supported by headless renderers" << std::endl;
+		return {};
+	}
+
+	// Before the first frame the image has never been rendered to, nor moved to TRANSFER_SRC_OPTIMAL.
+	auto last_frame_value = m_frames[m_last_rendered_frame].timeline_value;
+	if (last_frame_value == 0)
+	{
+		std::cerr << "Failed to read back frame, no frame has been rendered yet" << std::endl;
+		return {};
+	}
+
+	wait_for_frame_timeline(last_frame_value);
+
+	VkDeviceSize size = (VkDeviceSize)m_swapchain_extent.width * m_swapchain_extent.height * 4;
+
+	VkBufferCreateInfo buffer_create_info{};
+	buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_create_info.size = size;
+	buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer;
+	memory_allocation allocation;
+	if (!m_memory_allocator->create_buffer(buffer_create_info, memory_usage::gpu_to_cpu, buffer, allocation))
+		return {};
+
+	VkCommandBufferAllocateInfo command_buffer_allocate_info{};
+	command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	command_buffer_allocate_info.commandPool = m_command_pool;
+	command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	command_buffer_allocate_info.commandBufferCount = 1;
+
+	VkCommandBuffer command_buffer;
+	auto result = m_device_functions.vkAllocateCommandBuffers(m_device, &command_buffer_allocate_info, &command_buffer);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to allocate read back command buffer: {}", result) << std::endl;
+		m_memory_allocator->destroy_buffer(buffer, allocation);
+		return {};
+	}
+
+	VkCommandBufferBeginInfo begin_info{};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	m_device_functions.vkBeginCommandBuffer(command_buffer, &begin_info);
+
+	// The render pass already left the image in TRANSFER_SRC_OPTIMAL, this only orders the copy after the writes.
+	VkImageMemoryBarrier image_barrier{};
+	image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	image_barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	image_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	image_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	image_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	image_barrier.image = m_swapchain_images[m_last_rendered_frame];
+	image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	image_barrier.subresourceRange.levelCount = 1;
+	image_barrier.subresourceRange.layerCount = 1;
+	m_device_functions.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+											0, 0, nullptr, 0, nullptr, 1, &image_barrier);
+
+	VkBufferImageCopy region{};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = { m_swapchain_extent.width, m_swapchain_extent.height, 1 };
+	m_device_functions.vkCmdCopyImageToBuffer(command_buffer, m_swapchain_images[m_last_rendered_frame],
+											  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
+
+	VkBufferMemoryBarrier buffer_barrier{};
+	buffer_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	buffer_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	buffer_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	buffer_barrier.buffer = buffer;
+	buffer_barrier.size = VK_WHOLE_SIZE;
+	m_device_functions.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+											0, 0, nullptr, 1, &buffer_barrier, 0, nullptr);
+
+	m_device_functions.vkEndCommandBuffer(command_buffer);
+
+	VkSubmitInfo submit_info{};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.pCommandBuffers = &command_buffer;
+	submit_info.commandBufferCount = 1;
+
+	fixed_vector<char> pixels(size);
+	bool succeeded = false;
+	result = m_device_functions.vkQueueSubmit(m_queues.graphics, 1, &submit_info, VK_NULL_HANDLE);
+	if (result == VK_SUCCESS)
+	{
+		m_device_functions.vkQueueWaitIdle(m_queues.graphics);
+		std::memcpy(pixels.data(), allocation.mapped, size);
+		succeeded = true;
+	}
+	else
+		std::cerr << std::format("Failed to submit read back: {}", result) << std::endl;
+
+	m_device_functions.vkFreeCommandBuffers(m_device, m_command_pool, 1, &command_buffer);
+	m_memory_allocator->destroy_buffer(buffer, allocation);
+
+	if (!succeeded)
+		return {};
+
+	return pixels;
+}
+
+VkDescriptorSet renderer_vulkan::allocate_culling_descriptor_set()
+{
+	VkDescriptorSetAllocateInfo allocate_info{};
+	allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocate_info.pSetLayouts = &m_culling_descriptor_set_layout;
+	allocate_info.descriptorSetCount = 1;
+
+	VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+	if (!m_culling_descriptor_pools.empty())
+	{
+		allocate_info.descriptorPool = m_culling_descriptor_pools.back();
+		auto result = m_device_functions.vkAllocateDescriptorSets(m_device, &allocate_info, &descriptor_set);
+		if (result == VK_SUCCESS)
+			return descriptor_set;
+
+		if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL)
+		{
+			std::cerr << std::format("Failed to allocate culling descriptor set: {}", result) << std::endl;
+			return VK_NULL_HANDLE;
+		}
+	}
+
+	// Batches are never removed, so full pools are simply kept around and a new one is started.
+	VkDescriptorPoolSize pool_size{};
+	pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	pool_size.descriptorCount = 3 * CULLING_DESCRIPTOR_SETS_PER_POOL;
+
+	VkDescriptorPoolCreateInfo pool_create_info{};
+	pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	pool_create_info.maxSets = CULLING_DESCRIPTOR_SETS_PER_POOL;
+	pool_create_info.pPoolSizes = &pool_size;
+	pool_create_info.poolSizeCount = 1;
+
+	VkDescriptorPool pool;
+	auto result = m_device_functions.vkCreateDescriptorPool(m_device, &pool_create_info, nullptr, &pool);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to create culling descriptor pool: {}", result) << std::endl;
+		return VK_NULL_HANDLE;
+	}
+
+	m_culling_descriptor_pools.push_back(pool);
+
+	allocate_info.descriptorPool = pool;
+	result = m_device_functions.vkAllocateDescriptorSets(m_device, &allocate_info, &descriptor_set);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to allocate culling descriptor set: {}", result) << std::endl;
+		return VK_NULL_HANDLE;
+	}
+
+	return descriptor_set;
+}
+
+bool renderer_vulkan::create_command_buffers()
+{
+	VkCommandBufferAllocateInfo allocate_info{};
+	allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocate_info.commandPool = m_command_pool;
+	allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocate_info.commandBufferCount = (uint32_t)m_frames.size();
+
+	fixed_vector<VkCommandBuffer> command_buffers(m_frames.size());
+	auto result = m_device_functions.vkAllocateCommandBuffers(m_device, &allocate_info, command_buffers.data());
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to allocate command buffers: {}", result) << std::endl;
+		return false;
+	}
+
+	for (size_t i = 0; i < m_frames.size(); ++i)
+		m_frames[i].command_buffer = command_buffers[i];
+
+	return true;
+}
+
+// Frames that record their scene inline have nothing to spread over threads.
+bool renderer_vulkan::create_command_recorder()
+{
+	if (!m_scene_command_reuse)
+		return true;
+
+	m_command_recorder = parallel_command_recorder::create(m_device, m_device_functions, m_queue_families.graphics.value(), (uint32_t)m_frames.size());
+	return m_command_recorder != nullptr;
+}
+
+void renderer_vulkan::destroy_graphics_pipelines()
+{
+	for (auto& [description, compiled] : m_graphics_pipelines)
+		m_device_functions.vkDestroyPipeline(m_device, compiled.pipeline, nullptr);
+
+	m_graphics_pipelines.clear();
+	m_graphics_pipeline = VK_NULL_HANDLE;
+	m_mesh_pipeline = VK_NULL_HANDLE;
+	m_culled_mesh_pipeline = VK_NULL_HANDLE;
+}
+
+bool renderer_vulkan::create_command_pool()
+{
+	VkCommandPoolCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	create_info.queueFamilyIndex = m_queue_families.graphics.value();
+
+	auto result = m_device_functions.vkCreateCommandPool(m_device, &create_info, nullptr, &m_command_pool);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to create command pool: {}", result) << std::endl;
 		return false;
+	}
+
+	return true;
+}
+
+bool renderer_vulkan::create_bindless_heap()
+{
+	if (!m_bindless_supported)
+	{
+		std::cout << "Descriptor indexing is not supported, meshes are drawn without materials" << std::endl;
+		return true;
+	}
+
+	m_bindless_heap = bindless_heap::create(m_physical_device, m_device, m_device_functions);
+	if (m_bindless_heap == nullptr)
+		return false;
+
+	VkSamplerCreateInfo sampler_create_info{};
+	sampler_create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler_create_info.magFilter = VK_FILTER_LINEAR;
+	sampler_create_info.minFilter = VK_FILTER_LINEAR;
+	sampler_create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	sampler_create_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	sampler_create_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	sampler_create_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	sampler_create_info.maxLod = VK_LOD_CLAMP_NONE;
+
+	auto result = m_device_functions.vkCreateSampler(m_device, &sampler_create_info, nullptr, &m_default_sampler);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to create default sampler: {}", result) << std::endl;
+		return false;
+	}
+
+	VkBufferCreateInfo buffer_create_info{};
+	buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buffer_create_info.size = MAX_MATERIALS * sizeof(gpu_material);
+	buffer_create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (!m_memory_allocator->create_buffer(buffer_create_info, memory_usage::cpu_to_gpu, m_material_buffer, m_material_allocation))
+		return false;
+
+	m_material_buffer_index = m_bindless_heap->add_buffer(m_material_buffer);
+	if (m_material_buffer_index == bindless_heap::INVALID_INDEX)
+		return false;
+
+	return create_material({}).has_value();
+}
+
+bool renderer_vulkan::create_culling_pipeline()
+{
+	if (m_bindless_heap == nullptr)
+	{
+		std::cout << "GPU driven rendering needs descriptor indexing, meshes are drawn with one instanced draw per batch" << std::endl;
+		return true;
+	}
+
+	m_culling_pipeline = compile_culling_pipeline();
+	return m_culling_pipeline != VK_NULL_HANDLE;
+}
+
+bool renderer_vulkan::create_culling_resources(mesh_instance_batch& batch)
+{
+	VkBufferCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	create_info.size = m_frames.size() * sizeof(VkDrawIndexedIndirectCommand);
+	create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (!m_memory_allocator->create_buffer(create_info, memory_usage::gpu_only, batch.draw_command_buffer, batch.draw_command_allocation))
+		return false;
+
+	create_info.size = (VkDeviceSize)m_frames.size() * batch.instance_count * sizeof(uint32_t);
+	create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	if (!m_memory_allocator->create_buffer(create_info, memory_usage::gpu_only, batch.visible_instance_buffer, batch.visible_instance_allocation))
+		return false;
+
+	batch.culling_descriptor_set = allocate_culling_descriptor_set();
+	if (batch.culling_descriptor_set == VK_NULL_HANDLE)
+		return false;
+
+	batch.instance_buffer_index = m_bindless_heap->add_buffer(batch.instance_buffer);
+	if (batch.instance_buffer_index == bindless_heap::INVALID_INDEX)
+		return false;
+
+	batch.visible_instance_buffer_index = m_bindless_heap->add_buffer(batch.visible_instance_buffer);
+	if (batch.visible_instance_buffer_index == bindless_heap::INVALID_INDEX)
+	{
+		m_bindless_heap->remove_buffer(batch.instance_buffer_index);
+		return false;
+	}
+
+	VkDescriptorBufferInfo buffer_infos[]{
+		{ batch.instance_buffer, 0, VK_WHOLE_SIZE },
+		{ batch.draw_command_buffer, 0, VK_WHOLE_SIZE },
+		{ batch.visible_instance_buffer, 0, VK_WHOLE_SIZE }
+	};
+
+	VkWriteDescriptorSet writes[3]{};
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = batch.culling_descriptor_set;
+		writes[i].dstBinding = i;
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[i].pBufferInfo = &buffer_infos[i];
+	}
+
+	m_device_functions.vkUpdateDescriptorSets(m_device, 3, writes, 0, nullptr);
+	return true;
+}
+
+upload_manager::ticket renderer_vulkan::create_device_local_buffer(void const* data, VkDeviceSize size, VkBufferUsageFlags usage,
+																   VkBuffer& buffer, memory_allocation& allocation)
+{
+	VkBufferCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	create_info.size = size;
+	create_info.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (!m_memory_allocator->create_buffer(create_info, memory_usage::gpu_only, buffer, allocation))
+		return 0;
+
+	auto upload = m_upload_manager->upload_buffer(buffer, 0, data, size);
+	if (upload == 0)
+		m_memory_allocator->destroy_buffer(buffer, allocation);
+
+	return upload;
+}
+
+void renderer_vulkan::create_debug_messenger()
+{
+	VkDebugUtilsMessengerCreateInfoEXT debugUtilsMessengerCreateInfo{};
+	debugUtilsMessengerCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+	debugUtilsMessengerCreateInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT |
+													VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+	debugUtilsMessengerCreateInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT |
+												VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT;
+	debugUtilsMessengerCreateInfo.pfnUserCallback = debug_callback;
+
+	vkCreateDebugUtilsMessengerEXT(m_instance, &debugUtilsMessengerCreateInfo, nullptr, &m_debugMessenger);
+}
+
+void renderer_vulkan::create_deletion_queue()
+{
+	m_deletion_queue = std::make_unique<deletion_queue>(m_device, m_device_functions, *m_memory_allocator, m_frame_timeline);
+}
+
+bool renderer_vulkan::create_depth_image()
+{
+	if (m_render_path == render_path::dynamic_rendering)
+		return true;
+
+	VkImageCreateInfo image_create_info{};
+	image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_create_info.imageType = VK_IMAGE_TYPE_2D;
+	image_create_info.format = DEPTH_FORMAT;
+	image_create_info.extent = { m_swapchain_extent.width, m_swapchain_extent.height, 1 };
+	image_create_info.mipLevels = 1;
+	image_create_info.arrayLayers = 1;
+	image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_create_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (!m_memory_allocator->create_image(image_create_info, memory_usage::gpu_only, m_depth_image, m_depth_allocation))
+	{
+		std::cerr << "Failed to create depth image" << std::endl;
+		return false;
+	}
+
+	VkImageViewCreateInfo image_view_create_info{};
+	image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	image_view_create_info.image = m_depth_image;
+	image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	image_view_create_info.format = DEPTH_FORMAT;
+	image_view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	image_view_create_info.subresourceRange.levelCount = 1;
+	image_view_create_info.subresourceRange.layerCount = 1;
+
+	auto result = m_device_functions.vkCreateImageView(m_device, &image_view_create_info, nullptr, &m_depth_image_view);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to create depth image view: {}", result) << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool renderer_vulkan::create_framebuffers()
+{
+	if (m_render_path == render_path::dynamic_rendering)
+		return true;
+
+	m_swapchain_framebuffers.resize(m_swapchain_image_views.size());
+	for (auto& framebuffer : m_swapchain_framebuffers)
+		framebuffer = VK_NULL_HANDLE;
+
+	VkImageView attachments[2]{ VK_NULL_HANDLE, m_depth_image_view };
+
+	VkFramebufferCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	create_info.renderPass = m_render_pass;
+	create_info.pAttachments = attachments;
+	create_info.attachmentCount = 2;
+	create_info.width = m_swapchain_extent.width;
+	create_info.height = m_swapchain_extent.height;
+	create_info.layers = 1;
+	for (size_t i = 0; i < m_swapchain_image_views.size(); ++i)
+	{
+		attachments[0] = m_swapchain_image_views[i];
+
+		auto result = m_device_functions.vkCreateFramebuffer(m_device, &create_info, nullptr,
+															 &m_swapchain_framebuffers[i]);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create framebuffer: {}", result) << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+VkPipeline renderer_vulkan::compile_culling_pipeline()
+{
+	auto shader_code = read_entire_file(CULLING_SHADER, io::file_mode::binary);
+	if (shader_code.empty())
+		return VK_NULL_HANDLE;
+
+	shader_reflection reflection;
+	if (!reflect_shader(shader_code, reflection))
+		return VK_NULL_HANDLE;
+
+	auto layout = m_pipeline_layouts->get_pipeline_layout(&reflection, 1);
+	if (layout == VK_NULL_HANDLE)
+		return VK_NULL_HANDLE;
+
+	// The descriptor sets allocated so far use the set layout, so a reloaded shader has to keep the interface.
+	if (m_culling_pipeline_layout == VK_NULL_HANDLE)
+	{
+		if (m_pipeline_layouts->push_constant_range(layout).size < sizeof(culling_constants))
+		{
+			std::cerr << "Failed to create culling pipeline: its push constants are smaller than culling_constants" << std::endl;
+			return VK_NULL_HANDLE;
+		}
+
+		if (m_pipeline_layouts->set_layout(layout, 1) == VK_NULL_HANDLE)
+		{
+			std::cerr << "Failed to create culling pipeline: it has no set for its per-frame constants" << std::endl;
+			return VK_NULL_HANDLE;
+		}
+
+		m_culling_pipeline_layout = layout;
+		m_culling_descriptor_set_layout = m_pipeline_layouts->set_layout(layout, 0);
+		m_culling_frame_set_layout = m_pipeline_layouts->set_layout(layout, 1);
+	}
+	else if (layout != m_culling_pipeline_layout)
+	{
+		std::cerr << std::format("Failed to create culling pipeline: {} changed its resources", CULLING_SHADER) << std::endl;
+		return VK_NULL_HANDLE;
+	}
+
+	auto shader = create_shader_module(shader_code);
+	if (shader == VK_NULL_HANDLE)
+		return VK_NULL_HANDLE;
+
+	VkComputePipelineCreateInfo pipeline_create_info{};
+	pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_create_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline_create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline_create_info.stage.module = shader;
+	pipeline_create_info.stage.pName = "main";
+	pipeline_create_info.layout = m_culling_pipeline_layout;
+
+	VkPipeline pipeline;
+	auto result = m_device_functions.vkCreateComputePipelines(m_device, m_pipeline_cache, 1, &pipeline_create_info, nullptr, &pipeline);
+	m_device_functions.vkDestroyShaderModule(m_device, shader, nullptr);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to create culling pipeline: {}", result) << std::endl;
+		return VK_NULL_HANDLE;
+	}
+
+	return pipeline;
+}
+
+VkPipeline renderer_vulkan::compile_graphics_pipeline(graphics_pipeline_description const& description, VkPipelineLayout& layout)
+{
+	auto vertex_shader_code = read_entire_file(description.vertex_shader.c_str(), io::file_mode::binary);
+	if (vertex_shader_code.empty())
+		return VK_NULL_HANDLE;
+
+	auto fragment_shader_code = read_entire_file(description.fragment_shader.c_str(), io::file_mode::binary);
+	if (fragment_shader_code.empty())
+		return VK_NULL_HANDLE;
+
+	shader_reflection shaders[2];
+	if (!reflect_shader(vertex_shader_code, shaders[0]) || !reflect_shader(fragment_shader_code, shaders[1]))
+		return VK_NULL_HANDLE;
+
+	if (!check_vertex_inputs(description.vertex_input, shaders[0]))
+	{
+		std::cerr << std::format("Failed to create graphics pipeline: the inputs of {} don't match its vertex layout", description.vertex_shader)
+				  << std::endl;
+		return VK_NULL_HANDLE;
+	}
+
+	// Without a layout, the pipeline gets the one its shaders declare, shared with any pipeline declaring the same.
+	layout = description.layout;
+	if (layout == VK_NULL_HANDLE)
+	{
+		layout = m_pipeline_layouts->get_pipeline_layout(shaders, 2);
+		if (layout == VK_NULL_HANDLE)
+			return VK_NULL_HANDLE;
+	}
+	else if (!m_pipeline_layouts->is_compatible(layout, shaders, 2))
+	{
+		std::cerr << std::format("Failed to create graphics pipeline: {} and {} don't fit its layout", description.vertex_shader,
+								 description.fragment_shader)
+				  << std::endl;
+		return VK_NULL_HANDLE;
+	}
+
+	// A stage only gets the constants it declares. The values are shared, each stage has its own map entries into
+	// them. A constant that one stage declares with another size than 32 bits would be read as the wrong type.
+	auto constant_count = description.specialization_constants().size();
+	fixed_vector<uint32_t> specialization_data(constant_count);
+	fixed_vector<VkSpecializationMapEntry> specialization_map_entries[2]{ fixed_vector<VkSpecializationMapEntry>(constant_count),
+																		   fixed_vector<VkSpecializationMapEntry>(constant_count) };
+	uint32_t stage_constant_counts[2]{};
+	char const* shader_names[2]{ description.vertex_shader.c_str(), description.fragment_shader.c_str() };
+	for (size_t i = 0; i < constant_count; ++i)
+	{
+		auto const& constant = description.specialization_constants()[i];
+		if (specialization_constant_size(shaders[0], constant.id) == 0 && specialization_constant_size(shaders[1], constant.id) == 0)
+		{
+			std::cerr << std::format("Failed to create graphics pipeline: neither {} nor {} has a specialization constant {}",
+									 description.vertex_shader, description.fragment_shader, constant.id)
+					  << std::endl;
+			return VK_NULL_HANDLE;
+		}
+
+		specialization_data[i] = constant.value;
+		for (uint32_t stage = 0; stage < 2; ++stage)
+		{
+			auto size = specialization_constant_size(shaders[stage], constant.id);
+			if (size == 0)
+				continue;
+
+			if (size != sizeof(uint32_t))
+			{
+				std::cerr << std::format("Failed to create graphics pipeline: specialization constant {} of {} is {} bytes instead of 32 bits",
+										 constant.id, shader_names[stage], size)
+						  << std::endl;
+				return VK_NULL_HANDLE;
+			}
+
+			specialization_map_entries[stage][stage_constant_counts[stage]++] = { constant.id, (uint32_t)(i * sizeof(uint32_t)),
+																				  sizeof(uint32_t) };
+		}
+	}
+
+	VkSpecializationInfo specialization_infos[2]{};
+	for (uint32_t stage = 0; stage < 2; ++stage)
+	{
+		specialization_infos[stage].pMapEntries = specialization_map_entries[stage].data();
+		specialization_infos[stage].mapEntryCount = stage_constant_counts[stage];
+		specialization_infos[stage].pData = specialization_data.data();
+		specialization_infos[stage].dataSize = constant_count * sizeof(uint32_t);
+	}
+
+	VkShaderModule vertex_shader = create_shader_module(vertex_shader_code);
+	if (vertex_shader == VK_NULL_HANDLE)
+		return VK_NULL_HANDLE;
+
+	VkShaderModule fragment_shader = create_shader_module(fragment_shader_code);
+	if (fragment_shader == VK_NULL_HANDLE)
+	{
+		m_device_functions.vkDestroyShaderModule(m_device, vertex_shader, nullptr);
+		return VK_NULL_HANDLE;
+	}
 
 	VkPipelineShaderStageCreateInfo vertex_shader_stage_create_info{};
 	vertex_shader_stage_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	vertex_shader_stage_create_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
 	vertex_shader_stage_create_info.module = vertex_shader;
 	vertex_shader_stage_create_info.pName = "main";
+	if (stage_constant_counts[0] > 0)
+		vertex_shader_stage_create_info.pSpecializationInfo = &specialization_infos[0];
 
 	VkPipelineShaderStageCreateInfo fragment_shader_stage_create_info{};
 	fragment_shader_stage_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	fragment_shader_stage_create_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 	fragment_shader_stage_create_info.module = fragment_shader;
 	fragment_shader_stage_create_info.pName = "main";
+	if (stage_constant_counts[1] > 0)
+		fragment_shader_stage_create_info.pSpecializationInfo = &specialization_infos[1];
 
 	VkPipelineShaderStageCreateInfo shader_stages_create_info[]{
 		vertex_shader_stage_create_info,
@@ -318,32 +1476,40 @@ bool renderer_vulkan::create_graphics_pipeline()
 
 	VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info{};
 	vertex_input_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	if (description.vertex_input != vertex_layout::none)
+	{
+		// The per vertex binding and attributes come first, so mesh_vertices uses the start of both arrays.
+		bool per_instance = description.vertex_input == vertex_layout::mesh;
+		vertex_input_state_create_info.pVertexBindingDescriptions = MESH_VERTEX_BINDINGS;
+		vertex_input_state_create_info.vertexBindingDescriptionCount = per_instance ? (uint32_t)std::size(MESH_VERTEX_BINDINGS) : 1;
+		vertex_input_state_create_info.pVertexAttributeDescriptions = MESH_VERTEX_ATTRIBUTES;
+		vertex_input_state_create_info.vertexAttributeDescriptionCount = per_instance ? (uint32_t)std::size(MESH_VERTEX_ATTRIBUTES)
+																					  : PER_VERTEX_ATTRIBUTE_COUNT;
+	}
 
 	VkPipelineInputAssemblyStateCreateInfo input_assembly_state_create_info{};
 	input_assembly_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	input_assembly_state_create_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-
-	VkViewport viewport{};
-	viewport.width = (float)m_swapchain_extent.width;
-	viewport.height = (float)m_swapchain_extent.height;
-	viewport.maxDepth = 1.f;
-
-	VkRect2D scissor{};
-	scissor.extent = m_swapchain_extent;
+	input_assembly_state_create_info.topology = description.topology;
 
+	// Viewport and scissor are set while recording, so the pipeline survives swapchain recreation.
 	VkPipelineViewportStateCreateInfo viewport_state_create_info{};
 	viewport_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewport_state_create_info.pViewports = &viewport;
 	viewport_state_create_info.viewportCount = 1;
-	viewport_state_create_info.pScissors = &scissor;
 	viewport_state_create_info.scissorCount = 1;
 
+	VkDynamicState dynamic_states[]{ VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamic_state_create_info{};
+	dynamic_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamic_state_create_info.pDynamicStates = dynamic_states;
+	dynamic_state_create_info.dynamicStateCount = 2;
+
 	VkPipelineRasterizationStateCreateInfo rasterization_state_create_info{};
 	rasterization_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterization_state_create_info.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterization_state_create_info.polygonMode = description.polygon_mode;
 	rasterization_state_create_info.lineWidth = 1.f;
-	rasterization_state_create_info.cullMode = VK_CULL_MODE_BACK_BIT;
-	rasterization_state_create_info.frontFace = VK_FRONT_FACE_CLOCKWISE;
+	rasterization_state_create_info.cullMode = description.cull_mode;
+	rasterization_state_create_info.frontFace = description.front_face;
 
 	VkPipelineMultisampleStateCreateInfo multisample_state_create_info{};
 	multisample_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
@@ -352,22 +1518,28 @@ bool renderer_vulkan::create_graphics_pipeline()
 	VkPipelineColorBlendAttachmentState color_blend_attachment_state{};
 	color_blend_attachment_state.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
 												  VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	if (description.blend_enabled)
+	{
+		color_blend_attachment_state.blendEnable = VK_TRUE;
+		color_blend_attachment_state.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+		color_blend_attachment_state.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		color_blend_attachment_state.colorBlendOp = VK_BLEND_OP_ADD;
+		color_blend_attachment_state.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		color_blend_attachment_state.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		color_blend_attachment_state.alphaBlendOp = VK_BLEND_OP_ADD;
+	}
 
 	VkPipelineColorBlendStateCreateInfo color_blend_state_create_info{};
 	color_blend_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
 	color_blend_state_create_info.pAttachments = &color_blend_attachment_state;
 	color_blend_state_create_info.attachmentCount = 1;
 
-	VkPipelineLayoutCreateInfo pipeline_layout_create_info{};
-	pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-
-	auto result = m_device_functions.vkCreatePipelineLayout(m_device, &pipeline_layout_create_info, nullptr,
-															&m_pipeline_layout);
-	if (result != VK_SUCCESS)
-	{
-		std::cerr << std::format("Failed to create pipeline layout: {}", result) << std::endl;
-		return false;
-	}
+	// Pipelines without the depth test still draw into passes with a depth attachment, they leave it untouched.
+	VkPipelineDepthStencilStateCreateInfo depth_stencil_state_create_info{};
+	depth_stencil_state_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depth_stencil_state_create_info.depthTestEnable = description.depth_test_enabled ? VK_TRUE : VK_FALSE;
+	depth_stencil_state_create_info.depthWriteEnable = description.depth_test_enabled ? VK_TRUE : VK_FALSE;
+	depth_stencil_state_create_info.depthCompareOp = VK_COMPARE_OP_LESS;
 
 	VkGraphicsPipelineCreateInfo graphics_pipeline_create_info{};
 	graphics_pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -379,19 +1551,101 @@ bool renderer_vulkan::create_graphics_pipeline()
 	graphics_pipeline_create_info.pRasterizationState = &rasterization_state_create_info;
 	graphics_pipeline_create_info.pMultisampleState = &multisample_state_create_info;
 	graphics_pipeline_create_info.pColorBlendState = &color_blend_state_create_info;
-	graphics_pipeline_create_info.layout = m_pipeline_layout;
-	graphics_pipeline_create_info.renderPass = m_render_pass;
+	graphics_pipeline_create_info.pDepthStencilState = &depth_stencil_state_create_info;
+	graphics_pipeline_create_info.pDynamicState = &dynamic_state_create_info;
+	graphics_pipeline_create_info.layout = layout;
+	graphics_pipeline_create_info.renderPass = description.render_pass;
+	graphics_pipeline_create_info.subpass = description.subpass;
+
+	VkPipelineRenderingCreateInfo rendering_create_info{};
+	rendering_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+	rendering_create_info.pColorAttachmentFormats = &description.color_format;
+	rendering_create_info.colorAttachmentCount = 1;
+	rendering_create_info.depthAttachmentFormat = description.depth_format;
+	if (description.render_pass == VK_NULL_HANDLE)
+		graphics_pipeline_create_info.pNext = &rendering_create_info;
+
+	VkPipeline pipeline;
+	auto result = m_device_functions.vkCreateGraphicsPipelines(m_device, m_pipeline_cache, 1, &graphics_pipeline_create_info,
+															   nullptr, &pipeline);
+
+	m_device_functions.vkDestroyShaderModule(m_device, vertex_shader, nullptr);
+	m_device_functions.vkDestroyShaderModule(m_device, fragment_shader, nullptr);
 
-	result = m_device_functions.vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info,
-														  nullptr, &m_graphics_pipeline);
 	if (result != VK_SUCCESS)
 	{
 		std::cerr << std::format("Failed to create graphics pipeline: {}", result) << std::endl;
-		return false;
+		return VK_NULL_HANDLE;
 	}
 
-	m_device_functions.vkDestroyShaderModule(m_device, vertex_shader, nullptr);
-	m_device_functions.vkDestroyShaderModule(m_device, fragment_shader, nullptr);
+	return pipeline;
+}
+
+bool renderer_vulkan::create_graphics_pipeline()
+{
+	graphics_pipeline_description description;
+	description.vertex_shader = "shaders/triangle.vert.spv";
+	description.fragment_shader = "shaders/triangle.frag.spv";
+	description.layout = m_pipeline_layout;
+	description.render_pass = m_render_pass;
+	if (m_render_path == render_path::dynamic_rendering)
+	{
+		description.color_format = m_swapchain_image_format;
+		description.depth_format = DEPTH_FORMAT;
+	}
+
+	m_graphics_pipeline = get_graphics_pipeline(description);
+	if (m_graphics_pipeline == VK_NULL_HANDLE)
+		return false;
+
+	// Without the bindless heap there are no materials, so meshes use the fragment stage of the triangle.
+	description.vertex_shader = "shaders/mesh.vert.spv";
+	if (m_bindless_heap != nullptr)
+		description.fragment_shader = "shaders/mesh.frag.spv";
+	description.vertex_input = vertex_layout::mesh;
+	description.front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	description.depth_test_enabled = true;
+
+	m_mesh_pipeline = get_graphics_pipeline(description);
+	if (m_mesh_pipeline == VK_NULL_HANDLE)
+		return false;
+
+	// GPU driven rendering needs the bindless heap, see create_culling_pipeline.
+	if (m_bindless_heap == nullptr)
+		return true;
+
+	description.vertex_shader = "shaders/mesh_culled.vert.spv";
+	description.vertex_input = vertex_layout::mesh_vertices;
+
+	m_culled_mesh_pipeline = get_graphics_pipeline(description);
+	return m_culled_mesh_pipeline != VK_NULL_HANDLE;
+}
+
+bool renderer_vulkan::create_image_views()
+{
+	m_swapchain_image_views.resize(m_swapchain_images.size());
+	for (auto& image_view : m_swapchain_image_views)
+		image_view = VK_NULL_HANDLE;
+
+	VkImageViewCreateInfo image_view_create_info{};
+	image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	image_view_create_info.format = m_swapchain_image_format;
+	image_view_create_info.components = { VK_COMPONENT_SWIZZLE_IDENTITY };
+	image_view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	image_view_create_info.subresourceRange.levelCount = 1;
+	image_view_create_info.subresourceRange.layerCount = 1;
+	for (size_t i = 0; i < m_swapchain_images.size(); ++i)
+	{
+		image_view_create_info.image = m_swapchain_images[i];
+		auto result = m_device_functions.vkCreateImageView(m_device, &image_view_create_info, nullptr,
+														   &m_swapchain_image_views[i]);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create image view: {}", result) << std::endl;
+			return false;
+		}
+	}
 
 	return true;
 }
@@ -409,18 +1663,39 @@ bool renderer_vulkan::create_logical_device(debug_output debugOutput)
 	vkGetPhysicalDeviceProperties(m_physical_device, &deviceProperties);
 	std::cout << std::format("Using {} {} ({})", (VkVendorId)deviceProperties.vendorID, deviceProperties.deviceName, deviceProperties.deviceType) << std::endl;
 
-	auto queueFamilyIndices = find_queue_families(m_physical_device);
+	m_queue_families = find_queue_families(m_physical_device);
+	auto const& queueFamilyIndices = m_queue_families;
 
-	float queuePriority = 1.0f;
-	std::set<uint32_t> uniqueQueueFamilies{ queueFamilyIndices.graphics.value(), queueFamilyIndices.present.value() };
+	uint32_t queueFamilyCount;
+	vkGetPhysicalDeviceQueueFamilyProperties(m_physical_device, &queueFamilyCount, nullptr);
+	fixed_vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(m_physical_device, &queueFamilyCount, queueFamilyProperties.data());
+
+	// Each kind of work gets its own queue while its family has queues left, after that it shares the last one.
+	// Presentation always shares queue 0 of its family.
+	std::map<uint32_t, uint32_t> queueCounts;
+	auto assignQueue = [&](uint32_t family) {
+		auto& count = queueCounts[family];
+		if (count < queueFamilyProperties[family].queueCount)
+			return count++;
+		return count - 1;
+	};
+
+	auto graphicsQueueIndex = assignQueue(queueFamilyIndices.graphics.value());
+	if (queueFamilyIndices.present != queueFamilyIndices.graphics)
+		assignQueue(queueFamilyIndices.present.value());
+	auto computeQueueIndex = queueFamilyIndices.compute.has_value() ? assignQueue(queueFamilyIndices.compute.value()) : 0;
+	auto transferQueueIndex = assignQueue(queueFamilyIndices.transfer.value());
+
+	float queuePriorities[]{ 1.0f, 1.0f, 1.0f, 1.0f };
 	vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	for (uint32_t queueFamilyIndex : uniqueQueueFamilies)
+	for (auto [queueFamilyIndex, queueCount] : queueCounts)
 	{
 		VkDeviceQueueCreateInfo queueCreateInfo{};
 		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 		queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
-		queueCreateInfo.queueCount = 1;
-		queueCreateInfo.pQueuePriorities = &queuePriority;
+		queueCreateInfo.queueCount = queueCount;
+		queueCreateInfo.pQueuePriorities = queuePriorities;
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
 
@@ -430,35 +1705,270 @@ bool renderer_vulkan::create_logical_device(debug_output debugOutput)
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
 	deviceCreateInfo.queueCreateInfoCount = (uint32_t)queueCreateInfos.size();
-	deviceCreateInfo.ppEnabledExtensionNames = REQUIRED_DEVICE_EXTENSION_NAMES.data();
-	deviceCreateInfo.enabledExtensionCount = (uint32_t)REQUIRED_DEVICE_EXTENSION_NAMES.size();
 	deviceCreateInfo.pEnabledFeatures = &features;
 
-	fixed_vector<char const*> requiredLayerNames(1);
-	if (debugOutput == debug_output::enabled)
+	// Optional extensions are enabled next to the required ones when the device has them.
+	vector<char const*> extensionNames;
+	if (!is_headless())
+	{
+		for (auto extensionName : REQUIRED_DEVICE_EXTENSION_NAMES)
+			extensionNames.push_back(extensionName);
+	}
+
+	bool memoryBudgetSupported = check_device_extension_support(m_physical_device, { VK_EXT_MEMORY_BUDGET_EXTENSION_NAME });
+	if (memoryBudgetSupported)
+		extensionNames.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+	bool swapchainMaintenanceSupported = !is_headless() && check_instance_extension_support(SURFACE_MAINTENANCE_EXTENSION_NAMES) &&
+										 check_device_extension_support(m_physical_device, { VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME });
+	if (swapchainMaintenanceSupported)
+		extensionNames.push_back(VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME);
+
+	deviceCreateInfo.ppEnabledExtensionNames = extensionNames.data();
+	deviceCreateInfo.enabledExtensionCount = (uint32_t)extensionNames.size();
+
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(m_physical_device, &supportedFeatures);
+
+	// Only benchmarks look at pipeline statistics, so they are collected when the device can count them. The scene's
+	// secondary command buffers are executed inside the query, so they are only reused when they can inherit it.
+	features.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+	features.inheritedQueries = supportedFeatures.inheritedQueries;
+	m_pipeline_statistics_supported = features.pipelineStatisticsQuery == VK_TRUE;
+	m_scene_command_reuse = !m_pipeline_statistics_supported || features.inheritedQueries == VK_TRUE;
+
+	VkPhysicalDeviceVulkan12Features vulkan12Features{};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceVulkan12Features supportedVulkan12Features{};
+	supportedVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceVulkan13Features supportedVulkan13Features{};
+	supportedVulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+	VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT supportedSwapchainMaintenanceFeatures{};
+	supportedSwapchainMaintenanceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT;
+	if (deviceProperties.apiVersion >= VK_API_VERSION_1_2)
+	{
+		// The 1.3 structure may only be chained on devices that know it, and so may the extension's.
+		if (deviceProperties.apiVersion >= VK_API_VERSION_1_3)
+			supportedVulkan12Features.pNext = &supportedVulkan13Features;
+		if (swapchainMaintenanceSupported)
+			supportedSwapchainMaintenanceFeatures.pNext = std::exchange(supportedVulkan12Features.pNext, &supportedSwapchainMaintenanceFeatures);
+
+		VkPhysicalDeviceFeatures2 supportedFeatures2{};
+		supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		supportedFeatures2.pNext = &supportedVulkan12Features;
+		vkGetPhysicalDeviceFeatures2(m_physical_device, &supportedFeatures2);
+
+		vulkan12Features.timelineSemaphore = supportedVulkan12Features.timelineSemaphore;
+		deviceCreateInfo.pNext = &vulkan12Features;
+	}
+
+	// Frames and uploads are synchronized with timeline semaphores only.
+	if (vulkan12Features.timelineSemaphore != VK_TRUE)
+	{
+		std::cerr << "Failed to create logical device: timeline semaphores are not supported" << std::endl;
+		return false;
+	}
+
+	VkPhysicalDeviceVulkan13Features vulkan13Features{};
+	vulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+	if (m_render_path == render_path::dynamic_rendering)
+	{
+		if (supportedVulkan13Features.dynamicRendering == VK_TRUE && supportedVulkan13Features.synchronization2 == VK_TRUE)
+		{
+			vulkan13Features.dynamicRendering = VK_TRUE;
+			vulkan13Features.synchronization2 = VK_TRUE;
+			vulkan12Features.pNext = &vulkan13Features;
+		}
+		else
+		{
+			std::cout << "Dynamic rendering is not supported, falling back to render passes" << std::endl;
+			m_render_path = render_path::render_pass;
+		}
+	}
+
+	// The bindless heap only needs the descriptor indexing features it uses, not all of them.
+	if (bindless_heap::is_supported(supportedFeatures, supportedVulkan12Features))
+	{
+		features.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+		vulkan12Features.descriptorIndexing = VK_TRUE;
+		vulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+		vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+		vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+		m_bindless_supported = true;
+	}
+
+	// Retired swapchains are destroyed once the fence of their last present has signaled, see recreate_swapchain.
+	VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT swapchainMaintenanceFeatures{};
+	swapchainMaintenanceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT;
+	if (supportedSwapchainMaintenanceFeatures.swapchainMaintenance1 == VK_TRUE)
+	{
+		swapchainMaintenanceFeatures.swapchainMaintenance1 = VK_TRUE;
+		swapchainMaintenanceFeatures.pNext = std::exchange(vulkan12Features.pNext, &swapchainMaintenanceFeatures);
+		m_present_fences_supported = true;
+	}
+
+	fixed_vector<char const*> requiredLayerNames(1);
+	if (debugOutput == debug_output::enabled)
+	{
+		requiredLayerNames[0] = "VK_LAYER_KHRONOS_validation";
+		deviceCreateInfo.enabledLayerCount = 1;
+		deviceCreateInfo.ppEnabledLayerNames = requiredLayerNames.data();
+	}
+
+	auto result = vkCreateDevice(m_physical_device, &deviceCreateInfo, nullptr, &m_device);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed creating Vulkan logical device: {}", result) << std::endl;
+		return false;
+	}
+
+	volkLoadDeviceTable(&m_device_functions, m_device);
+
+	m_device_functions.vkGetDeviceQueue(m_device, queueFamilyIndices.graphics.value(), graphicsQueueIndex, &m_queues.graphics);
+	m_device_functions.vkGetDeviceQueue(m_device, queueFamilyIndices.present.value(), 0, &m_queues.present);
+	if (queueFamilyIndices.compute.has_value())
+		m_device_functions.vkGetDeviceQueue(m_device, queueFamilyIndices.compute.value(), computeQueueIndex, &m_queues.compute);
+	m_device_functions.vkGetDeviceQueue(m_device, queueFamilyIndices.transfer.value(), transferQueueIndex, &m_queues.transfer);
+
+	std::cout << std::format("Queue families: graphics {}, compute {}, transfer {}", queueFamilyIndices.graphics.value(),
+							 queueFamilyIndices.compute.has_value() ? std::to_string(queueFamilyIndices.compute.value()) : "none",
+							 queueFamilyIndices.transfer.value())
+			  << std::endl;
+
+	m_memory_allocator = std::make_unique<memory_allocator>(m_physical_device, m_device, m_device_functions, memoryBudgetSupported);
+
+	return true;
+}
+
+bool renderer_vulkan::create_offscreen_images(uint32_t width, uint32_t height)
+{
+	m_swapchain_extent = { width, height };
+	m_swapchain_image_format = VK_FORMAT_R8G8B8A8_UNORM;
+
+	VkImageCreateInfo image_create_info{};
+	image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	image_create_info.imageType = VK_IMAGE_TYPE_2D;
+	image_create_info.format = m_swapchain_image_format;
+	image_create_info.extent = { width, height, 1 };
+	image_create_info.mipLevels = 1;
+	image_create_info.arrayLayers = 1;
+	image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+	image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	image_create_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	m_swapchain_images.resize(m_frames.size());
+	m_offscreen_image_allocations.resize(m_frames.size());
+	for (size_t i = 0; i < m_frames.size(); ++i)
+	{
+		m_swapchain_images[i] = VK_NULL_HANDLE;
+		m_offscreen_image_allocations[i] = {};
+	}
+
+	for (size_t i = 0; i < m_frames.size(); ++i)
+	{
+		if (!m_memory_allocator->create_image(image_create_info, memory_usage::gpu_only, m_swapchain_images[i], m_offscreen_image_allocations[i]))
+		{
+			std::cerr << "Failed to create offscreen image" << std::endl;
+			return false;
+		}
+	}
+
+	return create_image_views();
+}
+
+bool renderer_vulkan::create_pipeline_cache()
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_physical_device, &properties);
+
+	fixed_vector<char> initial_data(0);
+	if (file_exists(PIPELINE_CACHE_PATH))
+	{
+		initial_data = read_entire_file(PIPELINE_CACHE_PATH, io::file_mode::binary);
+		if (!check_pipeline_cache_compatibility(initial_data, properties))
+		{
+			std::cout << std::format("Discarding pipeline cache {}, it was created for a different device or driver", PIPELINE_CACHE_PATH) << std::endl;
+			initial_data = fixed_vector<char>(0);
+		}
+	}
+
+	VkPipelineCacheCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	create_info.pInitialData = initial_data.data();
+	create_info.initialDataSize = initial_data.size();
+
+	auto result = m_device_functions.vkCreatePipelineCache(m_device, &create_info, nullptr, &m_pipeline_cache);
+	if (result != VK_SUCCESS && !initial_data.empty())
+	{
+		// The header matched, but the driver may still reject the contents. Starting over beats failing to start.
+		std::cout << std::format("Discarding pipeline cache {}: {}", PIPELINE_CACHE_PATH, result) << std::endl;
+		create_info.pInitialData = nullptr;
+		create_info.initialDataSize = 0;
+		result = m_device_functions.vkCreatePipelineCache(m_device, &create_info, nullptr, &m_pipeline_cache);
+	}
+
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to create pipeline cache: {}", result) << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool renderer_vulkan::create_pipeline_layout()
+{
+	m_pipeline_layouts = std::make_unique<pipeline_layout_cache>(m_device, m_device_functions);
+
+	// Every pipeline shares the bindless set, so it stays bound across pipeline changes.
+	if (m_bindless_heap != nullptr)
+	{
+		m_pipeline_layouts->set_external_set_layout(
+			0, m_bindless_heap->set_layout(),
+			{ { 0, bindless_heap::TEXTURE_BINDING, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_bindless_heap->max_textures(), VK_SHADER_STAGE_ALL },
+			  { 0, bindless_heap::BUFFER_BINDING, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_bindless_heap->max_buffers(), VK_SHADER_STAGE_ALL } });
+	}
+
+	// The mesh shaders declare everything the renderer binds, so the triangle pipeline shares their layout.
+	shader_reflection shaders[3];
+	uint32_t shader_count = 2;
+	auto fragment_shader = m_bindless_heap != nullptr ? "shaders/mesh.frag.spv" : "shaders/triangle.frag.spv";
+	if (!reflect_shader_file("shaders/mesh.vert.spv", shaders[0]) || !reflect_shader_file(fragment_shader, shaders[1]))
+		return false;
+
+	// GPU driven draws push their batch's instances after mesh_constants.
+	auto push_constants_size = sizeof(mesh_constants);
+	if (m_bindless_heap != nullptr)
 	{
-		requiredLayerNames[0] = "VK_LAYER_KHRONOS_validation";
-		deviceCreateInfo.enabledLayerCount = 1;
-		deviceCreateInfo.ppEnabledLayerNames = requiredLayerNames.data();
+		if (!reflect_shader_file("shaders/mesh_culled.vert.spv", shaders[2]))
+			return false;
+
+		shader_count = 3;
+		push_constants_size += sizeof(culled_mesh_constants);
 	}
 
-	auto result = vkCreateDevice(m_physical_device, &deviceCreateInfo, nullptr, &m_device);
-	if (result != VK_SUCCESS)
+	m_pipeline_layout = m_pipeline_layouts->get_pipeline_layout(shaders, shader_count);
+	if (m_pipeline_layout == VK_NULL_HANDLE)
+		return false;
+
+	if (m_pipeline_layouts->push_constant_range(m_pipeline_layout).size < push_constants_size)
 	{
-		std::cerr << std::format("Failed creating Vulkan logical device: {}", result) << std::endl;
+		std::cerr << "Failed to create pipeline layout: the mesh push constants are smaller than what the renderer pushes" << std::endl;
 		return false;
 	}
 
-	volkLoadDeviceTable(&m_device_functions, m_device);
-
-	m_device_functions.vkGetDeviceQueue(m_device, queueFamilyIndices.graphics.value(), 0, &m_queues.graphics);
-	m_device_functions.vkGetDeviceQueue(m_device, queueFamilyIndices.present.value(), 0, &m_queues.present);
-
 	return true;
 }
 
 bool renderer_vulkan::create_render_pass()
 {
+	if (m_render_path == render_path::dynamic_rendering)
+		return true;
+
 	VkAttachmentDescription color_attachment_description{};
 	color_attachment_description.format = m_swapchain_image_format;
 	color_attachment_description.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -466,26 +1976,45 @@ bool renderer_vulkan::create_render_pass()
 	color_attachment_description.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	color_attachment_description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	color_attachment_description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	color_attachment_description.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	color_attachment_description.finalLayout = is_headless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	// Depth is only needed within the frame, so it is cleared and never stored.
+	VkAttachmentDescription depth_attachment_description{};
+	depth_attachment_description.format = DEPTH_FORMAT;
+	depth_attachment_description.samples = VK_SAMPLE_COUNT_1_BIT;
+	depth_attachment_description.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depth_attachment_description.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depth_attachment_description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depth_attachment_description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depth_attachment_description.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentDescription attachment_descriptions[]{ color_attachment_description, depth_attachment_description };
 
 	VkAttachmentReference color_attachment_reference{};
 	color_attachment_reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+	VkAttachmentReference depth_attachment_reference{};
+	depth_attachment_reference.attachment = 1;
+	depth_attachment_reference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
 	VkSubpassDescription subpass_description{};
 	subpass_description.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	subpass_description.pColorAttachments = &color_attachment_reference;
 	subpass_description.colorAttachmentCount = 1;
+	subpass_description.pDepthStencilAttachment = &depth_attachment_reference;
 
+	// The depth image is shared by all frames, so the depth writes of the previous frame have to be done as well.
 	VkSubpassDependency subpass_dependency{};
 	subpass_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	subpass_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	subpass_dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	subpass_dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	subpass_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpass_dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpass_dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	subpass_dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
 	VkRenderPassCreateInfo render_pass_create_info{};
 	render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	render_pass_create_info.pAttachments = &color_attachment_description;
-	render_pass_create_info.attachmentCount = 1;
+	render_pass_create_info.pAttachments = attachment_descriptions;
+	render_pass_create_info.attachmentCount = 2;
 	render_pass_create_info.pSubpasses = &subpass_description;
 	render_pass_create_info.subpassCount = 1;
 	render_pass_create_info.pDependencies = &subpass_dependency;
@@ -525,7 +2054,8 @@ bool renderer_vulkan::create_swapchain(window const& window)
 
 	auto surface_format = choose_surface_format(swapchain_support_details.formats);
 	auto present_mode = choose_present_mode(swapchain_support_details.present_modes);
-	m_swapchain_extent = choose_surface_extent(swapchain_support_details.capabilities, window.width(), window.height());
+	m_window_extent = { window.width(), window.height() };
+	m_swapchain_extent = choose_surface_extent(swapchain_support_details.capabilities, m_window_extent.width, m_window_extent.height);
 	m_swapchain_image_format = surface_format.format;
 
 	uint32_t image_count = swapchain_support_details.capabilities.minImageCount + 1;
@@ -549,202 +2079,952 @@ bool renderer_vulkan::create_swapchain(window const& window)
 	swapchain_create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	swapchain_create_info.presentMode = present_mode;
 	swapchain_create_info.clipped = VK_TRUE;
-	swapchain_create_info.oldSwapchain = VK_NULL_HANDLE;
+	swapchain_create_info.oldSwapchain = m_swapchain;
 	if (queue_family_indices.graphics != queue_family_indices.present)
 	{
 		swapchain_create_info.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
 		swapchain_create_info.queueFamilyIndexCount = 2;
 		swapchain_create_info.pQueueFamilyIndices = queue_family_indices_array;
 	}
-	else
-		swapchain_create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	else
+		swapchain_create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkSwapchainKHR swapchain;
+	auto result = m_device_functions.vkCreateSwapchainKHR(m_device, &swapchain_create_info, nullptr, &swapchain);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to create swapchain: {}", result) << std::endl;
+		return false;
+	}
+
+	// When recreating, the caller still owns the previous swapchain and destroys it once it is no longer in use.
+	m_swapchain = swapchain;
+
+	m_device_functions.vkGetSwapchainImagesKHR(m_device, m_swapchain, &image_count, nullptr);
+	m_swapchain_images.resize(image_count);
+	m_device_functions.vkGetSwapchainImagesKHR(m_device, m_swapchain, &image_count, m_swapchain_images.data());
+
+	return create_image_views();
+}
+
+bool renderer_vulkan::create_synchronization_objects()
+{
+	VkSemaphoreTypeCreateInfo semaphore_type_create_info{};
+	semaphore_type_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	semaphore_type_create_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+
+	VkSemaphoreCreateInfo semaphore_create_info{};
+	semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphore_create_info.pNext = &semaphore_type_create_info;
+
+	auto result = m_device_functions.vkCreateSemaphore(m_device, &semaphore_create_info, nullptr, &m_frame_timeline);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to create frame timeline semaphore: {}", result) << std::endl;
+		return false;
+	}
+
+	// Acquire and present only take binary semaphores.
+	semaphore_create_info.pNext = nullptr;
+	for (size_t i = 0; i < m_frames.size(); ++i)
+	{
+		auto& frame = m_frames[i];
+		result = m_device_functions.vkCreateSemaphore(m_device, &semaphore_create_info, nullptr, &frame.image_available_semaphore);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create semaphore: {}", result) << std::endl;
+			return false;
+		}
+
+		if (m_present_fences_supported)
+		{
+			frame.present_fence = create_present_fence();
+			if (frame.present_fence == VK_NULL_HANDLE)
+				return false;
+		}
+	}
+
+	// Headless frames are never presented, so nothing waits on a render finished semaphore.
+	if (is_headless())
+		return true;
+
+	m_render_finished_semaphores.resize(m_swapchain_images.size());
+	for (auto& render_finished_semaphore : m_render_finished_semaphores)
+	{
+		auto result = m_device_functions.vkCreateSemaphore(m_device, &semaphore_create_info, nullptr, &render_finished_semaphore);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create semaphore: {}", result) << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+VkFence renderer_vulkan::create_present_fence()
+{
+	VkFenceCreateInfo create_info{};
+	create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	VkFence fence;
+	auto result = m_device_functions.vkCreateFence(m_device, &create_info, nullptr, &fence);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to create present fence: {}", result) << std::endl;
+		return VK_NULL_HANDLE;
+	}
+
+	return fence;
+}
+
+void renderer_vulkan::wait_for_frame_timeline(uint64_t value)
+{
+	VkSemaphoreWaitInfo wait_info{};
+	wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	wait_info.pSemaphores = &m_frame_timeline;
+	wait_info.pValues = &value;
+	wait_info.semaphoreCount = 1;
+	m_device_functions.vkWaitSemaphores(m_device, &wait_info, UINT64_MAX);
+}
+
+bool renderer_vulkan::create_upload_manager()
+{
+	m_upload_manager = upload_manager::create(m_physical_device, m_device, m_device_functions, *m_memory_allocator, m_queues.transfer,
+											  m_queue_families.transfer.value(), m_queue_families.graphics.value());
+	return m_upload_manager != nullptr;
+}
+
+bool renderer_vulkan::create_frame_descriptor_allocator()
+{
+	m_frame_descriptor_allocator = frame_descriptor_allocator::create(m_device, m_device_functions, (uint32_t)m_frames.size());
+	return m_frame_descriptor_allocator != nullptr;
+}
+
+bool renderer_vulkan::create_frame_linear_allocator()
+{
+	m_frame_linear_allocator = frame_linear_allocator::create(m_physical_device, *m_memory_allocator, (uint32_t)m_frames.size());
+	return m_frame_linear_allocator != nullptr;
+}
+
+// Profiling is optional, frames are recorded the same without it.
+void renderer_vulkan::create_gpu_profiler()
+{
+	m_gpu_profiler = gpu_profiler::create(m_physical_device, m_device, m_device_functions, m_queue_families.graphics.value(),
+										  (uint32_t)m_frames.size());
+}
+
+bool renderer_vulkan::create_pipeline_statistics_query()
+{
+	if (!m_pipeline_statistics_supported)
+		return true;
+
+	m_pipeline_statistics_query = pipeline_statistics_query::create(m_device, m_device_functions, (uint32_t)m_frames.size());
+	return m_pipeline_statistics_query != nullptr;
+}
+
+// One graph per frame in flight, so the transient images of a frame are never reused while the GPU works on it.
+void renderer_vulkan::create_render_graphs()
+{
+	if (m_render_path != render_path::dynamic_rendering)
+		return;
+
+	for (size_t i = 0; i < m_frames.size(); ++i)
+		m_render_graphs.push_back(std::make_unique<render_graph>(m_device, m_device_functions, *m_memory_allocator));
+}
+
+renderer_vulkan::queue_family_indices renderer_vulkan::find_queue_families(VkPhysicalDevice physicalDevice)
+{
+	queue_family_indices indices;
+
+	uint32_t queueFamilyCount;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	fixed_vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyProperties.data());
+
+	for (uint32_t i = 0; i < queueFamilyCount; ++i)
+	{
+		auto const& queueFamily = queueFamilyProperties[i];
+		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		{
+			indices.graphics = i;
+
+			// Nothing is ever presented without a surface, so there is no separate present queue to find.
+			if (is_headless())
+				indices.present = i;
+		}
+
+		if (!is_headless())
+		{
+			VkBool32 hasPresentSupport;
+			vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, m_window_surface, &hasPresentSupport);
+
+			if (hasPresentSupport)
+				indices.present = i;
+		}
+
+		if (indices.is_complete())
+			break;
+	}
+
+	// Families without graphics support map to the async compute and copy engines of discrete GPUs, which run
+	// alongside the graphics queue instead of taking turns with it.
+	for (uint32_t i = 0; i < queueFamilyCount; ++i)
+	{
+		auto flags = queueFamilyProperties[i].queueFlags;
+		if (!indices.compute.has_value() && (flags & VK_QUEUE_COMPUTE_BIT) != 0 && (flags & VK_QUEUE_GRAPHICS_BIT) == 0)
+			indices.compute = i;
+
+		if (!indices.transfer.has_value() && (flags & VK_QUEUE_TRANSFER_BIT) != 0 && (flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0)
+			indices.transfer = i;
+	}
+
+	// Compute families implicitly support transfers, so a copy engine is the only thing worth preferring over them.
+	if (!indices.transfer.has_value())
+		indices.transfer = indices.compute;
+
+	if (indices.graphics.has_value())
+	{
+		auto graphics = indices.graphics.value();
+		if (!indices.compute.has_value() && (queueFamilyProperties[graphics].queueFlags & VK_QUEUE_COMPUTE_BIT) != 0)
+			indices.compute = graphics;
+
+		if (!indices.transfer.has_value())
+			indices.transfer = graphics;
+	}
+
+	return indices;
+}
+
+VkPhysicalDevice renderer_vulkan::pick_physical_device()
+{
+	uint32_t deviceCount = 0;
+	vkEnumeratePhysicalDevices(m_instance, &deviceCount, nullptr);
+	fixed_vector<VkPhysicalDevice> devices(deviceCount);
+	vkEnumeratePhysicalDevices(m_instance, &deviceCount, devices.data());
+
+	std::multimap<int, VkPhysicalDevice> candidates;
+	for (uint32_t i = 0; i < deviceCount; ++i)
+		candidates.insert(std::make_pair(rate_device_suitability(devices[i]), devices[i]));
+
+	if (!candidates.empty() && candidates.rbegin()->first > 0)
+		return candidates.rbegin()->second;
+
+	return nullptr;
+}
+
+void renderer_vulkan::begin_render_pass(VkCommandBuffer command_buffer, uint32_t image_index, VkSubpassContents contents)
+{
+	VkClearValue clear_values[2]{};
+	clear_values[0].color = { { 0.f, 0.f, 0.f, 1.f } };
+	clear_values[1].depthStencil = { 1.f, 0 };
+
+	VkRenderPassBeginInfo render_pass_begin_info{};
+	render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	render_pass_begin_info.renderPass = m_render_pass;
+	render_pass_begin_info.framebuffer = m_swapchain_framebuffers[image_index];
+	render_pass_begin_info.renderArea.offset = {};
+	render_pass_begin_info.renderArea.extent = m_swapchain_extent;
+	render_pass_begin_info.pClearValues = clear_values;
+	render_pass_begin_info.clearValueCount = 2;
+
+	m_device_functions.vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, contents);
+}
+
+bool renderer_vulkan::scene_state::operator==(scene_state const& other) const
+{
+	return graphics_pipeline == other.graphics_pipeline && mesh_pipeline == other.mesh_pipeline &&
+		   culled_mesh_pipeline == other.culled_mesh_pipeline && color_format == other.color_format &&
+		   extent.width == other.extent.width && extent.height == other.extent.height &&
+		   std::memcmp(&view_projection, &other.view_projection, sizeof(view_projection)) == 0 && draw_mode == other.draw_mode &&
+		   batch_count == other.batch_count && drawable_batch_count == other.drawable_batch_count;
+}
+
+renderer_vulkan::scene_state renderer_vulkan::current_scene_state() const
+{
+	scene_state state;
+	state.graphics_pipeline = m_graphics_pipeline;
+	state.mesh_pipeline = m_mesh_pipeline;
+	state.culled_mesh_pipeline = m_culled_mesh_pipeline;
+	state.color_format = m_swapchain_image_format;
+	state.extent = m_swapchain_extent;
+	state.view_projection = m_view_projection;
+	state.draw_mode = m_mesh_draw_mode;
+	state.batch_count = (uint32_t)m_instance_batches.size();
+	for (auto const& batch : m_instance_batches)
+	{
+		if (is_drawable(batch))
+			++state.drawable_batch_count;
+	}
+
+	return state;
+}
+
+bool renderer_vulkan::is_drawable(mesh_instance_batch const& batch) const
+{
+	return m_upload_manager->is_complete(m_meshes[batch.mesh].upload) && m_upload_manager->is_complete(batch.upload);
+}
+
+int renderer_vulkan::rate_device_suitability(VkPhysicalDevice physicalDevice)
+{
+	// Start above zero so devices without any bonus (e.g. software rasterizers used headless) remain usable.
+	int score = 1;
+
+	VkPhysicalDeviceProperties properties;
+	VkPhysicalDeviceFeatures features;
+
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+
+	if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+		score += 1000;
+
+	if (!is_headless())
+	{
+		if (!check_device_extension_support(physicalDevice, REQUIRED_DEVICE_EXTENSION_NAMES))
+			return false;
+
+		auto swapchain_support_details = get_swapchain_support_details(physicalDevice, m_window_surface);
+		if (swapchain_support_details.formats.empty() || swapchain_support_details.present_modes.empty())
+			return false;
+
+		auto format = choose_surface_format(swapchain_support_details.formats);
+		if (format.format == VK_FORMAT_B8G8R8A8_SRGB)
+			score += 50;
+
+		if (format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+			score += 50;
+
+		auto present_mode = choose_present_mode(swapchain_support_details.present_modes);
+		if (present_mode == VK_PRESENT_MODE_MAILBOX_KHR)
+			score += 100;
+	}
+
+	auto queueFamilyIndices = find_queue_families(physicalDevice);
+	if (!queueFamilyIndices.is_complete())
+		return false;
+
+	return score;
+}
+
+bool renderer_vulkan::record_command_buffer(VkCommandBuffer command_buffer, uint32_t image_index)
+{
+	VkCommandBufferBeginInfo command_buffer_begin_info{};
+	command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+	auto result = m_device_functions.vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to begin recording command buffer: {}", result) << std::endl;
+		return false;
+	}
+
+	// The timestamps of the frame that last used this index are read back here, its timeline value has been reached.
+	if (m_gpu_profiler != nullptr)
+		m_gpu_profiler->begin_frame(m_current_frame, command_buffer);
+
+	if (m_pipeline_statistics_query != nullptr)
+		m_pipeline_statistics_query->begin_frame(m_current_frame, command_buffer);
+
+	// Uploads queued since the previous frame go out first, finished ones are handed over to the graphics queue and
+	// can be used from the next frame on.
+	m_upload_manager->flush();
+	m_upload_manager->record_pending_barriers(command_buffer);
+
+	if (m_render_path == render_path::render_pass && !record_culling(command_buffer))
+		return false;
+
+	if (m_scene_command_reuse && !record_scene_command_buffers())
+		return false;
+
+	if (m_render_path == render_path::render_pass)
+	{
+		auto region = m_gpu_profiler != nullptr ? m_gpu_profiler->begin_region(command_buffer, "scene") : 0;
+		if (m_pipeline_statistics_query != nullptr)
+			m_pipeline_statistics_query->begin(command_buffer);
+
+		if (m_scene_command_reuse)
+		{
+			auto& scene_command_buffers = m_frames[m_current_frame].scene_command_buffers;
+			begin_render_pass(command_buffer, image_index, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+			m_device_functions.vkCmdExecuteCommands(command_buffer, (uint32_t)scene_command_buffers.size(), scene_command_buffers.data());
+		}
+		else
+		{
+			begin_render_pass(command_buffer, image_index, VK_SUBPASS_CONTENTS_INLINE);
+			record_scene(command_buffer, 0, (uint32_t)m_instance_batches.size());
+		}
+		m_device_functions.vkCmdEndRenderPass(command_buffer);
+
+		if (m_pipeline_statistics_query != nullptr)
+			m_pipeline_statistics_query->end(command_buffer);
+		if (m_gpu_profiler != nullptr)
+			m_gpu_profiler->end_region(command_buffer, region);
+	}
+	else if (!record_render_graph(command_buffer, image_index))
+		return false;
+
+	if (m_gpu_profiler != nullptr)
+		m_gpu_profiler->end_frame(command_buffer);
+
+	result = m_device_functions.vkEndCommandBuffer(command_buffer);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to end recording command buffer: {}", result) << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// Presents the image with undefined contents, for when recording its frame failed after it was acquired. The
+// barrier waits at the stage the acquire semaphore is waited on, so the transition happens after the acquire.
+bool renderer_vulkan::record_present_transition(VkCommandBuffer command_buffer, uint32_t image_index)
+{
+	VkCommandBufferBeginInfo command_buffer_begin_info{};
+	command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	auto result = m_device_functions.vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
+	if (result != VK_SUCCESS)
+	{
+		std::cerr << std::format("Failed to begin recording present transition: {}", result) << std::endl;
+		return false;
+	}
 
-	auto result = m_device_functions.vkCreateSwapchainKHR(m_device, &swapchain_create_info, nullptr, &m_swapchain);
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = m_swapchain_images[image_index];
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.layerCount = 1;
+	m_device_functions.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+											0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	result = m_device_functions.vkEndCommandBuffer(command_buffer);
 	if (result != VK_SUCCESS)
 	{
-		std::cerr << std::format("Failed to create swapchain: {}", result) << std::endl;
+		std::cerr << std::format("Failed to end recording present transition: {}", result) << std::endl;
 		return false;
 	}
 
-	m_device_functions.vkGetSwapchainImagesKHR(m_device, m_swapchain, &image_count, nullptr);
-	m_swapchain_images.resize(image_count);
-	m_device_functions.vkGetSwapchainImagesKHR(m_device, m_swapchain, &image_count, m_swapchain_images.data());
+	return true;
+}
 
-	m_swapchain_image_views.resize(image_count);
-	VkImageViewCreateInfo image_view_create_info{};
-	image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	image_view_create_info.format = m_swapchain_image_format;
-	image_view_create_info.components = { VK_COMPONENT_SWIZZLE_IDENTITY };
-	image_view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	image_view_create_info.subresourceRange.levelCount = 1;
-	image_view_create_info.subresourceRange.layerCount = 1;
-	for (size_t i = 0; i < m_swapchain_images.size(); ++i)
+// GPU culling clears the draw counts and writes the draw commands in passes of its own, so the graph places the
+// barriers between the clears, the dispatches and the indirect draws. The final layout of the frame's image is the
+// one the render pass path leaves it in.
+bool renderer_vulkan::record_render_graph(VkCommandBuffer command_buffer, uint32_t image_index)
+{
+	auto& graph = *m_render_graphs[m_current_frame];
+	graph.reset();
+
+	auto final_layout = is_headless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	auto target = graph.import_image(m_swapchain_images[image_index], m_swapchain_image_views[image_index], m_swapchain_image_format,
+									 m_swapchain_extent, VK_IMAGE_LAYOUT_UNDEFINED, final_layout);
+
+	vector<render_graph::resource> indirect_buffers;
+	vector<render_graph::resource> visible_instance_buffers;
+	if (is_culling_enabled())
 	{
-		image_view_create_info.image = m_swapchain_images[i];
-		result = m_device_functions.vkCreateImageView(m_device, &image_view_create_info, nullptr,
-													  &m_swapchain_image_views[i]);
-		if (result != VK_SUCCESS)
-		{
-			std::cerr << std::format("Failed to create image view: {}", result) << std::endl;
+		auto frame_set = write_culling_frame_constants();
+		if (frame_set == VK_NULL_HANDLE)
 			return false;
+
+		auto resets = graph.add_pass("reset draw commands", [this](VkCommandBuffer pass_command_buffer) {
+			record_draw_command_resets(pass_command_buffer);
+		});
+		auto culling = graph.add_pass("culling", [this, frame_set](VkCommandBuffer pass_command_buffer) {
+			record_culling_dispatches(pass_command_buffer, frame_set);
+		});
+
+		for (auto const& batch : m_instance_batches)
+		{
+			if (!is_drawable(batch))
+				continue;
+
+			auto draw_commands = graph.import_buffer(batch.draw_command_buffer);
+			auto visible_instances = graph.import_buffer(batch.visible_instance_buffer);
+			graph.write(resets, draw_commands, render_graph::access::transfer_write);
+			graph.write(culling, draw_commands, render_graph::access::storage_write);
+			graph.write(culling, visible_instances, render_graph::access::storage_write);
+			indirect_buffers.push_back(draw_commands);
+			visible_instance_buffers.push_back(visible_instances);
 		}
 	}
 
+	render_graph::pass scene;
+	if (m_scene_command_reuse)
+	{
+		scene = graph.add_pass("scene", [this](VkCommandBuffer pass_command_buffer) {
+			auto& scene_command_buffers = m_frames[m_current_frame].scene_command_buffers;
+			m_device_functions.vkCmdExecuteCommands(pass_command_buffer, (uint32_t)scene_command_buffers.size(), scene_command_buffers.data());
+		});
+		graph.use_secondary_command_buffers(scene);
+	}
+	else
+		scene = graph.add_pass("scene", [this](VkCommandBuffer pass_command_buffer) {
+			record_scene(pass_command_buffer, 0, (uint32_t)m_instance_batches.size());
+		});
+	graph.set_color_attachment(scene, target, VK_ATTACHMENT_LOAD_OP_CLEAR, { { 0.f, 0.f, 0.f, 1.f } });
+	graph.set_depth_attachment(scene, graph.create_image({ DEPTH_FORMAT, m_swapchain_extent }), VK_ATTACHMENT_LOAD_OP_CLEAR);
+	for (auto buffer : indirect_buffers)
+		graph.read(scene, buffer, render_graph::access::indirect_read);
+	for (auto buffer : visible_instance_buffers)
+		graph.read(scene, buffer, render_graph::access::storage_read);
+
+	if (!graph.compile())
+		return false;
+
+	// The statistics cover every pass of the graph, they only count draws anyway.
+	if (m_pipeline_statistics_query != nullptr)
+		m_pipeline_statistics_query->begin(command_buffer);
+
+	graph.execute(command_buffer, m_gpu_profiler.get());
+
+	if (m_pipeline_statistics_query != nullptr)
+		m_pipeline_statistics_query->end(command_buffer);
 	return true;
 }
 
-bool renderer_vulkan::create_synchronization_objects()
+// Sets all state it draws with, so any range of batches can be recorded into a command buffer of its own.
+void renderer_vulkan::record_scene(VkCommandBuffer command_buffer, uint32_t first_batch, uint32_t batch_count)
 {
-	VkSemaphoreCreateInfo semaphore_create_info{};
-	semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	m_device_functions.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics_pipeline);
 
-	auto result = m_device_functions.vkCreateSemaphore(m_device, &semaphore_create_info, nullptr, &m_image_available_semaphore);
-	if (result != VK_SUCCESS)
-	{
-		std::cerr << std::format("Failed to create semaphore: {}", result) << std::endl;
-		return false;
-	}
+	VkViewport viewport{};
+	viewport.width = (float)m_swapchain_extent.width;
+	viewport.height = (float)m_swapchain_extent.height;
+	viewport.maxDepth = 1.f;
+	m_device_functions.vkCmdSetViewport(command_buffer, 0, 1, &viewport);
 
-	result = m_device_functions.vkCreateSemaphore(m_device, &semaphore_create_info, nullptr, &m_render_finished_semaphore);
-	if (result != VK_SUCCESS)
-	{
-		std::cerr << std::format("Failed to create semaphore: {}", result) << std::endl;
+	VkRect2D scissor{};
+	scissor.extent = m_swapchain_extent;
+	m_device_functions.vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+	// The triangle stays as the placeholder scene until meshes are added.
+	if (m_instance_batches.empty())
+		m_device_functions.vkCmdDraw(command_buffer, 3, 1, 0, 0);
+	else
+		record_mesh_draws(command_buffer, first_batch, batch_count);
+}
+
+// Only records the scene's draws again when something they depend on changed since this frame index last recorded
+// them, a static scene is not recorded at all. Its frame has finished, so its command buffers aren't in use anymore
+// and its pools can be reset. The batches are split into contiguous ranges, one per secondary command buffer, so
+// executing them in order draws in the same order as recording inline does.
+bool renderer_vulkan::record_scene_command_buffers()
+{
+	auto& frame = m_frames[m_current_frame];
+	auto state = current_scene_state();
+	if (frame.scene_recorded && frame.recorded_scene == state)
+		return true;
+
+	VkCommandBufferInheritanceRenderingInfo rendering_inheritance_info{};
+	rendering_inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+	rendering_inheritance_info.pColorAttachmentFormats = &m_swapchain_image_format;
+	rendering_inheritance_info.colorAttachmentCount = 1;
+	rendering_inheritance_info.depthAttachmentFormat = DEPTH_FORMAT;
+	rendering_inheritance_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	// The framebuffer is left out, so one recording works for every swapchain image.
+	VkCommandBufferInheritanceInfo inheritance_info{};
+	inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	if (m_render_path == render_path::render_pass)
+		inheritance_info.renderPass = m_render_pass;
+	else
+		inheritance_info.pNext = &rendering_inheritance_info;
+	if (m_pipeline_statistics_query != nullptr)
+		inheritance_info.pipelineStatistics = pipeline_statistics_query::STATISTIC_FLAGS;
+
+	auto batch_count = (uint32_t)m_instance_batches.size();
+	auto task_count = clamp((batch_count + SCENE_BATCHES_PER_TASK - 1) / SCENE_BATCHES_PER_TASK, 1u, m_command_recorder->thread_count());
+	auto batches_per_task = (batch_count + task_count - 1) / task_count;
+	if (batches_per_task > 0)
+		task_count = (batch_count + batches_per_task - 1) / batches_per_task;
+
+	frame.scene_recorded = false;
+	m_command_recorder->begin_frame(m_current_frame);
+
+	// Recording only reads the scene, nothing changes it until all tasks are done.
+	bool recorded = m_command_recorder->record(
+		inheritance_info, VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT, task_count,
+		[&](VkCommandBuffer command_buffer, uint32_t task) {
+			auto first_batch = task * batches_per_task;
+			record_scene(command_buffer, first_batch, std::min(batches_per_task, batch_count - first_batch));
+		},
+		frame.scene_command_buffers);
+	if (!recorded)
 		return false;
-	}
 
-	VkFenceCreateInfo fence_create_info{};
-	fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	frame.recorded_scene = state;
+	frame.scene_recorded = true;
+	return true;
+}
 
-	result = m_device_functions.vkCreateFence(m_device, &fence_create_info, nullptr, &m_in_flight_fence);
-	if (result != VK_SUCCESS)
-	{
-		std::cerr << std::format("Failed to create fence: {}", result) << std::endl;
+// The render pass path has no graph, so it synchronizes the culling output itself.
+bool renderer_vulkan::record_culling(VkCommandBuffer command_buffer)
+{
+	if (!is_culling_enabled())
+		return true;
+
+	auto frame_set = write_culling_frame_constants();
+	if (frame_set == VK_NULL_HANDLE)
 		return false;
-	}
 
+	auto region = m_gpu_profiler != nullptr ? m_gpu_profiler->begin_region(command_buffer, "culling") : 0;
+
+	record_draw_command_resets(command_buffer);
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	m_device_functions.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+											1, &barrier, 0, nullptr, 0, nullptr);
+
+	record_culling_dispatches(command_buffer, frame_set);
+
+	// The draws read the instance count as an indirect command and the visible instances in the vertex shader.
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	m_device_functions.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+											VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &barrier, 0,
+											nullptr, 0, nullptr);
+
+	if (m_gpu_profiler != nullptr)
+		m_gpu_profiler->end_region(command_buffer, region);
 	return true;
 }
 
-renderer_vulkan::queue_family_indices renderer_vulkan::find_queue_families(VkPhysicalDevice physicalDevice)
+bool renderer_vulkan::is_culling_enabled() const
 {
-	queue_family_indices indices;
+	if (m_mesh_draw_mode != mesh_draw_mode::gpu_driven || m_culling_pipeline == VK_NULL_HANDLE)
+		return false;
 
-	uint32_t queueFamilyCount;
-	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
-	fixed_vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
-	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyProperties.data());
+	for (auto const& batch : m_instance_batches)
+	{
+		if (is_drawable(batch))
+			return true;
+	}
 
-	for (uint32_t i = 0; i < queueFamilyCount; ++i)
+	return false;
+}
+
+// The frustum and this frame's draw command index are the same for every batch, so they go in a uniform buffer that is
+// written once. Both it and its set only live until this frame index begins again.
+VkDescriptorSet renderer_vulkan::write_culling_frame_constants()
+{
+	culling_frame_constants frame_constants;
+	extract_frustum_planes(m_view_projection, frame_constants.frustum_planes);
+	frame_constants.draw_command_index = m_current_frame;
+
+	auto constants_allocation = m_frame_linear_allocator->write(frame_constants);
+	auto frame_set = m_frame_descriptor_allocator->allocate(m_culling_frame_set_layout);
+	if (!constants_allocation.is_valid() || frame_set == VK_NULL_HANDLE)
 	{
-		auto const& queueFamily = queueFamilyProperties[i];
-		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
-			indices.graphics = i;
+		std::cerr << "Failed to allocate the culling constants of the frame" << std::endl;
+		return VK_NULL_HANDLE;
+	}
 
-		VkBool32 hasPresentSupport;
-		vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, m_window_surface, &hasPresentSupport);
+	VkDescriptorBufferInfo constants_info{ constants_allocation.buffer, constants_allocation.offset, sizeof(frame_constants) };
 
-		if (hasPresentSupport)
-			indices.present = i;
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = frame_set;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	write.pBufferInfo = &constants_info;
+	m_device_functions.vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+	return frame_set;
+}
 
-		if (indices.is_complete())
-			break;
+// Each frame in flight has its own draw command in every batch, so this never resets a command a previous frame may
+// still be drawing with. Culling counts the visible instances into its instance count.
+void renderer_vulkan::record_draw_command_resets(VkCommandBuffer command_buffer)
+{
+	for (auto const& batch : m_instance_batches)
+	{
+		if (!is_drawable(batch))
+			continue;
+
+		VkDrawIndexedIndirectCommand command{ m_meshes[batch.mesh].index_count, 0, 0, 0, 0 };
+		m_device_functions.vkCmdUpdateBuffer(command_buffer, batch.draw_command_buffer, m_current_frame * sizeof(command), sizeof(command),
+											 &command);
 	}
+}
 
-	return indices;
+// Each frame in flight has its own range of visible instances in every batch, so culling never overwrites indices a
+// previous frame may still be drawing.
+void renderer_vulkan::record_culling_dispatches(VkCommandBuffer command_buffer, VkDescriptorSet frame_set)
+{
+	m_device_functions.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_culling_pipeline);
+	m_device_functions.vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_culling_pipeline_layout, 1, 1, &frame_set, 0,
+											   nullptr);
+
+	culling_constants constants;
+
+	for (auto const& batch : m_instance_batches)
+	{
+		if (!is_drawable(batch))
+			continue;
+
+		auto const& mesh = m_meshes[batch.mesh];
+		constants.bounding_sphere[0] = mesh.bounds_center.x;
+		constants.bounding_sphere[1] = mesh.bounds_center.y;
+		constants.bounding_sphere[2] = mesh.bounds_center.z;
+		constants.bounding_sphere[3] = mesh.bounds_radius;
+		constants.instance_count = batch.instance_count;
+		constants.first_visible_instance = m_current_frame * batch.instance_count;
+
+		m_device_functions.vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_culling_pipeline_layout, 0, 1,
+												   &batch.culling_descriptor_set, 0, nullptr);
+		m_device_functions.vkCmdPushConstants(command_buffer, m_culling_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+											  sizeof(constants), &constants);
+		m_device_functions.vkCmdDispatch(command_buffer, (batch.instance_count + 63) / 64, 1, 1);
+	}
 }
 
-VkPhysicalDevice renderer_vulkan::pick_physical_device()
+void renderer_vulkan::record_mesh_draws(VkCommandBuffer command_buffer, uint32_t first_batch, uint32_t batch_count)
 {
-	uint32_t deviceCount = 0;
-	vkEnumeratePhysicalDevices(m_instance, &deviceCount, nullptr);
-	fixed_vector<VkPhysicalDevice> devices(deviceCount);
-	vkEnumeratePhysicalDevices(m_instance, &deviceCount, devices.data());
+	auto draw_mode = m_mesh_draw_mode;
+	if (draw_mode == mesh_draw_mode::gpu_driven && m_culling_pipeline == VK_NULL_HANDLE)
+		draw_mode = mesh_draw_mode::instanced;
+
+	auto pipeline = draw_mode == mesh_draw_mode::gpu_driven ? m_culled_mesh_pipeline : m_mesh_pipeline;
+	m_device_functions.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	if (m_bindless_heap != nullptr)
+		m_bindless_heap->bind(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout);
+
+	// Without the bindless heap, the triangle fragment shader has no push constants.
+	auto push_constant_stages = m_pipeline_layouts->push_constant_range(m_pipeline_layout).stageFlags;
+	mesh_constants constants{};
+	constants.view_projection = m_view_projection;
+	constants.material_buffer = m_material_buffer_index;
+	m_device_functions.vkCmdPushConstants(command_buffer, m_pipeline_layout, push_constant_stages, 0, sizeof(constants), &constants);
+
+	for (auto batch_index = first_batch; batch_index < first_batch + batch_count; ++batch_index)
+	{
+		auto const& batch = m_instance_batches[batch_index];
+		if (!is_drawable(batch))
+			continue;
 
-	std::multimap<int, VkPhysicalDevice> candidates;
-	for (uint32_t i = 0; i < deviceCount; ++i)
-		candidates.insert(std::make_pair(rate_device_suitability(devices[i]), devices[i]));
+		auto const& mesh = m_meshes[batch.mesh];
+		m_device_functions.vkCmdBindIndexBuffer(command_buffer, mesh.index_buffer, 0, VK_INDEX_TYPE_UINT32);
 
-	if (candidates.rbegin()->first > 0)
-		return candidates.rbegin()->second;
+		// Culling wrote the number of visible instances into this frame's draw command and their indices into this
+		// frame's range, which the vertex shader reads the instances through.
+		if (draw_mode == mesh_draw_mode::gpu_driven)
+		{
+			VkDeviceSize offset = 0;
+			m_device_functions.vkCmdBindVertexBuffers(command_buffer, 0, 1, &mesh.vertex_buffer, &offset);
+
+			culled_mesh_constants batch_constants{ batch.instance_buffer_index, batch.visible_instance_buffer_index,
+												   m_current_frame * batch.instance_count };
+			m_device_functions.vkCmdPushConstants(command_buffer, m_pipeline_layout, push_constant_stages, sizeof(constants),
+												  sizeof(batch_constants), &batch_constants);
+			m_device_functions.vkCmdDrawIndexedIndirect(command_buffer, batch.draw_command_buffer,
+														m_current_frame * sizeof(VkDrawIndexedIndirectCommand), 1,
+														sizeof(VkDrawIndexedIndirectCommand));
+			continue;
+		}
 
-	return nullptr;
+		VkBuffer vertex_buffers[]{ mesh.vertex_buffer, batch.instance_buffer };
+		VkDeviceSize offsets[]{ 0, 0 };
+		m_device_functions.vkCmdBindVertexBuffers(command_buffer, 0, 2, vertex_buffers, offsets);
+
+		if (draw_mode == mesh_draw_mode::instanced)
+			m_device_functions.vkCmdDrawIndexed(command_buffer, mesh.index_count, batch.instance_count, 0, 0, 0);
+		else
+		{
+			for (uint32_t i = 0; i < batch.instance_count; ++i)
+				m_device_functions.vkCmdDrawIndexed(command_buffer, mesh.index_count, 1, 0, 0, i);
+		}
+	}
 }
 
-int renderer_vulkan::rate_device_suitability(VkPhysicalDevice physicalDevice)
+// New pipelines are compiled while the GPU keeps drawing with the old ones, which are only destroyed once the
+// frames in flight are done with them. A shader that fails to compile, or that no longer fits the layout its
+// pipelines were created with, leaves them as they were.
+void renderer_vulkan::reload_changed_shaders()
 {
-	int score = 0;
+	std::vector<std::string> changed_shaders;
+	m_shader_reloader->poll(changed_shaders);
+	if (changed_shaders.empty())
+		return;
 
-	VkPhysicalDeviceProperties properties;
-	VkPhysicalDeviceFeatures features;
+	for (auto const& shader : changed_shaders)
+	{
+		std::cout << std::format("Reloading pipelines using {}", shader) << std::endl;
 
-	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
-	vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+		for (auto& [description, compiled] : m_graphics_pipelines)
+		{
+			if (description.vertex_shader != shader && description.fragment_shader != shader)
+				continue;
+
+			// Resources or push constants that don't fit the layout would need every user of the pipeline to bind
+			// them differently, which takes a restart. A pipeline without a layout of its own keeps the one its
+			// shaders first declared.
+			auto reloaded_description = description;
+			reloaded_description.layout = compiled.layout;
+			VkPipelineLayout layout;
+			auto new_pipeline = compile_graphics_pipeline(reloaded_description, layout);
+			if (new_pipeline == VK_NULL_HANDLE)
+			{
+				std::cerr << std::format("Kept the previous pipeline of {} and {}", description.vertex_shader, description.fragment_shader)
+						  << std::endl;
+				continue;
+			}
 
-	if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
-		score += 1000;
+			auto pipeline = compiled.pipeline;
+			if (m_graphics_pipeline == pipeline)
+				m_graphics_pipeline = new_pipeline;
+			if (m_mesh_pipeline == pipeline)
+				m_mesh_pipeline = new_pipeline;
+			if (m_culled_mesh_pipeline == pipeline)
+				m_culled_mesh_pipeline = new_pipeline;
+
+			retire_pipeline(pipeline);
+			compiled.pipeline = new_pipeline;
+		}
+
+		if (shader == CULLING_SHADER && m_culling_pipeline != VK_NULL_HANDLE)
+		{
+			auto new_pipeline = compile_culling_pipeline();
+			if (new_pipeline != VK_NULL_HANDLE)
+			{
+				retire_pipeline(m_culling_pipeline);
+				m_culling_pipeline = new_pipeline;
+			}
+		}
+	}
+}
+
+// Frames that were submitted may still use the pipeline, the one being recorded won't. The recorded scene command
+// buffers may use it too, and once it is destroyed a new pipeline can get the same handle, so they are recorded again.
+void renderer_vulkan::retire_pipeline(VkPipeline pipeline)
+{
+	m_deletion_queue->destroy_pipeline(pipeline, m_frame_timeline_value);
+	for (auto& frame : m_frames)
+		frame.scene_recorded = false;
+}
 
-	if (!check_device_extension_support(physicalDevice, REQUIRED_DEVICE_EXTENSION_NAMES))
+bool renderer_vulkan::recreate_swapchain()
+{
+	if (m_window->width() == 0 || m_window->height() == 0)
 		return false;
 
-	auto swapchain_support_details = get_swapchain_support_details(physicalDevice, m_window_surface);
-	if (swapchain_support_details.formats.empty() || swapchain_support_details.present_modes.empty())
+	// Only frames still in flight can reference the current swapchain, image views and framebuffers. They are
+	// destroyed once those frames are done, so nothing waits for the GPU and nothing that does not depend on the
+	// swapchain is rebuilt.
+	auto old_swapchain = m_swapchain;
+	auto old_image_format = m_swapchain_image_format;
+	vector<VkImageView> old_image_views(m_swapchain_image_views);
+	vector<VkFramebuffer> old_framebuffers(m_swapchain_framebuffers);
+	auto old_depth_image = m_depth_image;
+	auto old_depth_image_view = m_depth_image_view;
+	auto old_depth_allocation = m_depth_allocation;
+
+	bool succeeded = create_swapchain(*m_window);
+	if (m_swapchain == old_swapchain)
 		return false;
 
-	auto format = choose_surface_format(swapchain_support_details.formats);
-	if (format.format == VK_FORMAT_B8G8R8A8_SRGB)
-		score += 50;
+	// A different surface format makes the render pass, and with it the pipeline, incompatible. Dynamic rendering
+	// only has to rebuild the pipelines, which were created for the old format.
+	if (succeeded && m_swapchain_image_format != old_image_format)
+	{
+		for (auto& [description, compiled] : m_graphics_pipelines)
+			retire_pipeline(compiled.pipeline);
 
-	if (format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
-		score += 50;
+		m_graphics_pipelines.clear();
+		m_graphics_pipeline = VK_NULL_HANDLE;
+		m_mesh_pipeline = VK_NULL_HANDLE;
+		m_culled_mesh_pipeline = VK_NULL_HANDLE;
 
-	auto present_mode = choose_present_mode(swapchain_support_details.present_modes);
-	if (present_mode == VK_PRESENT_MODE_MAILBOX_KHR)
-		score += 100;
+		m_deletion_queue->destroy_render_pass(m_render_pass, m_frame_timeline_value);
+		m_render_pass = VK_NULL_HANDLE;
 
-	auto queueFamilyIndices = find_queue_families(physicalDevice);
-	if (!queueFamilyIndices.is_complete())
-		return false;
+		succeeded = create_render_pass() && create_graphics_pipeline();
+	}
 
-	return score;
-}
+	m_depth_image = VK_NULL_HANDLE;
+	m_depth_image_view = VK_NULL_HANDLE;
+	m_depth_allocation = {};
+	succeeded = succeeded && create_depth_image() && create_framebuffers();
 
-bool renderer_vulkan::record_command_buffer(VkCommandBuffer command_buffer, uint32_t image_index)
-{
-	VkCommandBufferBeginInfo command_buffer_begin_info{};
-	command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	for (auto& framebuffer : old_framebuffers)
+		m_deletion_queue->destroy_framebuffer(framebuffer, m_frame_timeline_value);
 
-	auto result = m_device_functions.vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
-	if (result != VK_SUCCESS)
+	for (auto& image_view : old_image_views)
+		m_deletion_queue->destroy_image_view(image_view, m_frame_timeline_value);
+
+	m_deletion_queue->destroy_image_view(old_depth_image_view, m_frame_timeline_value);
+	m_deletion_queue->destroy_image(old_depth_image, old_depth_allocation, m_frame_timeline_value);
+
+	// Presents of a queue finish in order, so the fence of the last present to the old swapchain tells when all of
+	// them are done, and that frame gets a new fence. Without present fences nothing does, so the old swapchain
+	// also waits for the frames in flight after it. By then they have each acquired an image of the new swapchain,
+	// which in practice the presentation engine only hands out after it let go of the old one.
+	VkFence last_present_fence = VK_NULL_HANDLE;
+	auto last_use = m_frame_timeline_value + m_frames.size();
+	auto& last_frame = m_frames[m_last_rendered_frame];
+	if (last_frame.present_pending)
 	{
-		std::cerr << std::format("Failed to begin recording command buffer: {}", result) << std::endl;
+		if (auto present_fence = create_present_fence(); present_fence != VK_NULL_HANDLE)
+		{
+			last_present_fence = std::exchange(last_frame.present_fence, present_fence);
+			last_frame.present_pending = false;
+			last_use = m_frame_timeline_value;
+		}
+	}
+	m_deletion_queue->destroy_swapchain(old_swapchain, last_present_fence, last_use);
+
+	if (!succeeded)
 		return false;
+
+	// The new swapchain may have more images, each of which needs its own render finished semaphore.
+	auto render_finished_semaphore_count = m_render_finished_semaphores.size();
+	if (m_swapchain_images.size() > render_finished_semaphore_count)
+	{
+		VkSemaphoreCreateInfo semaphore_create_info{};
+		semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		m_render_finished_semaphores.resize(m_swapchain_images.size());
+		for (auto i = render_finished_semaphore_count; i < m_render_finished_semaphores.size(); ++i)
+		{
+			auto result = m_device_functions.vkCreateSemaphore(m_device, &semaphore_create_info, nullptr, &m_render_finished_semaphores[i]);
+			if (result != VK_SUCCESS)
+			{
+				std::cerr << std::format("Failed to create semaphore: {}", result) << std::endl;
+				m_render_finished_semaphores.resize(i);
+				return false;
+			}
+		}
 	}
 
-	VkClearValue clear_color{ 0.f, 0.f, 0.f, 1.f };
-	VkRenderPassBeginInfo render_pass_begin_info{};
-	render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	render_pass_begin_info.renderPass = m_render_pass;
-	render_pass_begin_info.framebuffer = m_swapchain_framebuffers[image_index];
-	render_pass_begin_info.renderArea.offset = {};
-	render_pass_begin_info.renderArea.extent = m_swapchain_extent;
-	render_pass_begin_info.pClearValues = &clear_color;
-	render_pass_begin_info.clearValueCount = 1;
+	return true;
+}
 
-	m_device_functions.vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-	m_device_functions.vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics_pipeline);
-	m_device_functions.vkCmdDraw(command_buffer, 3, 1, 0, 0);
-	m_device_functions.vkCmdEndRenderPass(command_buffer);
+void renderer_vulkan::save_pipeline_cache()
+{
+	size_t size = 0;
+	auto result = m_device_functions.vkGetPipelineCacheData(m_device, m_pipeline_cache, &size, nullptr);
+	if (result != VK_SUCCESS || size == 0)
+		return;
 
-	result = m_device_functions.vkEndCommandBuffer(command_buffer);
+	fixed_vector<char> data(size);
+	result = m_device_functions.vkGetPipelineCacheData(m_device, m_pipeline_cache, &size, data.data());
 	if (result != VK_SUCCESS)
 	{
-		std::cerr << std::format("Failed to end recording command buffer: {}", result) << std::endl;
-		return false;
+		std::cerr << std::format("Failed to get pipeline cache data: {}", result) << std::endl;
+		return;
 	}
 
-	return true;
+	write_entire_file(PIPELINE_CACHE_PATH, data.data(), size, io::file_mode::binary);
 }
 
 bool check_device_extension_support(VkPhysicalDevice physicalDevice, fixed_vector<char const*> const& extensionNames)
@@ -773,6 +3053,33 @@ bool check_device_extension_support(VkPhysicalDevice physicalDevice, fixed_vecto
 	return true;
 }
 
+// Like check_device_extension_support, for instance extensions that are only enabled when they are there.
+bool check_instance_extension_support(fixed_vector<char const*> const& extensionNames)
+{
+	uint32_t extensionCount = 0;
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+	fixed_vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, availableExtensions.data());
+
+	for (int i = 0; i < extensionNames.size(); ++i)
+	{
+		bool extensionFound = false;
+		for (int j = 0; j < availableExtensions.size(); ++j)
+		{
+			if (std::strcmp(extensionNames[i], availableExtensions[j].extensionName) == 0)
+			{
+				extensionFound = true;
+				break;
+			}
+		}
+
+		if (!extensionFound)
+			return false;
+	}
+
+	return true;
+}
+
 bool check_extension_support(fixed_vector<char const*>& extensionNames)
 {
 	uint32_t extensionCount = 0;
@@ -833,6 +3140,47 @@ bool check_layer_support(fixed_vector<char const*>& layerNames)
 	return true;
 }
 
+bool check_pipeline_cache_compatibility(fixed_vector<char> const& data, VkPhysicalDeviceProperties const& properties)
+{
+	// Read field by field, the file contents come from disk and may be truncated or not aligned for the struct.
+	VkPipelineCacheHeaderVersionOne header;
+	constexpr size_t header_size = sizeof(uint32_t) * 4 + VK_UUID_SIZE;
+	if (data.size() < header_size)
+		return false;
+
+	auto const* bytes = data.data();
+	std::memcpy(&header.headerSize, bytes, sizeof(uint32_t));
+	std::memcpy(&header.headerVersion, bytes + 4, sizeof(uint32_t));
+	std::memcpy(&header.vendorID, bytes + 8, sizeof(uint32_t));
+	std::memcpy(&header.deviceID, bytes + 12, sizeof(uint32_t));
+	std::memcpy(header.pipelineCacheUUID, bytes + 16, VK_UUID_SIZE);
+
+	return header.headerSize >= header_size && header.headerSize <= data.size() &&
+		   header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		   header.vendorID == properties.vendorID &&
+		   header.deviceID == properties.deviceID &&
+		   std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+// Every input of the vertex shader has to be fed by an attribute of the same format.
+bool check_vertex_inputs(vertex_layout layout, shader_reflection const& vertex_shader)
+{
+	for (auto const& input : vertex_shader.vertex_inputs)
+	{
+		if (layout == vertex_layout::none)
+			return false;
+
+		auto attributes_end = layout == vertex_layout::mesh ? std::end(MESH_VERTEX_ATTRIBUTES)
+															: std::begin(MESH_VERTEX_ATTRIBUTES) + PER_VERTEX_ATTRIBUTE_COUNT;
+		auto attribute = std::find_if(std::begin(MESH_VERTEX_ATTRIBUTES), attributes_end,
+									  [&](VkVertexInputAttributeDescription const& other) { return other.location == input.location; });
+		if (attribute == attributes_end || attribute->format != input.format)
+			return false;
+	}
+
+	return true;
+}
+
 VkPresentModeKHR choose_present_mode(vector<VkPresentModeKHR> const& available_present_modes)
 {
 	if (available_present_modes.contains(VK_PRESENT_MODE_MAILBOX_KHR))
@@ -864,12 +3212,22 @@ VkSurfaceFormatKHR choose_surface_format(vector<VkSurfaceFormatKHR> const& avail
 	return available_formats[0];
 }
 
-VkInstance create_instance(renderer_vulkan::debug_output debugOutput)
+VkInstance create_instance(renderer_vulkan::debug_output debugOutput, bool headless)
 {
-	fixed_vector<char const*> requiredExtensionNames = get_required_extension_names(debugOutput);
+	fixed_vector<char const*> requiredExtensionNames = get_required_extension_names(debugOutput, headless);
 	if (!check_extension_support(requiredExtensionNames))
 		return nullptr;
 
+	vector<char const*> extensionNames;
+	for (auto extensionName : requiredExtensionNames)
+		extensionNames.push_back(extensionName);
+
+	if (!headless && check_instance_extension_support(SURFACE_MAINTENANCE_EXTENSION_NAMES))
+	{
+		for (auto extensionName : SURFACE_MAINTENANCE_EXTENSION_NAMES)
+			extensionNames.push_back(extensionName);
+	}
+
 	auto debugOutputEnabled = debugOutput == renderer_vulkan::debug_output::enabled;
 	fixed_vector<char const*> requiredLayerNames(1);
 	requiredLayerNames[0] = "VK_LAYER_KHRONOS_validation";
@@ -882,13 +3240,13 @@ VkInstance create_instance(renderer_vulkan::debug_output debugOutput)
 	applicationInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	applicationInfo.pEngineName = "VulkanEngine";
 	applicationInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	applicationInfo.apiVersion = VK_API_VERSION_1_0;
+	applicationInfo.apiVersion = VK_API_VERSION_1_3;
 
 	VkInstanceCreateInfo instanceCreateInfo{};
 	instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	instanceCreateInfo.pApplicationInfo = &applicationInfo;
-	instanceCreateInfo.ppEnabledExtensionNames = requiredExtensionNames.data();
-	instanceCreateInfo.enabledExtensionCount = (uint32_t)requiredExtensionNames.size();
+	instanceCreateInfo.ppEnabledExtensionNames = extensionNames.data();
+	instanceCreateInfo.enabledExtensionCount = (uint32_t)extensionNames.size();
 
 	VkDebugUtilsMessengerCreateInfoEXT debugUtilsMessengerCreateInfo{};
 	if (debugOutputEnabled)
@@ -930,19 +3288,48 @@ VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(VkDebugUtilsMessageSeverityFlagBit
 	return VK_FALSE;
 }
 
-fixed_vector<char const*> get_required_extension_names(renderer_vulkan::debug_output debugOutput)
+// Planes point inwards and are normalized, so a sphere is outside once its center lies more than its radius behind
+// any of them. Vulkan clip space has depth from 0 to w, so the near plane is the z row on its own.
+void extract_frustum_planes(math::mat4 const& view_projection, float (&planes)[6][4])
 {
-	size_t extensionCount = 2;
-	if (debugOutput == renderer_vulkan::debug_output::enabled)
-		++extensionCount;
+	auto const& m = view_projection;
+	for (int column = 0; column < 4; ++column)
+	{
+		planes[0][column] = m(3, column) + m(0, column);
+		planes[1][column] = m(3, column) - m(0, column);
+		planes[2][column] = m(3, column) + m(1, column);
+		planes[3][column] = m(3, column) - m(1, column);
+		planes[4][column] = m(2, column);
+		planes[5][column] = m(3, column) - m(2, column);
+	}
+
+	for (auto& plane : planes)
+	{
+		float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		for (auto& value : plane)
+			value /= length;
+	}
+}
+
+fixed_vector<char const*> get_required_extension_names(renderer_vulkan::debug_output debugOutput, bool headless)
+{
+	vector<char const*> extensionNames;
+	if (!headless)
+	{
+		extensionNames.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+#if defined(VK_USE_PLATFORM_WIN32_KHR)
+		extensionNames.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+#endif
+	}
 
-	fixed_vector<char const*> extensionNames(extensionCount);
-	extensionNames[0] = VK_KHR_SURFACE_EXTENSION_NAME;
-	extensionNames[1] = VK_KHR_WIN32_SURFACE_EXTENSION_NAME;
 	if (debugOutput == renderer_vulkan::debug_output::enabled)
-		extensionNames[2] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
+		extensionNames.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
-	return extensionNames;
+	fixed_vector<char const*> requiredExtensionNames(extensionNames.size());
+	for (size_t i = 0; i < extensionNames.size(); ++i)
+		requiredExtensionNames[i] = extensionNames[i];
+
+	return requiredExtensionNames;
 }
 
 swapchain_support_details get_swapchain_support_details(VkPhysicalDevice physical_device, VkSurfaceKHR surface)
@@ -970,6 +3357,17 @@ swapchain_support_details get_swapchain_support_details(VkPhysicalDevice physica
 	return details;
 }
 
+uint32_t specialization_constant_size(shader_reflection const& shader, uint32_t id)
+{
+	for (auto const& constant : shader.specialization_constants)
+	{
+		if (constant.id == id)
+			return constant.size;
+	}
+
+	return 0;
+}
+
 void output_vulkan_details()
 {
 	std::cout << "Vulkan support details:" << std::endl;
@@ -1045,3 +3443,12 @@ void output_vulkan_device_details(VkInstance instance)
 		std::cout << "\t}" << std::endl;
 	}
 }
+
+bool reflect_shader_file(char const* path, shader_reflection& reflection)
+{
+	auto code = read_entire_file(path, io::file_mode::binary);
+	if (code.empty())
+		return false;
+
+	return reflect_shader(code, reflection);
+}
@@ -8,8 +8,28 @@
 #include "datastructures/optional.h"
 #include "datastructures/fixed_vector.h"
 #include "datastructures/vector.h"
+#include "engine/backend/vulkan/bindless_heap.h"
+#include "engine/backend/vulkan/deletion_queue.h"
+#include "engine/backend/vulkan/descriptor_allocator.h"
+#include "engine/backend/vulkan/gpu_profiler.h"
+#include "engine/backend/vulkan/linear_allocator.h"
+#include "engine/backend/vulkan/material.h"
+#include "engine/backend/vulkan/memory_allocator.h"
+#include "engine/backend/vulkan/mesh.h"
+#include "engine/backend/vulkan/parallel_recorder.h"
+#include "engine/backend/vulkan/pipeline_layout_cache.h"
+#include "engine/backend/vulkan/pipeline_state.h"
+#include "engine/backend/vulkan/pipeline_statistics.h"
+#include "engine/backend/vulkan/render_graph.h"
+#include "engine/backend/vulkan/shader_reflection.h"
+#include "engine/backend/vulkan/shader_reloader.h"
+#include "engine/backend/vulkan/upload_manager.h"
+#include "math/math.h"
 
+#include <functional>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include <volk/volk.h>
 
@@ -25,18 +45,103 @@ namespace engine
 			disabled
 		};
 
-		static std::unique_ptr<renderer_vulkan> create_with_window(window const&, debug_output debugOutput = debug_output::enabled);
+		enum class queue_type
+		{
+			graphics,
+			compute,
+			transfer
+		};
+
+		enum class render_path
+		{
+			render_pass,	  // A VkRenderPass with a VkFramebuffer per image, rebuilt with the swapchain.
+			dynamic_rendering // vkCmdBeginRendering with synchronization2 layout transitions, needs Vulkan 1.3.
+		};
 
-		renderer_vulkan(VkInstance instance) : m_instance(instance) {}
+		static constexpr uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+		static constexpr uint32_t MAX_MATERIALS = 4096;
+
+		// Devices without dynamic rendering fall back to the render pass path.
+		static std::unique_ptr<renderer_vulkan> create_with_window(window const&, debug_output debugOutput = debug_output::enabled,
+																   uint32_t frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT,
+																   render_path path = render_path::dynamic_rendering);
+		// Renders into device-owned images instead of a swapchain, so neither a window nor presentation support is
+		// required. Every frame in flight gets its own image.
+		static std::unique_ptr<renderer_vulkan> create_headless(uint32_t width, uint32_t height,
+																debug_output debugOutput = debug_output::enabled,
+																uint32_t frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT,
+																render_path path = render_path::dynamic_rendering);
+
+		renderer_vulkan(VkInstance instance, uint32_t frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT)
+			: m_instance(instance), m_frames(frames_in_flight) {}
 		~renderer_vulkan();
 
 		void render();
+		void wait_idle();
+
+		// Headless only: waits for the most recently rendered frame and returns its pixels as tightly packed RGBA8.
+		datastructures::fixed_vector<char> read_back_last_frame();
+
+		// Uploads the mesh into device local memory. Instances of it are drawn once the upload has finished.
+		datastructures::optional<mesh_handle> create_mesh(mesh_vertex const* vertices, uint32_t vertex_count, uint32_t const* indices,
+														  uint32_t index_count);
+		// Draws these instances of the mesh every frame from now on, once the textures of their materials are uploaded.
+		bool add_instances(mesh_handle, mesh_instance const* instances, uint32_t instance_count);
+
+		// Textures and materials need the bindless heap and fail without it. Material 0 is white and untextured and
+		// always exists, so it is what instances without a material use.
+		datastructures::optional<texture_handle> create_texture(uint32_t width, uint32_t height, void const* rgba8_pixels);
+		datastructures::optional<material_handle> create_material(material_description const&);
+		void set_mesh_draw_mode(mesh_draw_mode mode) { m_mesh_draw_mode = mode; }
+		void set_view_projection(math::mat4 const& view_projection) { m_view_projection = view_projection; }
+
+		// Returns the cached pipeline for this state, compiling it on first use. The renderer owns the pipeline.
+		// The handle changes when a shader of it is reloaded, so don't keep it across frames. Every set of
+		// specialization constants is a variant of its own, compiled from the same SPIR-V.
+		VkPipeline get_graphics_pipeline(graphics_pipeline_description const&);
+		// Recreates the pipelines of shaders that change on disk at the start of the next frame, recompiling changed
+		// GLSL sources first. Meant for development, returns false when the shader directories can't be watched.
+		bool enable_shader_hot_reload();
+
+		bool is_headless() const { return m_window_surface == VK_NULL_HANDLE; }
+		render_path rendering_path() const { return m_render_path; }
+		VkExtent2D extent() const { return m_swapchain_extent; }
+		// Its heap budgets are read at the start of every frame, which is when its budget callbacks are called.
+		memory_allocator& memory() { return *m_memory_allocator; }
+		upload_manager& uploads() { return *m_upload_manager; }
+		// Destroys objects once the frames that may use them are done, without stalling. Objects released between
+		// frames were last used by the frame of submitted_frame_value().
+		deletion_queue& deletions() { return *m_deletion_queue; }
+		uint64_t submitted_frame_value() const { return m_frame_timeline_value; }
+		// Sets for the frame that is being recorded, reset once that frame index comes around again.
+		frame_descriptor_allocator& frame_descriptors() { return *m_frame_descriptor_allocator; }
+		// Host visible memory for the frame that is being recorded, rewound once that frame index comes around again.
+		frame_linear_allocator& frame_memory() { return *m_frame_linear_allocator; }
+		// Null when the device lacks descriptor indexing.
+		bindless_heap* bindless() { return m_bindless_heap.get(); }
+		// Null when the graphics queue can't write timestamps. Times the frame, culling and every render pass.
+		gpu_profiler* profiler() { return m_gpu_profiler.get(); }
+		// Layouts reflected from SPIR-V; graphics pipelines without a layout in their description get theirs from here.
+		pipeline_layout_cache& pipeline_layouts() { return *m_pipeline_layouts; }
+		// Null without pipelineStatisticsQuery. Counts the draws of every frame, but not GPU culling.
+		pipeline_statistics_query* statistics() { return m_pipeline_statistics_query.get(); }
+		// The graph of the most recently rendered frame, null on the render pass path. Its barriers and transient
+		// images stay readable until that frame index is recorded again.
+		render_graph const* last_render_graph() const;
+
+		// Compute and transfer work prefers families without graphics support, so it can overlap with rendering.
+		// Without those, they share the graphics family and possibly its queue. Exclusive resources that move
+		// between families need an ownership transfer, see queue_ownership.h.
+		VkQueue queue(queue_type) const;
+		uint32_t queue_family(queue_type) const;
 
 	private:
 		struct queue_family_indices
 		{
 			datastructures::optional<uint32_t> graphics;
 			datastructures::optional<uint32_t> present;
+			datastructures::optional<uint32_t> compute;
+			datastructures::optional<uint32_t> transfer;
 
 			bool is_complete() const
 			{
@@ -48,39 +153,181 @@ namespace engine
 		{
 			VkQueue graphics;
 			VkQueue present;
+			VkQueue compute;
+			VkQueue transfer;
+		};
+
+		// Everything the scene's draws depend on. A recording of them stays valid while this stays the same.
+		// Whoever draws with a pipeline binds its resources through its layout, so the layout stays when the pipeline
+		// is reloaded.
+		struct compiled_graphics_pipeline
+		{
+			VkPipeline pipeline = VK_NULL_HANDLE;
+			VkPipelineLayout layout = VK_NULL_HANDLE;
+		};
+
+		struct scene_state
+		{
+			VkPipeline graphics_pipeline = VK_NULL_HANDLE;
+			VkPipeline mesh_pipeline = VK_NULL_HANDLE;
+			VkPipeline culled_mesh_pipeline = VK_NULL_HANDLE;
+			VkFormat color_format = VK_FORMAT_UNDEFINED;
+			VkExtent2D extent{};
+			math::mat4 view_projection{};
+			mesh_draw_mode draw_mode = mesh_draw_mode::gpu_driven;
+			uint32_t batch_count = 0;
+			uint32_t drawable_batch_count = 0; // Batches only ever become drawable.
+
+			bool operator==(scene_state const&) const;
 		};
 
-		bool create_command_buffer();
+		// Everything the CPU needs to record and submit a frame while the GPU may still be working on the
+		// previous ones. A frame's resources may only be reused once the frame timeline has reached its value.
+		struct frame
+		{
+			VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+			VkSemaphore image_available_semaphore = VK_NULL_HANDLE;
+			uint64_t timeline_value = 0;
+			// Signaled once the frame's last present is done with its swapchain, with VK_EXT_swapchain_maintenance1 only.
+			VkFence present_fence = VK_NULL_HANDLE;
+			bool present_pending = false;
+
+			// The scene's draws, split over secondary command buffers that are recorded in parallel and executed in
+			// order. They're kept across frames and only recorded again when their scene_state changes. Draws of GPU
+			// driven rendering read this frame's slice of the culling output, so every frame has its own.
+			datastructures::vector<VkCommandBuffer> scene_command_buffers;
+			scene_state recorded_scene;
+			bool scene_recorded = false;
+		};
+
+		static std::unique_ptr<renderer_vulkan> create_with_instance(debug_output, uint32_t frames_in_flight, bool headless);
+
+		VkDescriptorSet allocate_culling_descriptor_set();
+		void begin_render_pass(VkCommandBuffer, uint32_t image_index, VkSubpassContents);
+		scene_state current_scene_state() const;
+		bool create_bindless_heap();
+		VkPipeline compile_culling_pipeline();
+		// Layout is the description's, or the one its shaders declare when it has none.
+		VkPipeline compile_graphics_pipeline(graphics_pipeline_description const&, VkPipelineLayout& layout);
+		bool create_command_buffers();
 		bool create_command_pool();
+		bool create_command_recorder();
+		bool create_culling_pipeline();
+		bool create_culling_resources(mesh_instance_batch&);
 		void create_debug_messenger();
+		void create_deletion_queue();
+		bool create_depth_image();
+		upload_manager::ticket create_device_local_buffer(void const* data, VkDeviceSize size, VkBufferUsageFlags, VkBuffer&, memory_allocation&);
+		bool create_frame_descriptor_allocator();
+		bool create_frame_linear_allocator();
 		bool create_framebuffers();
+		void create_gpu_profiler();
 		bool create_graphics_pipeline();
+		bool create_image_views();
 		bool create_logical_device(debug_output);
+		bool create_offscreen_images(uint32_t width, uint32_t height);
+		bool create_pipeline_cache();
+		bool create_pipeline_layout();
+		bool create_pipeline_statistics_query();
+		void create_render_graphs();
 		bool create_render_pass();
 		VkShaderModule create_shader_module(datastructures::fixed_vector<char> const& code);
 		bool create_swapchain(window const&);
 		bool create_synchronization_objects();
+		VkFence create_present_fence();
+		bool create_upload_manager();
 		bool create_window_surface(window const&);
+		void destroy_graphics_pipelines();
 		queue_family_indices find_queue_families(VkPhysicalDevice);
+		bool initialize(debug_output, render_path, std::function<bool()> const& create_render_targets);
+		bool is_drawable(mesh_instance_batch const&) const;
 		VkPhysicalDevice pick_physical_device();
 		int rate_device_suitability(VkPhysicalDevice);
 		bool record_command_buffer(VkCommandBuffer, uint32_t image_index);
+		bool is_culling_enabled() const;
+		bool record_culling(VkCommandBuffer);
+		void record_culling_dispatches(VkCommandBuffer, VkDescriptorSet frame_set);
+		void record_draw_command_resets(VkCommandBuffer);
+		bool record_present_transition(VkCommandBuffer, uint32_t image_index);
+		void record_mesh_draws(VkCommandBuffer, uint32_t first_batch, uint32_t batch_count);
+		bool record_render_graph(VkCommandBuffer, uint32_t image_index);
+		void record_scene(VkCommandBuffer, uint32_t first_batch, uint32_t batch_count);
+		bool record_scene_command_buffers();
+		bool recreate_swapchain();
+		void reload_changed_shaders();
+		void retire_pipeline(VkPipeline);
+		void save_pipeline_cache();
+		void wait_for_frame_timeline(uint64_t value);
+		VkDescriptorSet write_culling_frame_constants();
+
+		window const* m_window = nullptr;
+		VkExtent2D m_window_extent{};
 
 		VkInstance m_instance = VK_NULL_HANDLE;
 		VkPhysicalDevice m_physical_device = VK_NULL_HANDLE;
 		VkDevice m_device = VK_NULL_HANDLE;
 		VolkDeviceTable m_device_functions{};
+		std::unique_ptr<memory_allocator> m_memory_allocator;
+		std::unique_ptr<upload_manager> m_upload_manager;
+		std::unique_ptr<deletion_queue> m_deletion_queue;
+		std::unique_ptr<frame_descriptor_allocator> m_frame_descriptor_allocator;
+		std::unique_ptr<frame_linear_allocator> m_frame_linear_allocator;
+		std::unique_ptr<gpu_profiler> m_gpu_profiler;
+		bool m_pipeline_statistics_supported = false;
+		bool m_scene_command_reuse = false; // Secondary command buffers can't run inside queries they don't inherit.
+		std::unique_ptr<pipeline_statistics_query> m_pipeline_statistics_query;
+
+		bool m_bindless_supported = false;
+		bool m_present_fences_supported = false; // VK_EXT_swapchain_maintenance1, see recreate_swapchain.
+		std::unique_ptr<bindless_heap> m_bindless_heap;
+		VkSampler m_default_sampler = VK_NULL_HANDLE;
+		datastructures::vector<texture> m_textures;
+
+		// Host visible and written when a material is created, so materials need no upload of their own.
+		VkBuffer m_material_buffer = VK_NULL_HANDLE;
+		memory_allocation m_material_allocation;
+		uint32_t m_material_buffer_index = bindless_heap::INVALID_INDEX;
+		datastructures::vector<upload_manager::ticket> m_material_uploads; // Upload of each material's texture.
+
 		VkSurfaceKHR m_window_surface = VK_NULL_HANDLE;
+		queue_family_indices m_queue_families;
+		VkPipelineCache m_pipeline_cache = VK_NULL_HANDLE;
+		std::unique_ptr<shader_reloader> m_shader_reloader;
+		render_path m_render_path = render_path::render_pass;
 		VkRenderPass m_render_pass = VK_NULL_HANDLE;
+		std::vector<std::unique_ptr<render_graph>> m_render_graphs; // Per frame in flight, dynamic rendering only.
+		std::unique_ptr<pipeline_layout_cache> m_pipeline_layouts; // Owns every pipeline and descriptor set layout.
 		VkPipelineLayout m_pipeline_layout = VK_NULL_HANDLE;
 		VkPipeline m_graphics_pipeline = VK_NULL_HANDLE;
+		VkPipeline m_mesh_pipeline = VK_NULL_HANDLE;
+		VkPipeline m_culled_mesh_pipeline = VK_NULL_HANDLE; // Draws the visible instances GPU culling compacted.
+		std::unordered_map<graphics_pipeline_description, compiled_graphics_pipeline> m_graphics_pipelines;
+
+		// Only created with the bindless heap, which the culled mesh pipeline reads the instances through.
+		VkDescriptorSetLayout m_culling_descriptor_set_layout = VK_NULL_HANDLE;
+		VkDescriptorSetLayout m_culling_frame_set_layout = VK_NULL_HANDLE; // Allocated every frame, for the frustum.
+		VkPipelineLayout m_culling_pipeline_layout = VK_NULL_HANDLE;
+		VkPipeline m_culling_pipeline = VK_NULL_HANDLE;
+		datastructures::vector<VkDescriptorPool> m_culling_descriptor_pools;
 
 		VkCommandPool m_command_pool = VK_NULL_HANDLE;
-		VkCommandBuffer m_command_buffer = VK_NULL_HANDLE;
+		std::unique_ptr<parallel_command_recorder> m_command_recorder; // Only when the scene is recorded once for many frames.
 
-		VkSemaphore m_image_available_semaphore = VK_NULL_HANDLE;
-		VkSemaphore m_render_finished_semaphore = VK_NULL_HANDLE;
-		VkFence m_in_flight_fence = VK_NULL_HANDLE;
+		datastructures::vector<mesh> m_meshes;
+		datastructures::vector<mesh_instance_batch> m_instance_batches;
+		mesh_draw_mode m_mesh_draw_mode = mesh_draw_mode::gpu_driven;
+		math::mat4 m_view_projection = math::mat4::identity();
+
+		datastructures::fixed_vector<frame> m_frames;
+		uint32_t m_current_frame = 0;
+
+		// Indexed by swapchain image rather than by frame: presentation may still be waiting on the semaphore
+		// after the frame timeline has reached the frame's value, so it can only be reused once the same image is
+		// acquired again.
+		datastructures::vector<VkSemaphore> m_render_finished_semaphores;
+		// Signaled by every graphics submission with the next value, so a single value orders all frames.
+		VkSemaphore m_frame_timeline = VK_NULL_HANDLE;
+		uint64_t m_frame_timeline_value = 0;
 
 		VkSwapchainKHR m_swapchain = VK_NULL_HANDLE;
 		VkFormat m_swapchain_image_format;
@@ -89,6 +336,16 @@ namespace engine
 		datastructures::vector<VkImageView> m_swapchain_image_views;
 		datastructures::vector<VkFramebuffer> m_swapchain_framebuffers;
 
+		// Only for the render pass path, the render graph has a transient depth image of its own. One is enough for
+		// every frame, the render pass orders the depth writes of consecutive frames.
+		VkImage m_depth_image = VK_NULL_HANDLE;
+		VkImageView m_depth_image_view = VK_NULL_HANDLE;
+		memory_allocation m_depth_allocation;
+
+		// When headless, m_swapchain_images holds the offscreen images backed by these allocations.
+		datastructures::vector<memory_allocation> m_offscreen_image_allocations;
+		uint32_t m_last_rendered_frame = 0;
+
 		queues m_queues{};
 
 		VkDebugUtilsMessengerEXT m_debugMessenger = VK_NULL_HANDLE;
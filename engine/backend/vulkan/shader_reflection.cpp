@@ -0,0 +1,596 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/shader_reflection.h"
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <iostream>
+
+namespace engine
+{
+	namespace
+	{
+		constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+		constexpr uint32_t SPIRV_HEADER_WORDS = 5;
+
+		// The few parts of the SPIR-V specification the reflection needs.
+		enum spirv_opcode : uint32_t
+		{
+			op_entry_point = 15,
+			op_type_bool = 20,
+			op_type_int = 21,
+			op_type_float = 22,
+			op_type_vector = 23,
+			op_type_matrix = 24,
+			op_type_image = 25,
+			op_type_sampler = 26,
+			op_type_sampled_image = 27,
+			op_type_array = 28,
+			op_type_runtime_array = 29,
+			op_type_struct = 30,
+			op_type_pointer = 32,
+			op_constant = 43,
+			op_spec_constant_true = 48,
+			op_spec_constant_false = 49,
+			op_spec_constant = 50,
+			op_variable = 59,
+			op_decorate = 71,
+			op_member_decorate = 72
+		};
+
+		enum spirv_decoration : uint32_t
+		{
+			decoration_spec_id = 1,
+			decoration_buffer_block = 3,
+			decoration_array_stride = 6,
+			decoration_matrix_stride = 7,
+			decoration_built_in = 11,
+			decoration_location = 30,
+			decoration_binding = 33,
+			decoration_descriptor_set = 34,
+			decoration_offset = 35
+		};
+
+		enum spirv_storage_class : uint32_t
+		{
+			storage_uniform_constant = 0,
+			storage_input = 1,
+			storage_uniform = 2,
+			storage_push_constant = 9,
+			storage_storage_buffer = 12
+		};
+
+		constexpr uint32_t NONE = ~0u;
+		// Far deeper than any real shader nests its types, so a type that contains itself can't recurse forever.
+		constexpr uint32_t MAX_TYPE_DEPTH = 64;
+
+		// Everything an id can be in the instructions above, indexed by id.
+		struct spirv_id
+		{
+			uint32_t opcode = 0;
+			uint32_t type = NONE;		   // Result type of variables and constants, pointee of pointers, element of arrays.
+			uint32_t value = 0;			   // Constants, the length id of arrays, the width of scalars, the count of vectors and matrices.
+			uint32_t storage_class = NONE; // Variables and pointers.
+			uint32_t set = NONE;
+			uint32_t binding = NONE;
+			uint32_t location = NONE;
+			uint32_t spec_id = NONE;
+			uint32_t array_stride = 0;
+			uint32_t image_dim = 0;
+			uint32_t image_sampled = 0;
+			uint32_t first_member = 0; // Into the member lists for structs.
+			uint32_t member_count = 0;
+			bool signed_int = false;
+			bool buffer_block = false;
+			bool built_in = false;
+		};
+
+		struct spirv_member
+		{
+			uint32_t type = NONE;
+			uint32_t offset = 0;
+			uint32_t matrix_stride = 0;
+		};
+
+		struct member_decoration
+		{
+			uint32_t structure;
+			uint32_t member;
+			uint32_t decoration;
+			uint32_t value;
+		};
+
+		class spirv_parser
+		{
+		public:
+			spirv_parser(uint32_t const* words, size_t word_count, uint32_t bound)
+				: m_words(words), m_word_count(word_count), m_ids(bound) {}
+
+			bool parse(shader_reflection&);
+
+		private:
+			bool type_size(uint32_t type, uint32_t& size, uint32_t depth = 0) const;
+			bool struct_size(uint32_t type, uint32_t& size, uint32_t depth = 0) const;
+			VkFormat input_format(uint32_t type) const;
+			bool add_binding(spirv_id const& variable, shader_reflection&) const;
+			void add_vertex_input(spirv_id const& variable, shader_reflection&) const;
+
+			uint32_t const* m_words;
+			size_t m_word_count;
+			datastructures::fixed_vector<spirv_id> m_ids;
+			datastructures::vector<spirv_member> m_members;
+			datastructures::vector<member_decoration> m_member_decorations;
+		};
+
+		bool spirv_parser::parse(shader_reflection& reflection)
+		{
+			bool found_entry_point = false;
+			datastructures::vector<uint32_t> variables;
+
+			for (size_t offset = SPIRV_HEADER_WORDS; offset < m_word_count;)
+			{
+				auto const* instruction = m_words + offset;
+				uint32_t word_count = instruction[0] >> 16;
+				uint32_t opcode = instruction[0] & 0xffff;
+				if (word_count == 0 || offset + word_count > m_word_count)
+				{
+					std::cerr << std::format("Failed to reflect shader: malformed instruction at word {}", offset) << std::endl;
+					return false;
+				}
+
+				offset += word_count;
+
+				// Result ids of the instructions below are checked against the bound before they are used.
+				auto result_id = [&](uint32_t word) -> spirv_id* {
+					return word < word_count && instruction[word] < m_ids.size() ? &m_ids[instruction[word]] : nullptr;
+				};
+
+				switch (opcode)
+				{
+				case op_entry_point:
+				{
+					if (found_entry_point)
+						break;
+
+					// The execution model, the function and at least one word of its name.
+					if (word_count < 4)
+					{
+						std::cerr << std::format("Failed to reflect shader: malformed entry point at word {}", offset - word_count) << std::endl;
+						return false;
+					}
+
+					found_entry_point = true;
+					switch (instruction[1])
+					{
+					case 0:
+						reflection.stage = VK_SHADER_STAGE_VERTEX_BIT;
+						break;
+					case 1:
+						reflection.stage = VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+						break;
+					case 2:
+						reflection.stage = VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+						break;
+					case 3:
+						reflection.stage = VK_SHADER_STAGE_GEOMETRY_BIT;
+						break;
+					case 4:
+						reflection.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+						break;
+					case 5:
+						reflection.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+						break;
+					default:
+						std::cerr << std::format("Failed to reflect shader: unsupported execution model {}", instruction[1]) << std::endl;
+						return false;
+					}
+					break;
+				}
+				case op_decorate:
+				{
+					auto* target = result_id(1);
+					if (target == nullptr || word_count < 3)
+						break;
+
+					auto value = word_count > 3 ? instruction[3] : 0;
+					switch (instruction[2])
+					{
+					case decoration_spec_id:
+						target->spec_id = value;
+						break;
+					case decoration_buffer_block:
+						target->buffer_block = true;
+						break;
+					case decoration_array_stride:
+						target->array_stride = value;
+						break;
+					case decoration_built_in:
+						target->built_in = true;
+						break;
+					case decoration_location:
+						target->location = value;
+						break;
+					case decoration_binding:
+						target->binding = value;
+						break;
+					case decoration_descriptor_set:
+						target->set = value;
+						break;
+					}
+					break;
+				}
+				case op_member_decorate:
+					// Decorations come before the types, so they are applied once the struct is known.
+					if (word_count > 4)
+						m_member_decorations.push_back({ instruction[1], instruction[2], instruction[3], instruction[4] });
+					break;
+				case op_type_bool:
+				case op_type_sampler:
+					if (auto* id = result_id(1))
+						id->opcode = opcode;
+					break;
+				case op_type_int:
+				case op_type_float:
+					if (auto* id = result_id(1); id != nullptr && word_count > 2)
+					{
+						id->opcode = opcode;
+						id->value = instruction[2];
+						id->signed_int = opcode == op_type_int && word_count > 3 && instruction[3] != 0;
+					}
+					break;
+				case op_type_vector:
+				case op_type_matrix:
+				case op_type_array:
+					if (auto* id = result_id(1); id != nullptr && word_count > 3)
+					{
+						id->opcode = opcode;
+						id->type = instruction[2];
+						id->value = instruction[3];
+					}
+					break;
+				case op_type_runtime_array:
+				case op_type_sampled_image:
+					if (auto* id = result_id(1); id != nullptr && word_count > 2)
+					{
+						id->opcode = opcode;
+						id->type = instruction[2];
+					}
+					break;
+				case op_type_image:
+					if (auto* id = result_id(1); id != nullptr && word_count > 7)
+					{
+						id->opcode = opcode;
+						id->image_dim = instruction[3];
+						id->image_sampled = instruction[7];
+					}
+					break;
+				case op_type_struct:
+					if (auto* id = result_id(1))
+					{
+						id->opcode = opcode;
+						id->first_member = (uint32_t)m_members.size();
+						id->member_count = word_count - 2;
+						for (uint32_t i = 2; i < word_count; ++i)
+							m_members.push_back({ instruction[i], 0, 0 });
+					}
+					break;
+				case op_type_pointer:
+					if (auto* id = result_id(1); id != nullptr && word_count > 3)
+					{
+						id->opcode = opcode;
+						id->storage_class = instruction[2];
+						id->type = instruction[3];
+					}
+					break;
+				case op_constant:
+					if (auto* id = result_id(2); id != nullptr && word_count > 3)
+					{
+						id->opcode = opcode;
+						id->type = instruction[1];
+						id->value = instruction[3];
+					}
+					break;
+				case op_spec_constant_true:
+				case op_spec_constant_false:
+				case op_spec_constant:
+					// Constants derived from these with OpSpecConstantOp can't be set, so they aren't reflected.
+					if (auto* id = result_id(2); id != nullptr && id->spec_id != NONE)
+					{
+						uint32_t size = sizeof(VkBool32);
+						if (opcode == op_spec_constant && !type_size(instruction[1], size))
+							return false;
+						reflection.specialization_constants.push_back({ id->spec_id, size });
+					}
+					break;
+				case op_variable:
+					if (auto* id = result_id(2); id != nullptr && word_count > 3)
+					{
+						id->opcode = opcode;
+						id->type = instruction[1];
+						id->storage_class = instruction[3];
+						variables.push_back(instruction[2]);
+					}
+					break;
+				}
+			}
+
+			if (!found_entry_point)
+			{
+				std::cerr << "Failed to reflect shader: it has no entry point" << std::endl;
+				return false;
+			}
+
+			for (auto const& decoration : m_member_decorations)
+			{
+				if (decoration.structure >= m_ids.size())
+					continue;
+
+				auto const& structure = m_ids[decoration.structure];
+				if (structure.opcode != op_type_struct || decoration.member >= structure.member_count)
+					continue;
+
+				auto& member = m_members[structure.first_member + decoration.member];
+				if (decoration.decoration == decoration_offset)
+					member.offset = decoration.value;
+				else if (decoration.decoration == decoration_matrix_stride)
+					member.matrix_stride = decoration.value;
+			}
+
+			uint32_t push_constant_end = 0;
+			reflection.push_constant_offset = ~0u;
+			for (auto variable_id : variables)
+			{
+				auto const& variable = m_ids[variable_id];
+				if (variable.type >= m_ids.size())
+					continue;
+
+				switch (variable.storage_class)
+				{
+				case storage_uniform_constant:
+				case storage_uniform:
+				case storage_storage_buffer:
+					if (!add_binding(variable, reflection))
+						return false;
+					break;
+				case storage_push_constant:
+				{
+					auto block = m_ids[variable.type].type;
+					if (block >= m_ids.size() || m_ids[block].opcode != op_type_struct)
+						break;
+
+					auto const& structure = m_ids[block];
+					for (uint32_t i = 0; i < structure.member_count; ++i)
+						reflection.push_constant_offset = std::min(reflection.push_constant_offset, m_members[structure.first_member + i].offset);
+					uint32_t block_size;
+					if (!struct_size(block, block_size))
+						return false;
+					push_constant_end = std::max(push_constant_end, block_size);
+					break;
+				}
+				case storage_input:
+					if (reflection.stage == VK_SHADER_STAGE_VERTEX_BIT && !variable.built_in)
+						add_vertex_input(variable, reflection);
+					break;
+				}
+			}
+
+			if (push_constant_end == 0)
+				reflection.push_constant_offset = 0;
+			reflection.push_constant_size = push_constant_end - reflection.push_constant_offset;
+
+			std::sort(reflection.bindings.begin(), reflection.bindings.end(), [](shader_binding const& a, shader_binding const& b) {
+				return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+			});
+			return true;
+		}
+
+		// Unknown types have no size, only types that nest deeper than MAX_TYPE_DEPTH fail.
+		bool spirv_parser::type_size(uint32_t type, uint32_t& size, uint32_t depth) const
+		{
+			if (depth > MAX_TYPE_DEPTH)
+			{
+				std::cerr << std::format("Failed to reflect shader: type {} nests deeper than {} levels", type, MAX_TYPE_DEPTH) << std::endl;
+				return false;
+			}
+
+			size = 0;
+			if (type >= m_ids.size())
+				return true;
+
+			auto const& id = m_ids[type];
+			switch (id.opcode)
+			{
+			case op_type_bool:
+				size = 4;
+				break;
+			case op_type_int:
+			case op_type_float:
+				size = id.value / 8;
+				break;
+			case op_type_vector:
+			case op_type_matrix:
+			{
+				uint32_t element_size;
+				if (!type_size(id.type, element_size, depth + 1))
+					return false;
+				size = id.value * element_size;
+				break;
+			}
+			case op_type_array:
+			{
+				auto length = id.value < m_ids.size() ? m_ids[id.value].value : 0;
+				uint32_t element_size = id.array_stride;
+				if (element_size == 0 && !type_size(id.type, element_size, depth + 1))
+					return false;
+				size = length * element_size;
+				break;
+			}
+			case op_type_struct:
+				return struct_size(type, size, depth + 1);
+			}
+
+			return true;
+		}
+
+		// The end of the last member, explicit layouts put every member at its offset decoration.
+		bool spirv_parser::struct_size(uint32_t type, uint32_t& size, uint32_t depth) const
+		{
+			auto const& structure = m_ids[type];
+
+			size = 0;
+			for (uint32_t i = 0; i < structure.member_count; ++i)
+			{
+				auto const& member = m_members[structure.first_member + i];
+				auto const* member_type = member.type < m_ids.size() ? &m_ids[member.type] : nullptr;
+
+				uint32_t member_size;
+				if (member_type != nullptr && member_type->opcode == op_type_matrix && member.matrix_stride != 0)
+					member_size = member_type->value * member.matrix_stride;
+				else if (!type_size(member.type, member_size, depth + 1))
+					return false;
+
+				size = std::max(size, member.offset + member_size);
+			}
+
+			return true;
+		}
+
+		VkFormat spirv_parser::input_format(uint32_t type) const
+		{
+			auto const& id = m_ids[type];
+			uint32_t component_count = 1;
+			auto const* component = &id;
+			if (id.opcode == op_type_vector && id.type < m_ids.size())
+			{
+				component_count = id.value;
+				component = &m_ids[id.type];
+			}
+
+			if (component->value != 32 || component_count < 1 || component_count > 4)
+				return VK_FORMAT_UNDEFINED;
+
+			constexpr VkFormat FLOAT_FORMATS[]{ VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+			constexpr VkFormat SINT_FORMATS[]{ VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+			constexpr VkFormat UINT_FORMATS[]{ VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+
+			if (component->opcode == op_type_float)
+				return FLOAT_FORMATS[component_count - 1];
+			if (component->opcode == op_type_int)
+				return component->signed_int ? SINT_FORMATS[component_count - 1] : UINT_FORMATS[component_count - 1];
+
+			return VK_FORMAT_UNDEFINED;
+		}
+
+		bool spirv_parser::add_binding(spirv_id const& variable, shader_reflection& reflection) const
+		{
+			if (variable.set == NONE || variable.binding == NONE)
+				return true;
+
+			shader_binding binding{};
+			binding.set = variable.set;
+			binding.binding = variable.binding;
+			binding.stages = reflection.stage;
+
+			// Arrays of descriptors multiply into the count.
+			auto type = m_ids[variable.type].type;
+			for (uint32_t depth = 0; type < m_ids.size() && (m_ids[type].opcode == op_type_array || m_ids[type].opcode == op_type_runtime_array); ++depth)
+			{
+				if (depth == MAX_TYPE_DEPTH)
+				{
+					std::cerr << std::format("Failed to reflect shader: binding {}.{} nests arrays deeper than {} levels", binding.set,
+											 binding.binding, MAX_TYPE_DEPTH)
+							  << std::endl;
+					return false;
+				}
+
+				auto const& array = m_ids[type];
+				binding.count = array.opcode == op_type_runtime_array ? 0 : binding.count * (array.value < m_ids.size() ? m_ids[array.value].value : 1);
+				type = array.type;
+			}
+
+			if (type >= m_ids.size())
+				return true;
+
+			auto const& resource = m_ids[type];
+			switch (resource.opcode)
+			{
+			case op_type_sampled_image:
+				binding.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				break;
+			case op_type_sampler:
+				binding.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+				break;
+			case op_type_image:
+			{
+				constexpr uint32_t DIM_BUFFER = 5;
+				constexpr uint32_t DIM_SUBPASS_DATA = 6;
+				bool storage = resource.image_sampled == 2;
+				if (resource.image_dim == DIM_BUFFER)
+					binding.type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+				else if (resource.image_dim == DIM_SUBPASS_DATA)
+					binding.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+				else
+					binding.type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+				break;
+			}
+			case op_type_struct:
+				// Older compilers mark storage buffers as BufferBlock in the Uniform storage class.
+				binding.type = variable.storage_class == storage_storage_buffer || resource.buffer_block ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+																										 : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+				break;
+			default:
+				std::cerr << std::format("Failed to reflect shader: binding {}.{} has an unsupported type", binding.set, binding.binding) << std::endl;
+				return false;
+			}
+
+			reflection.bindings.push_back(binding);
+			return true;
+		}
+
+		void spirv_parser::add_vertex_input(spirv_id const& variable, shader_reflection& reflection) const
+		{
+			auto type = m_ids[variable.type].type;
+			if (variable.location == NONE || type >= m_ids.size())
+				return;
+
+			auto const& input = m_ids[type];
+			if (input.opcode == op_type_matrix && input.type < m_ids.size())
+			{
+				auto format = input_format(input.type);
+				for (uint32_t column = 0; column < input.value; ++column)
+					reflection.vertex_inputs.push_back({ variable.location + column, format });
+			}
+			else
+				reflection.vertex_inputs.push_back({ variable.location, input_format(type) });
+		}
+	}
+
+	bool reflect_shader(datastructures::fixed_vector<char> const& code, shader_reflection& reflection)
+	{
+		auto word_count = code.size() / sizeof(uint32_t);
+		if (word_count < SPIRV_HEADER_WORDS || code.size() % sizeof(uint32_t) != 0)
+		{
+			std::cerr << "Failed to reflect shader: it is too small to be SPIR-V" << std::endl;
+			return false;
+		}
+
+		// The buffer comes from new[], which is aligned for any scalar.
+		auto const* words = (uint32_t const*)code.data();
+		if (words[0] != SPIRV_MAGIC)
+		{
+			std::cerr << "Failed to reflect shader: it is not SPIR-V" << std::endl;
+			return false;
+		}
+
+		reflection.bindings.clear();
+		reflection.vertex_inputs.clear();
+		reflection.specialization_constants.clear();
+
+		spirv_parser parser(words, word_count, words[3]);
+		return parser.parse(reflection);
+	}
+}
@@ -0,0 +1,54 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "datastructures/fixed_vector.h"
+#include "datastructures/vector.h"
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	constexpr uint32_t MAX_DESCRIPTOR_SETS = 4; // The minimum maxBoundDescriptorSets.
+
+	struct shader_binding
+	{
+		uint32_t set = 0;
+		uint32_t binding = 0;
+		VkDescriptorType type = VK_DESCRIPTOR_TYPE_MAX_ENUM;
+		uint32_t count = 1; // 0 for runtime sized arrays.
+		VkShaderStageFlags stages = 0;
+
+		bool operator==(shader_binding const&) const = default;
+	};
+
+	struct shader_vertex_input
+	{
+		uint32_t location;
+		VkFormat format;
+	};
+
+	struct shader_specialization_constant
+	{
+		uint32_t id; // The constant_id.
+		uint32_t size;
+	};
+
+	// The interface of a shader's entry point: its descriptors, push constants and, for vertex shaders, its inputs.
+	struct shader_reflection
+	{
+		VkShaderStageFlagBits stage = VK_SHADER_STAGE_ALL;
+		datastructures::vector<shader_binding> bindings;
+		datastructures::vector<shader_vertex_input> vertex_inputs; // Matrices take a location per column.
+		datastructures::vector<shader_specialization_constant> specialization_constants;
+		uint32_t push_constant_offset = 0;
+		uint32_t push_constant_size = 0; // 0 without push constants.
+	};
+
+	// Reads what a layout needs to know straight from the SPIR-V, without a reflection library. Only the first
+	// entry point is reflected, and every declared resource counts, whether the entry point uses it or not.
+	bool reflect_shader(datastructures::fixed_vector<char> const& code, shader_reflection&);
+}
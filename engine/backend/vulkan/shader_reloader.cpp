@@ -0,0 +1,139 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/shader_reloader.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <iostream>
+
+namespace engine
+{
+	// Same mapping from file name to stage as vulkan_utils.cmake.
+	static char const* shader_stage(std::string const& source)
+	{
+		if (source.ends_with(".vert.glsl"))
+			return "vertex";
+		if (source.ends_with(".frag.glsl"))
+			return "fragment";
+		if (source.ends_with(".comp.glsl"))
+			return "compute";
+
+		return nullptr;
+	}
+
+	std::unique_ptr<shader_reloader> shader_reloader::create(char const* source_directory, char const* binary_directory, char const* glslc)
+	{
+		auto watcher = file_watcher::create();
+		if (watcher == nullptr)
+			return nullptr;
+
+		if (!watcher->watch_directory(binary_directory))
+			return nullptr;
+
+		bool can_compile = glslc != nullptr && glslc[0] != '\0';
+		if (can_compile && !watcher->watch_directory(source_directory))
+			return nullptr;
+
+		std::cout << std::format("Reloading shaders from {}{}", binary_directory, can_compile ? std::format(", compiling {}", source_directory) : "")
+				  << std::endl;
+		return std::make_unique<shader_reloader>(std::move(watcher), source_directory, binary_directory, can_compile ? glslc : "");
+	}
+
+	shader_reloader::shader_reloader(std::unique_ptr<file_watcher> watcher, char const* source_directory, char const* binary_directory,
+									 char const* glslc)
+		: m_watcher(std::move(watcher)), m_source_directory(source_directory), m_binary_directory(binary_directory), m_glslc(glslc)
+	{
+		if (!m_glslc.empty())
+			m_worker = std::thread(&shader_reloader::run_worker, this);
+	}
+
+	shader_reloader::~shader_reloader()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_stopping = true;
+		}
+
+		m_condition.notify_one();
+		if (m_worker.joinable())
+			m_worker.join();
+	}
+
+	void shader_reloader::poll(std::vector<std::string>& changed_binaries)
+	{
+		m_changed_paths.clear();
+		m_watcher->poll(m_changed_paths);
+
+		bool queued_sources = false;
+		for (auto const& path : m_changed_paths)
+		{
+			if (path.ends_with(".spv"))
+			{
+				if (std::find(changed_binaries.begin(), changed_binaries.end(), path) == changed_binaries.end())
+					changed_binaries.push_back(path);
+			}
+			else if (!m_glslc.empty() && shader_stage(path) != nullptr)
+			{
+				std::lock_guard lock(m_mutex);
+				if (std::find(m_pending_sources.begin(), m_pending_sources.end(), path) == m_pending_sources.end())
+					m_pending_sources.push_back(path);
+				queued_sources = true;
+			}
+		}
+
+		if (queued_sources)
+			m_condition.notify_one();
+	}
+
+	bool shader_reloader::compile(std::string const& source) const
+	{
+		auto file_name = std::filesystem::path(source).filename().string();
+		auto binary = std::format("{}/{}.spv", m_binary_directory, file_name.substr(0, file_name.size() - 5));
+
+		// glslc writes a temporary file that is renamed over the binary, so it is never read half written, and a
+		// failed compile leaves the previous binary in place.
+		auto temporary = binary + ".tmp";
+		auto command = std::format("\"{}\" -fshader-stage={} -o \"{}\" \"{}\"", m_glslc, shader_stage(source), temporary, source);
+		if (std::system(command.c_str()) != 0)
+		{
+			std::cerr << std::format("Failed to compile shader {}", source) << std::endl;
+			return false;
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporary, binary, error);
+		if (error)
+		{
+			std::cerr << std::format("Failed to replace shader binary {}: {}", binary, error.message()) << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	void shader_reloader::run_worker()
+	{
+		std::vector<std::string> sources;
+		while (true)
+		{
+			{
+				std::unique_lock lock(m_mutex);
+				m_condition.wait(lock, [this] { return m_stopping || !m_pending_sources.empty(); });
+				if (m_stopping)
+					return;
+
+				sources.swap(m_pending_sources);
+			}
+
+			for (auto const& source : sources)
+				compile(source);
+
+			sources.clear();
+		}
+	}
+}
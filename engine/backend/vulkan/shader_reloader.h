@@ -0,0 +1,54 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "engine/file_watcher.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace engine
+{
+	// Notices shader changes while the renderer is running. Changed .glsl files in the source directory are
+	// compiled into the binary directory with glslc on a worker thread, the same way the compile_shader CMake
+	// function does. Changed .spv files in the binary directory are reported by poll, whether the worker or a
+	// build wrote them, so the renderer only has to recreate the pipelines that use them.
+	class shader_reloader
+	{
+	public:
+		// Without glslc only .spv files are watched. Returns nullptr when the platform can't watch files.
+		static std::unique_ptr<shader_reloader> create(char const* source_directory, char const* binary_directory, char const* glslc);
+
+		shader_reloader(std::unique_ptr<file_watcher> watcher, char const* source_directory, char const* binary_directory, char const* glslc);
+		~shader_reloader();
+
+		shader_reloader(shader_reloader const&) = delete;
+		shader_reloader& operator=(shader_reloader const&) = delete;
+
+		// Never blocks. Appends each SPIR-V file that changed since the last call once, as binary directory/name.spv.
+		void poll(std::vector<std::string>& changed_binaries);
+
+	private:
+		bool compile(std::string const& source) const;
+		void run_worker();
+
+		std::unique_ptr<file_watcher> m_watcher;
+		std::string m_source_directory;
+		std::string m_binary_directory;
+		std::string m_glslc;
+		std::vector<std::string> m_changed_paths;
+
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		std::vector<std::string> m_pending_sources; // Guarded by m_mutex, like m_stopping.
+		bool m_stopping = false;
+		std::thread m_worker;
+	};
+}
@@ -0,0 +1,433 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/upload_manager.h"
+
+#include "engine/backend/vulkan/formatters.h"
+#include "engine/backend/vulkan/queue_ownership.h"
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <iostream>
+
+namespace engine
+{
+	// Uploaded data can end up in any kind of read, the barriers don't know what the resource is used for.
+	static constexpr VkAccessFlags BUFFER_READ_ACCESS = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+		VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+	static constexpr VkAccessFlags IMAGE_READ_ACCESS = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+
+	// bufferOffset of an image copy has to be a multiple of both 4 and the texel size.
+	static constexpr VkDeviceSize IMAGE_COPY_ALIGNMENT = 16;
+
+	static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	std::unique_ptr<upload_manager> upload_manager::create(VkPhysicalDevice physical_device, VkDevice device, VolkDeviceTable const& device_functions,
+														   memory_allocator& allocator, VkQueue upload_queue, uint32_t upload_queue_family,
+														   uint32_t graphics_queue_family, VkDeviceSize ring_size /* = DEFAULT_RING_SIZE */)
+	{
+		auto manager = std::make_unique<upload_manager>(device, device_functions, allocator);
+		manager->m_upload_queue = upload_queue;
+		manager->m_upload_queue_family = upload_queue_family;
+		manager->m_graphics_queue_family = graphics_queue_family;
+		manager->m_ring_size = ring_size;
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physical_device, &properties);
+		manager->m_copy_offset_alignment = std::max<VkDeviceSize>(properties.limits.optimalBufferCopyOffsetAlignment, 1);
+
+		VkCommandPoolCreateInfo pool_create_info{};
+		pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		pool_create_info.queueFamilyIndex = upload_queue_family;
+
+		auto result = device_functions.vkCreateCommandPool(device, &pool_create_info, nullptr, &manager->m_command_pool);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create upload command pool: {}", result) << std::endl;
+			return nullptr;
+		}
+
+		VkCommandBufferAllocateInfo allocate_info{};
+		allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocate_info.commandPool = manager->m_command_pool;
+		allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocate_info.commandBufferCount = MAX_BATCHES_IN_FLIGHT;
+
+		datastructures::fixed_vector<VkCommandBuffer> command_buffers(MAX_BATCHES_IN_FLIGHT);
+		result = device_functions.vkAllocateCommandBuffers(device, &allocate_info, command_buffers.data());
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to allocate upload command buffers: {}", result) << std::endl;
+			return nullptr;
+		}
+
+		for (uint32_t i = 0; i < MAX_BATCHES_IN_FLIGHT; ++i)
+			manager->m_batches[i].command_buffer = command_buffers[i];
+
+		VkSemaphoreTypeCreateInfo semaphore_type_create_info{};
+		semaphore_type_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		semaphore_type_create_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+
+		VkSemaphoreCreateInfo semaphore_create_info{};
+		semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphore_create_info.pNext = &semaphore_type_create_info;
+
+		result = device_functions.vkCreateSemaphore(device, &semaphore_create_info, nullptr, &manager->m_timeline);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to create upload timeline semaphore: {}", result) << std::endl;
+			return nullptr;
+		}
+
+		VkBufferCreateInfo buffer_create_info{};
+		buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		buffer_create_info.size = ring_size;
+		buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		if (!allocator.create_buffer(buffer_create_info, memory_usage::staging, manager->m_staging_buffer, manager->m_staging_allocation))
+		{
+			std::cerr << "Failed to create staging ring buffer" << std::endl;
+			return nullptr;
+		}
+
+		return manager;
+	}
+
+	upload_manager::~upload_manager()
+	{
+		while (m_batches_in_flight > 0)
+			retire_oldest_batch(true);
+
+		if (m_timeline != VK_NULL_HANDLE)
+			m_device_functions.vkDestroySemaphore(m_device, m_timeline, nullptr);
+
+		if (m_command_pool != VK_NULL_HANDLE)
+			m_device_functions.vkDestroyCommandPool(m_device, m_command_pool, nullptr);
+
+		m_allocator.destroy_buffer(m_staging_buffer, m_staging_allocation);
+	}
+
+	upload_manager::ticket upload_manager::upload_buffer(VkBuffer buffer, VkDeviceSize offset, void const* data, VkDeviceSize size)
+	{
+		ticket result = 0;
+		auto const* source = static_cast<char const*>(data);
+		while (size > 0)
+		{
+			auto chunk_size = std::min(size, m_ring_size);
+			auto staging_offset = allocate_staging(chunk_size, m_copy_offset_alignment);
+			if (!staging_offset.has_value())
+				return 0;
+
+			auto* batch = begin_batch();
+			if (batch == nullptr)
+				return 0;
+
+			std::memcpy(static_cast<char*>(m_staging_allocation.mapped) + staging_offset.value(), source, chunk_size);
+
+			VkBufferCopy region{};
+			region.srcOffset = staging_offset.value();
+			region.dstOffset = offset;
+			region.size = chunk_size;
+			m_device_functions.vkCmdCopyBuffer(batch->command_buffer, m_staging_buffer, buffer, 1, &region);
+
+			if (uses_separate_queue_family())
+				batch->buffer_barriers.push_back(buffer_ownership_release(buffer, offset, chunk_size, VK_ACCESS_TRANSFER_WRITE_BIT,
+																		  m_upload_queue_family, m_graphics_queue_family));
+
+			result = batch->serial;
+			source += chunk_size;
+			offset += chunk_size;
+			size -= chunk_size;
+		}
+
+		return result;
+	}
+
+	upload_manager::ticket upload_manager::upload_image(VkImage image, VkExtent3D extent, void const* data, VkDeviceSize size)
+	{
+		if (size == 0 || size > m_ring_size)
+		{
+			std::cerr << std::format("Failed to upload image: {} bytes don't fit in the {} byte staging ring", size, m_ring_size) << std::endl;
+			return 0;
+		}
+
+		auto staging_offset = allocate_staging(size, std::max(m_copy_offset_alignment, IMAGE_COPY_ALIGNMENT));
+		if (!staging_offset.has_value())
+			return 0;
+
+		auto* batch = begin_batch();
+		if (batch == nullptr)
+			return 0;
+
+		std::memcpy(static_cast<char*>(m_staging_allocation.mapped) + staging_offset.value(), data, size);
+
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.layerCount = 1;
+		m_device_functions.vkCmdPipelineBarrier(batch->command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+												0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkBufferImageCopy region{};
+		region.bufferOffset = staging_offset.value();
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = extent;
+		m_device_functions.vkCmdCopyBufferToImage(batch->command_buffer, m_staging_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+		if (uses_separate_queue_family())
+			barrier = image_ownership_release(image, barrier.subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+											  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+											  m_upload_queue_family, m_graphics_queue_family);
+		else
+		{
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = IMAGE_READ_ACCESS;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		}
+		batch->image_barriers.push_back(barrier);
+
+		return batch->serial;
+	}
+
+	void upload_manager::flush()
+	{
+		auto& batch = m_batches[m_current_batch];
+		if (!batch.recording)
+			return;
+
+		if (uses_separate_queue_family())
+		{
+			// Releases only need to be ordered after the copies, the acquire on the graphics queue does the rest.
+			if (!batch.buffer_barriers.empty() || !batch.image_barriers.empty())
+				m_device_functions.vkCmdPipelineBarrier(batch.command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+														0, nullptr, (uint32_t)batch.buffer_barriers.size(), batch.buffer_barriers.data(),
+														(uint32_t)batch.image_barriers.size(), batch.image_barriers.data());
+		}
+		else
+		{
+			// Later submissions to the same queue are part of the second synchronization scope, so a single barrier
+			// here covers every command buffer that uses the uploaded data.
+			VkMemoryBarrier memory_barrier{};
+			memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			memory_barrier.dstAccessMask = BUFFER_READ_ACCESS;
+			m_device_functions.vkCmdPipelineBarrier(batch.command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+													1, &memory_barrier, 0, nullptr,
+													(uint32_t)batch.image_barriers.size(), batch.image_barriers.data());
+		}
+
+		auto result = m_device_functions.vkEndCommandBuffer(batch.command_buffer);
+		if (result == VK_SUCCESS)
+		{
+			VkTimelineSemaphoreSubmitInfo timeline_submit_info{};
+			timeline_submit_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+			timeline_submit_info.pSignalSemaphoreValues = &batch.serial;
+			timeline_submit_info.signalSemaphoreValueCount = 1;
+
+			VkSubmitInfo submit_info{};
+			submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submit_info.pNext = &timeline_submit_info;
+			submit_info.pCommandBuffers = &batch.command_buffer;
+			submit_info.commandBufferCount = 1;
+			submit_info.pSignalSemaphores = &m_timeline;
+			submit_info.signalSemaphoreCount = 1;
+
+			result = m_device_functions.vkQueueSubmit(m_upload_queue, 1, &submit_info, VK_NULL_HANDLE);
+		}
+
+		batch.recording = false;
+		if (result != VK_SUCCESS)
+		{
+			// The batch never reaches the GPU, so its value won't be signaled. Drain the batches before it so the
+			// ring can start over empty; the uploads in this batch are lost.
+			std::cerr << std::format("Failed to submit uploads: {}", result) << std::endl;
+			m_device_functions.vkResetCommandBuffer(batch.command_buffer, 0);
+			while (m_batches_in_flight > 0)
+				retire_oldest_batch(true);
+
+			m_ring_head = m_ring_tail = 0;
+			return;
+		}
+
+		batch.ring_end = m_ring_head;
+		batch.in_flight = true;
+		++m_batches_in_flight;
+		m_current_batch = (m_current_batch + 1) % MAX_BATCHES_IN_FLIGHT;
+	}
+
+	// Batches are only handed to graphics once they have finished, so a frame never waits on transfers in flight.
+	void upload_manager::record_pending_barriers(VkCommandBuffer command_buffer)
+	{
+		while (retire_oldest_batch(false))
+			continue;
+
+		m_recorded_buffer_acquires = m_pending_buffer_acquires.size();
+		m_recorded_image_acquires = m_pending_image_acquires.size();
+		m_recorded_serial = m_finished_serial;
+		if (m_recorded_buffer_acquires > 0 || m_recorded_image_acquires > 0)
+			m_device_functions.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+													0, nullptr, (uint32_t)m_recorded_buffer_acquires, m_pending_buffer_acquires.data(),
+													(uint32_t)m_recorded_image_acquires, m_pending_image_acquires.data());
+	}
+
+	// Batches retired while the command buffer was recorded are behind the recorded ones, they stay pending.
+	void upload_manager::commit_pending_barriers()
+	{
+		auto buffer_acquires = m_pending_buffer_acquires.size() - m_recorded_buffer_acquires;
+		for (size_t i = 0; i < buffer_acquires; ++i)
+			m_pending_buffer_acquires[i] = m_pending_buffer_acquires[m_recorded_buffer_acquires + i];
+		m_pending_buffer_acquires.resize(buffer_acquires);
+
+		auto image_acquires = m_pending_image_acquires.size() - m_recorded_image_acquires;
+		for (size_t i = 0; i < image_acquires; ++i)
+			m_pending_image_acquires[i] = m_pending_image_acquires[m_recorded_image_acquires + i];
+		m_pending_image_acquires.resize(image_acquires);
+
+		m_recorded_buffer_acquires = m_recorded_image_acquires = 0;
+		m_completed_serial = m_recorded_serial;
+	}
+
+	datastructures::optional<VkDeviceSize> upload_manager::allocate_staging(VkDeviceSize size, VkDeviceSize alignment)
+	{
+		for (;;)
+		{
+			auto offset = try_allocate_staging(size, alignment);
+			if (offset.has_value())
+				return offset;
+
+			// Out of space: submit what has been recorded so far and wait for the oldest batch to free its range.
+			flush();
+			if (m_batches_in_flight == 0)
+				break;
+
+			retire_oldest_batch(true);
+		}
+
+		auto offset = try_allocate_staging(size, alignment);
+		if (!offset.has_value())
+			std::cerr << std::format("Failed to allocate {} bytes of staging memory", size) << std::endl;
+
+		return offset;
+	}
+
+	upload_manager::batch* upload_manager::begin_batch()
+	{
+		auto& batch = m_batches[m_current_batch];
+		if (batch.recording)
+			return &batch;
+
+		// Batch slots are reused in submission order, so an occupied slot is always the oldest one in flight.
+		if (batch.in_flight)
+			retire_oldest_batch(true);
+
+		VkCommandBufferBeginInfo begin_info{};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		auto result = m_device_functions.vkBeginCommandBuffer(batch.command_buffer, &begin_info);
+		if (result != VK_SUCCESS)
+		{
+			std::cerr << std::format("Failed to begin recording uploads: {}", result) << std::endl;
+			return nullptr;
+		}
+
+		batch.serial = m_next_serial++;
+		batch.recording = true;
+		batch.buffer_barriers.clear();
+		batch.image_barriers.clear();
+		return &batch;
+	}
+
+	bool upload_manager::retire_oldest_batch(bool wait)
+	{
+		auto& batch = m_batches[m_oldest_batch];
+		if (!batch.in_flight)
+			return false;
+
+		if (wait)
+		{
+			VkSemaphoreWaitInfo wait_info{};
+			wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+			wait_info.pSemaphores = &m_timeline;
+			wait_info.pValues = &batch.serial;
+			wait_info.semaphoreCount = 1;
+			m_device_functions.vkWaitSemaphores(m_device, &wait_info, UINT64_MAX);
+		}
+		else
+		{
+			uint64_t value = 0;
+			m_device_functions.vkGetSemaphoreCounterValue(m_device, m_timeline, &value);
+			if (value < batch.serial)
+				return false;
+		}
+
+		if (uses_separate_queue_family())
+		{
+			for (size_t i = 0; i < batch.buffer_barriers.size(); ++i)
+				m_pending_buffer_acquires.push_back(buffer_ownership_acquire(batch.buffer_barriers[i], BUFFER_READ_ACCESS));
+
+			for (size_t i = 0; i < batch.image_barriers.size(); ++i)
+				m_pending_image_acquires.push_back(image_ownership_acquire(batch.image_barriers[i], IMAGE_READ_ACCESS));
+		}
+
+		m_finished_serial = batch.serial;
+		m_ring_tail = batch.ring_end;
+		batch.in_flight = false;
+		--m_batches_in_flight;
+		m_oldest_batch = (m_oldest_batch + 1) % MAX_BATCHES_IN_FLIGHT;
+		return true;
+	}
+
+	// The ring holds the ranges of all batches between tail and head, possibly wrapping around the end. A range
+	// never wraps itself, the space left at the end is skipped instead.
+	datastructures::optional<VkDeviceSize> upload_manager::try_allocate_staging(VkDeviceSize size, VkDeviceSize alignment)
+	{
+		bool empty = m_batches_in_flight == 0 && !m_batches[m_current_batch].recording;
+		if (empty)
+			m_ring_head = m_ring_tail = 0;
+
+		datastructures::optional<VkDeviceSize> offset;
+		if (empty)
+		{
+			if (size <= m_ring_size)
+				offset = 0;
+		}
+		else if (m_ring_head > m_ring_tail)
+		{
+			auto aligned_head = align_up(m_ring_head, alignment);
+			if (aligned_head + size <= m_ring_size)
+				offset = aligned_head;
+			else if (size <= m_ring_tail)
+				offset = 0;
+		}
+		else if (m_ring_head < m_ring_tail)
+		{
+			auto aligned_head = align_up(m_ring_head, alignment);
+			if (aligned_head + size <= m_ring_tail)
+				offset = aligned_head;
+		}
+
+		if (offset.has_value())
+			m_ring_head = offset.value() + size;
+
+		return offset;
+	}
+}
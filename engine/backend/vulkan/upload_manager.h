@@ -0,0 +1,123 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include "datastructures/fixed_vector.h"
+#include "datastructures/optional.h"
+#include "datastructures/vector.h"
+#include "engine/backend/vulkan/memory_allocator.h"
+
+#include <memory>
+
+#include <volk/volk.h>
+
+namespace engine
+{
+	// Streams data into device local resources through a persistently mapped staging ring buffer. Uploads are
+	// batched into one command buffer per flush and submitted on the upload queue, which is a dedicated transfer
+	// queue when the device has one. Every batch signals its ticket on a timeline semaphore. The CPU polls that value
+	// to reuse staging memory, so it only blocks when the ring or every batch slot is still in use by the GPU.
+	// Uploads only complete once their batch has finished, so graphics work never waits for transfers in flight.
+	class upload_manager
+	{
+	public:
+		using ticket = uint64_t;
+
+		static constexpr VkDeviceSize DEFAULT_RING_SIZE = 32ull * 1024 * 1024;
+		static constexpr uint32_t MAX_BATCHES_IN_FLIGHT = 8;
+
+		static std::unique_ptr<upload_manager> create(VkPhysicalDevice, VkDevice, VolkDeviceTable const&, memory_allocator&,
+													  VkQueue upload_queue, uint32_t upload_queue_family, uint32_t graphics_queue_family,
+													  VkDeviceSize ring_size = DEFAULT_RING_SIZE);
+
+		upload_manager(VkDevice device, VolkDeviceTable const& device_functions, memory_allocator& allocator)
+			: m_device(device), m_device_functions(device_functions), m_allocator(allocator), m_batches(MAX_BATCHES_IN_FLIGHT) {}
+		~upload_manager();
+
+		upload_manager(upload_manager const&) = delete;
+		upload_manager& operator=(upload_manager const&) = delete;
+
+		// Both return 0 when the upload could not be recorded. Uploads larger than the ring are split for buffers,
+		// images have to fit in the ring as a whole.
+		ticket upload_buffer(VkBuffer, VkDeviceSize offset, void const* data, VkDeviceSize size);
+		// Uploads mip level 0 of the first layer of a color image and leaves it in SHADER_READ_ONLY_OPTIMAL.
+		ticket upload_image(VkImage, VkExtent3D, void const* data, VkDeviceSize size);
+
+		// Submits everything recorded since the previous flush.
+		void flush();
+
+		// Retires finished batches and records the queue family ownership acquires of every finished batch. Must be
+		// recorded into a graphics command buffer, whose successful submission is reported with commit_pending_barriers.
+		void record_pending_barriers(VkCommandBuffer);
+		// Completes the uploads whose acquires were last recorded. Until then they stay pending and are recorded again,
+		// so a command buffer that is never submitted loses nothing.
+		void commit_pending_barriers();
+
+		// Whether command buffers recorded from now on may use the resources of this upload. Their submission has to
+		// wait on timeline() reaching wait_value().
+		bool is_complete(ticket value) const { return value <= m_completed_serial; }
+
+		// The batches up to this value have finished already, waiting on it only orders their writes before the
+		// submission on the GPU, it never stalls.
+		VkSemaphore timeline() const { return m_timeline; }
+		uint64_t wait_value() const { return m_recorded_serial; }
+
+		bool uses_separate_queue_family() const { return m_upload_queue_family != m_graphics_queue_family; }
+
+	private:
+		struct batch
+		{
+			VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+			uint64_t serial = 0; // The value the batch signals on the timeline.
+			VkDeviceSize ring_end = 0;
+			bool recording = false;
+			bool in_flight = false;
+
+			// Recorded at the end of the batch: ownership releases when the upload queue has its own family,
+			// otherwise the barriers that make the copies visible to later graphics work.
+			datastructures::vector<VkBufferMemoryBarrier> buffer_barriers;
+			datastructures::vector<VkImageMemoryBarrier> image_barriers;
+		};
+
+		datastructures::optional<VkDeviceSize> allocate_staging(VkDeviceSize size, VkDeviceSize alignment);
+		batch* begin_batch();
+		bool retire_oldest_batch(bool wait);
+		datastructures::optional<VkDeviceSize> try_allocate_staging(VkDeviceSize size, VkDeviceSize alignment);
+
+		VkDevice m_device;
+		VolkDeviceTable const& m_device_functions;
+		memory_allocator& m_allocator;
+
+		VkQueue m_upload_queue = VK_NULL_HANDLE;
+		uint32_t m_upload_queue_family = 0;
+		uint32_t m_graphics_queue_family = 0;
+		VkCommandPool m_command_pool = VK_NULL_HANDLE;
+		VkSemaphore m_timeline = VK_NULL_HANDLE;
+
+		VkBuffer m_staging_buffer = VK_NULL_HANDLE;
+		memory_allocation m_staging_allocation;
+		VkDeviceSize m_ring_size = 0;
+		VkDeviceSize m_ring_head = 0; // Next free byte.
+		VkDeviceSize m_ring_tail = 0; // Start of the oldest range the GPU may still read.
+		VkDeviceSize m_copy_offset_alignment = 1;
+
+		datastructures::fixed_vector<batch> m_batches;
+		uint32_t m_current_batch = 0;
+		uint32_t m_oldest_batch = 0;
+		uint32_t m_batches_in_flight = 0;
+
+		uint64_t m_next_serial = 1;
+		uint64_t m_finished_serial = 0; // Of the newest batch retired.
+		uint64_t m_recorded_serial = 0; // Of the newest batch whose acquires were last recorded.
+		uint64_t m_completed_serial = 0;
+
+		// Acquires of finished batches, the first recorded counts of them were recorded into the last command buffer.
+		datastructures::vector<VkBufferMemoryBarrier> m_pending_buffer_acquires;
+		datastructures::vector<VkImageMemoryBarrier> m_pending_image_acquires;
+		size_t m_recorded_buffer_acquires = 0;
+		size_t m_recorded_image_acquires = 0;
+	};
+}
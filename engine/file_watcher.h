@@ -0,0 +1,28 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace engine
+{
+	// Reports files that were written in the watched directories, without blocking. Subdirectories aren't watched.
+	class file_watcher
+	{
+	public:
+		// Returns nullptr when watching can't be set up.
+		static std::unique_ptr<file_watcher> create();
+
+		virtual ~file_watcher() = default;
+
+		virtual bool watch_directory(char const* path) = 0;
+		// Appends the path of every file that was written or moved into a watched directory since the last call.
+		// Paths are the watched directory joined with the file name.
+		virtual void poll(std::vector<std::string>& changed_paths) = 0;
+	};
+}
@@ -0,0 +1,18 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/backend/vulkan/renderer.h"
+
+#include <iostream>
+
+namespace engine
+{
+	bool renderer_vulkan::create_window_surface(window const&)
+	{
+		// There is no window implementation for this platform yet, only headless rendering is supported.
+		std::cerr << "Failed creating window surface: windows are not supported on this platform" << std::endl;
+		return false;
+	}
+}
@@ -0,0 +1,81 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/file_watcher.h"
+
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <map>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace engine
+{
+	namespace
+	{
+		class file_watcher_linux final : public file_watcher
+		{
+		public:
+			explicit file_watcher_linux(int inotify) : m_inotify(inotify) {}
+			~file_watcher_linux() override { close(m_inotify); }
+
+			bool watch_directory(char const* path) override
+			{
+				// Editors and compilers either write in place or write a temporary file and rename it over the old one.
+				auto watch = inotify_add_watch(m_inotify, path, IN_CLOSE_WRITE | IN_MOVED_TO);
+				if (watch == -1)
+				{
+					std::cerr << std::format("Failed to watch directory {}: {}", path, std::strerror(errno)) << std::endl;
+					return false;
+				}
+
+				m_directories[watch] = path;
+				return true;
+			}
+
+			void poll(std::vector<std::string>& changed_paths) override
+			{
+				alignas(inotify_event) char buffer[4096];
+				while (true)
+				{
+					auto length = read(m_inotify, buffer, sizeof(buffer));
+					if (length <= 0)
+						break;
+
+					for (ssize_t offset = 0; offset < length;)
+					{
+						auto const* event = (inotify_event const*)(buffer + offset);
+						offset += sizeof(inotify_event) + event->len;
+
+						auto directory = m_directories.find(event->wd);
+						if (event->len == 0 || directory == m_directories.end())
+							continue;
+
+						changed_paths.push_back(directory->second + "/" + event->name);
+					}
+				}
+			}
+
+		private:
+			int m_inotify;
+			std::map<int, std::string> m_directories;
+		};
+	}
+
+	std::unique_ptr<file_watcher> file_watcher::create()
+	{
+		auto inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotify == -1)
+		{
+			std::cerr << std::format("Failed to create file watcher: {}", std::strerror(errno)) << std::endl;
+			return nullptr;
+		}
+
+		return std::make_unique<file_watcher_linux>(inotify);
+	}
+}
@@ -0,0 +1,160 @@
+/* Copyright (c) 2022, Thijs Waalen
+ *
+ * SPDX-License-Identifier: ISC
+ */
+
+#include "engine/file_watcher.h"
+
+#include "engine/platform/windows/utils.h"
+
+#include <iostream>
+
+#include <Windows.h>
+
+namespace engine
+{
+	namespace
+	{
+		// Every directory has a ReadDirectoryChangesW in flight, poll only checks whether it has completed and starts
+		// the next one. Changes made while no read is pending are buffered by the system. A directory whose read could
+		// not be started has none in flight, poll tries to start one again every time.
+		class file_watcher_windows final : public file_watcher
+		{
+		public:
+			~file_watcher_windows() override
+			{
+				// Waiting for a read that was never started would never return.
+				for (auto& directory : m_directories)
+				{
+					if (directory->pending)
+					{
+						CancelIoEx(directory->handle, &directory->overlapped);
+						DWORD bytes;
+						GetOverlappedResult(directory->handle, &directory->overlapped, &bytes, TRUE);
+					}
+					CloseHandle(directory->overlapped.hEvent);
+					CloseHandle(directory->handle);
+				}
+			}
+
+			bool watch_directory(char const* path) override
+			{
+				auto handle = CreateFileA(path, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+										  OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+				if (handle == INVALID_HANDLE_VALUE)
+				{
+					std::wcerr << L"Failed to watch directory " << path << L": " << error_message_from_win32_error_code(GetLastError())
+							   << std::endl;
+					return false;
+				}
+
+				auto directory = std::make_unique<watched_directory>();
+				directory->handle = handle;
+				directory->path = path;
+				directory->overlapped.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+				if (directory->overlapped.hEvent == nullptr || !read_changes(*directory))
+				{
+					std::wcerr << L"Failed to watch directory " << path << L": " << error_message_from_win32_error_code(GetLastError())
+							   << std::endl;
+					if (directory->overlapped.hEvent != nullptr)
+						CloseHandle(directory->overlapped.hEvent);
+					CloseHandle(handle);
+					return false;
+				}
+
+				directory->pending = true;
+				m_directories.push_back(std::move(directory));
+				return true;
+			}
+
+			void poll(std::vector<std::string>& changed_paths) override
+			{
+				for (auto& directory : m_directories)
+				{
+					if (!directory->pending)
+					{
+						start_read(*directory);
+						continue;
+					}
+
+					// A read that failed is over as well, its changes are lost and the next one is started.
+					DWORD bytes;
+					if (!GetOverlappedResult(directory->handle, &directory->overlapped, &bytes, FALSE))
+					{
+						auto error = GetLastError();
+						if (error != ERROR_IO_INCOMPLETE)
+						{
+							std::wcerr << L"Failed to read changes of " << directory->path.c_str() << L": "
+									   << error_message_from_win32_error_code(error) << std::endl;
+							directory->pending = false;
+							start_read(*directory);
+						}
+						continue;
+					}
+
+					directory->pending = false;
+
+					// Zero bytes means the system's buffer overflowed and the changes are lost.
+					for (DWORD offset = 0; bytes > 0;)
+					{
+						auto const* information = (FILE_NOTIFY_INFORMATION const*)(directory->buffer + offset);
+
+						// Editors and compilers either write in place or write a temporary file and rename it over the old one.
+						if (information->Action == FILE_ACTION_ADDED || information->Action == FILE_ACTION_MODIFIED ||
+							information->Action == FILE_ACTION_RENAMED_NEW_NAME)
+							changed_paths.push_back(directory->path + "/" + to_utf8(information->FileName, (int)(information->FileNameLength / sizeof(WCHAR))));
+
+						if (information->NextEntryOffset == 0)
+							break;
+						offset += information->NextEntryOffset;
+					}
+
+					start_read(*directory);
+				}
+			}
+
+		private:
+			struct watched_directory
+			{
+				HANDLE handle = INVALID_HANDLE_VALUE;
+				std::string path;
+				OVERLAPPED overlapped{};
+				bool pending = false; // A read is in flight and owns overlapped and buffer.
+				alignas(DWORD) char buffer[16 * 1024];
+			};
+
+			static bool read_changes(watched_directory& directory)
+			{
+				return ReadDirectoryChangesW(directory.handle, directory.buffer, sizeof(directory.buffer), FALSE,
+											 FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE, nullptr, &directory.overlapped,
+											 nullptr) != FALSE;
+			}
+
+			// The previous read's result is only consumed once, the event still reports it as completed until reset.
+			static void start_read(watched_directory& directory)
+			{
+				ResetEvent(directory.overlapped.hEvent);
+				directory.pending = read_changes(directory);
+				if (!directory.pending)
+					std::wcerr << L"Failed to read changes of " << directory.path.c_str() << L": "
+							   << error_message_from_win32_error_code(GetLastError()) << std::endl;
+			}
+
+			static std::string to_utf8(WCHAR const* name, int length)
+			{
+				auto size = WideCharToMultiByte(CP_UTF8, 0, name, length, nullptr, 0, nullptr, nullptr);
+				std::string result(size, '\0');
+				WideCharToMultiByte(CP_UTF8, 0, name, length, result.data(), size, nullptr, nullptr);
+				return result;
+			}
+
+			// The system writes into the buffer and overlapped of a pending read, so they must not move.
+			std::vector<std::unique_ptr<watched_directory>> m_directories;
+		};
+	}
+
+	std::unique_ptr<file_watcher> file_watcher::create()
+	{
+		return std::make_unique<file_watcher_windows>();
+	}
+}
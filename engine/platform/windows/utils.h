@@ -13,7 +13,7 @@
 
 namespace engine
 {
-	std::wstring error_message_from_win32_error_code(DWORD errorCode)
+	inline std::wstring error_message_from_win32_error_code(DWORD errorCode)
 	{
 		LPWSTR errorMessage;
 		FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM,
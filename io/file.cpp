@@ -5,17 +5,26 @@
 
 #include "file.h"
 
+#include <cstdio>
+#include <filesystem>
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <string>
 
 using datastructures::fixed_vector;
 
 namespace io
 {
+	bool file_exists(char const* path)
+	{
+		std::error_code error;
+		return std::filesystem::is_regular_file(path, error);
+	}
+
 	fixed_vector<char> read_entire_file(char const* path, file_mode mode)
 	{
-		int open_mode = std::ios::ate;
+		std::ios::openmode open_mode = std::ios::ate;
 		if (mode == file_mode::binary)
 			open_mode |= std::ios::binary;
 
@@ -50,4 +59,40 @@ namespace io
 
 		return data;
 	}
+
+	bool write_entire_file(char const* path, void const* data, size_t size, file_mode mode)
+	{
+		auto temporary_path = std::string(path) + ".tmp";
+
+		{
+			std::ios::openmode open_mode = std::ios::trunc;
+			if (mode == file_mode::binary)
+				open_mode |= std::ios::binary;
+
+			std::ofstream file(temporary_path, open_mode);
+			if (!file)
+			{
+				std::cerr << std::format("Failed to open file {}", temporary_path) << std::endl;
+				return false;
+			}
+
+			file.write(static_cast<char const*>(data), size);
+			if (file.fail())
+			{
+				std::cerr << std::format("Failed to write all data to {}", temporary_path) << std::endl;
+				return false;
+			}
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporary_path, path, error);
+		if (error)
+		{
+			std::cerr << std::format("Failed to replace {}: {}", path, error.message()) << std::endl;
+			std::remove(temporary_path.c_str());
+			return false;
+		}
+
+		return true;
+	}
 }
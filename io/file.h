@@ -15,5 +15,8 @@ namespace io
 		binary
 	};
 
+	bool file_exists(char const* path);
 	datastructures::fixed_vector<char> read_entire_file(char const* path, file_mode);
+	// Writes to a temporary file first and then replaces the destination, so readers never observe partial data.
+	bool write_entire_file(char const* path, void const* data, size_t size, file_mode);
 }
@@ -33,6 +33,10 @@ int main()
 	if (renderer == nullptr)
 		return -1;
 
+	// Shaders can be edited while running, only worth the watcher thread while developing.
+	if (debug_renderer == renderer_vulkan::debug_output::enabled)
+		renderer->enable_shader_hot_reload();
+
 	while (!window->should_close())
 	{
 		window->update();
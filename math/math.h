@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <cmath>
+
 namespace math
 {
 	template <typename T>
@@ -13,4 +15,115 @@ namespace math
 		return value < min ? min : value < max ? value
 											   : max;
 	}
+
+	struct vec3
+	{
+		float x, y, z;
+	};
+
+	constexpr vec3 operator+(vec3 const& a, vec3 const& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+	constexpr vec3 operator-(vec3 const& a, vec3 const& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+	constexpr vec3 operator*(vec3 const& v, float s) { return { v.x * s, v.y * s, v.z * s }; }
+
+	constexpr float dot(vec3 const& a, vec3 const& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	constexpr vec3 cross(vec3 const& a, vec3 const& b)
+	{
+		return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	}
+
+	inline vec3 normalize(vec3 const& v)
+	{
+		return v * (1.f / std::sqrt(dot(v, v)));
+	}
+
+	// Column major, matching GLSL, so it can be copied into buffers and push constants as is.
+	struct mat4
+	{
+		float m[16];
+
+		static constexpr mat4 identity()
+		{
+			return { { 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f } };
+		}
+
+		constexpr float& operator()(int row, int column) { return m[column * 4 + row]; }
+		constexpr float operator()(int row, int column) const { return m[column * 4 + row]; }
+	};
+
+	constexpr mat4 operator*(mat4 const& a, mat4 const& b)
+	{
+		mat4 result{};
+		for (int column = 0; column < 4; ++column)
+		{
+			for (int row = 0; row < 4; ++row)
+			{
+				float sum = 0.f;
+				for (int i = 0; i < 4; ++i)
+					sum += a(row, i) * b(i, column);
+				result(row, column) = sum;
+			}
+		}
+
+		return result;
+	}
+
+	constexpr mat4 translation(vec3 const& offset)
+	{
+		auto result = mat4::identity();
+		result(0, 3) = offset.x;
+		result(1, 3) = offset.y;
+		result(2, 3) = offset.z;
+		return result;
+	}
+
+	constexpr mat4 scaling(float scale)
+	{
+		auto result = mat4::identity();
+		result(0, 0) = scale;
+		result(1, 1) = scale;
+		result(2, 2) = scale;
+		return result;
+	}
+
+	// Right handed view space looking down -z.
+	inline mat4 look_at(vec3 const& eye, vec3 const& target, vec3 const& up)
+	{
+		auto forward = normalize(target - eye);
+		auto right = normalize(cross(forward, up));
+		auto camera_up = cross(right, forward);
+
+		auto result = mat4::identity();
+		result(0, 0) = right.x;
+		result(0, 1) = right.y;
+		result(0, 2) = right.z;
+		result(1, 0) = camera_up.x;
+		result(1, 1) = camera_up.y;
+		result(1, 2) = camera_up.z;
+		result(2, 0) = -forward.x;
+		result(2, 1) = -forward.y;
+		result(2, 2) = -forward.z;
+		result(0, 3) = -dot(right, eye);
+		result(1, 3) = -dot(camera_up, eye);
+		result(2, 3) = dot(forward, eye);
+		return result;
+	}
+
+	// Vulkan clip space: depth from 0 to 1 and y pointing down, which is flipped here so counter clockwise
+	// triangles in view space stay counter clockwise on screen.
+	inline mat4 perspective(float vertical_fov, float aspect_ratio, float near_plane, float far_plane)
+	{
+		float focal_length = 1.f / std::tan(vertical_fov * 0.5f);
+
+		mat4 result{};
+		result(0, 0) = focal_length / aspect_ratio;
+		result(1, 1) = -focal_length;
+		result(2, 2) = far_plane / (near_plane - far_plane);
+		result(2, 3) = near_plane * far_plane / (near_plane - far_plane);
+		result(3, 2) = -1.f;
+		return result;
+	}
 }
@@ -5,6 +5,8 @@ function(compile_shader target)
             set(stage "vertex")
         elseif(${source} MATCHES "\.frag\.glsl$")
             set(stage "fragment")
+        elseif(${source} MATCHES "\.comp\.glsl$")
+            set(stage "compute")
         endif()
 
         string(LENGTH ${source} source_length)
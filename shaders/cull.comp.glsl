@@ -0,0 +1,71 @@
+#version 450
+
+layout(local_size_x = 64) in;
+
+struct instance
+{
+	mat4 transform;
+	vec4 color;
+	uint material;
+};
+
+struct draw_command
+{
+	uint index_count;
+	uint instance_count;
+	uint first_index;
+	int vertex_offset;
+	uint first_instance;
+};
+
+layout(set = 0, binding = 0) readonly buffer instance_buffer
+{
+	instance instances[];
+};
+
+// One command per frame in flight, reset to no instances before the dispatch.
+layout(set = 0, binding = 1) buffer draw_command_buffer
+{
+	draw_command draw_commands[];
+};
+
+// The indices of the visible instances, in a range of instance_count per frame in flight.
+layout(set = 0, binding = 2) writeonly buffer visible_instance_buffer
+{
+	uint visible_instances[];
+};
+
+// Written once per frame, shared by the dispatches of every batch.
+layout(set = 1, binding = 0) uniform frame_constants
+{
+	vec4 frustum_planes[6];
+	uint draw_command_index;
+};
+
+layout(push_constant) uniform constants
+{
+	vec4 bounding_sphere; // Mesh space center and radius.
+	uint instance_count;
+	uint first_visible_instance;
+};
+
+void main()
+{
+	uint instance_index = gl_GlobalInvocationID.x;
+	if (instance_index >= instance_count)
+		return;
+
+	mat4 transform = instances[instance_index].transform;
+	vec3 center = (transform * vec4(bounding_sphere.xyz, 1.0)).xyz;
+	float scale = max(max(length(transform[0].xyz), length(transform[1].xyz)), length(transform[2].xyz));
+	float radius = bounding_sphere.w * scale;
+
+	for (int i = 0; i < 6; ++i)
+	{
+		if (dot(frustum_planes[i].xyz, center) + frustum_planes[i].w < -radius)
+			return;
+	}
+
+	uint visible_index = atomicAdd(draw_commands[draw_command_index].instance_count, 1);
+	visible_instances[first_visible_instance + visible_index] = instance_index;
+}
@@ -0,0 +1,41 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct material
+{
+	vec4 base_color;
+	uint base_color_texture;
+};
+
+// The bindless heap, see bindless_heap.h.
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+layout(set = 0, binding = 1) readonly buffer material_buffer
+{
+	material materials[];
+} buffers[];
+
+layout(push_constant) uniform constants
+{
+	mat4 view_projection;
+	uint material_buffer_index;
+};
+
+layout(location = 0) in vec3 fragment_color;
+layout(location = 1) in vec2 fragment_uv;
+layout(location = 2) flat in uint fragment_material;
+
+layout(location = 0) out vec4 out_color;
+
+const uint NO_TEXTURE = 0xffffffff;
+
+void main()
+{
+	material current = buffers[material_buffer_index].materials[fragment_material];
+
+	// Instances with different materials can share a draw, so the texture index is not uniform.
+	vec4 color = vec4(fragment_color, 1.0) * current.base_color;
+	if (current.base_color_texture != NO_TEXTURE)
+		color *= texture(textures[nonuniformEXT(current.base_color_texture)], fragment_uv);
+
+	out_color = color;
+}
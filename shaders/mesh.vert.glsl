@@ -0,0 +1,31 @@
+#version 450
+
+layout(push_constant) uniform constants
+{
+	mat4 view_projection;
+	uint material_buffer;
+};
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 uv;
+layout(location = 3) in mat4 instance_transform;
+layout(location = 7) in vec4 instance_color;
+layout(location = 8) in uint instance_material;
+
+layout(location = 0) out vec3 fragment_color;
+layout(location = 1) out vec2 fragment_uv;
+layout(location = 2) flat out uint fragment_material;
+
+const vec3 light_direction = normalize(vec3(0.4, 1.0, 0.6));
+
+void main()
+{
+	gl_Position = view_projection * instance_transform * vec4(position, 1.0);
+
+	vec3 world_normal = normalize(mat3(instance_transform) * normal);
+	float lighting = 0.25 + 0.75 * max(dot(world_normal, light_direction), 0.0);
+	fragment_color = instance_color.rgb * lighting;
+	fragment_uv = uv;
+	fragment_material = instance_material;
+}
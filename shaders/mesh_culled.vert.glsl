@@ -0,0 +1,54 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct instance
+{
+	mat4 transform;
+	vec4 color;
+	uint material;
+};
+
+// The bindless heap, see bindless_heap.h. Culling leaves the instances where they are and only writes the indices of
+// the visible ones, so the draw reads them from the batch's instance buffer instead of a per instance binding.
+layout(set = 0, binding = 1) readonly buffer instance_buffer
+{
+	instance instances[];
+} instance_buffers[];
+
+layout(set = 0, binding = 1) readonly buffer visible_instance_buffer
+{
+	uint visible_instances[];
+} visible_instance_buffers[];
+
+layout(push_constant) uniform constants
+{
+	mat4 view_projection;
+	uint material_buffer;
+	uint instance_buffer;
+	uint visible_instance_buffer;
+	uint first_visible_instance;
+};
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 uv;
+
+layout(location = 0) out vec3 fragment_color;
+layout(location = 1) out vec2 fragment_uv;
+layout(location = 2) flat out uint fragment_material;
+
+const vec3 light_direction = normalize(vec3(0.4, 1.0, 0.6));
+
+void main()
+{
+	uint instance_index = visible_instance_buffers[visible_instance_buffer].visible_instances[first_visible_instance + gl_InstanceIndex];
+	instance current = instance_buffers[instance_buffer].instances[instance_index];
+
+	gl_Position = view_projection * current.transform * vec4(position, 1.0);
+
+	vec3 world_normal = normalize(mat3(current.transform) * normal);
+	float lighting = 0.25 + 0.75 * max(dot(world_normal, light_direction), 0.0);
+	fragment_color = current.color.rgb * lighting;
+	fragment_uv = uv;
+	fragment_material = current.material;
+}